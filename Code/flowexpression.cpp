@@ -0,0 +1,582 @@
+#include <climits>
+#include <cstring>
+#include "flowexpression.h"
+
+static const json s_null = nullptr;
+static const json s_true = true;
+static const json s_false = false;
+
+static bool isNameStart(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool isNameChar(char c)
+{
+    return isNameStart(c) || (c >= '0' && c <= '9');
+}
+
+bool FlowExpression::compile(const std::string &source)
+{
+    this->source = source;
+    position = 0;
+    depth = 0;
+    maxDepth = 0;
+    code.clear();
+    constants.clear();
+    paths.clear();
+    errorMessage = "";
+    errorColumn = -1;
+
+    if (!parseOr())
+        return false;
+    skipSpaces();
+    if (position < source.size())
+        return fail("Unexpected \"" + source.substr(position, 1) + "\"");
+    if (maxDepth > MAX_STACK_DEPTH)
+        return fail("Condition is nested too deeply");
+    return true;
+}
+
+bool FlowExpression::fail(const std::string &message)
+{
+    if (errorMessage.empty())
+    {
+        errorMessage = message;
+        errorColumn = (int)position + 1;
+    }
+    return false;
+}
+
+void FlowExpression::emit(Opcode op, int operand)
+{
+    code.push_back({op, operand});
+
+    // Track how deep the stack gets so evaluation can use a fixed array
+    if (op == OP_PUSH_CONSTANT || op == OP_LOAD_PATH)
+        depth++;
+    else if (op == OP_POP || (op >= OP_EQUAL && op <= OP_GREATER_EQUAL))
+        depth--;
+    if (depth > maxDepth)
+        maxDepth = depth;
+}
+
+void FlowExpression::skipSpaces()
+{
+    while (position < source.size() && (source[position] == ' ' || source[position] == '\t' || source[position] == '\n' || source[position] == '\r'))
+        position++;
+}
+
+bool FlowExpression::match(const char *text)
+{
+    skipSpaces();
+    size_t length = std::strlen(text);
+    if (source.compare(position, length, text) != 0)
+        return false;
+    position += length;
+    return true;
+}
+
+bool FlowExpression::matchWord(const char *word)
+{
+    skipSpaces();
+    size_t length = std::strlen(word);
+    if (source.compare(position, length, word) != 0)
+        return false;
+    if (position + length < source.size() && isNameChar(source[position + length]))
+        return false;
+    position += length;
+    return true;
+}
+
+bool FlowExpression::parseOr()
+{
+    if (!parseAnd())
+        return false;
+    while (match("||") || matchWord("or"))
+    {
+        // a || b: keep a if it is true, otherwise drop it and use b
+        emit(OP_TO_BOOL);
+        size_t jump = code.size();
+        emit(OP_JUMP_IF_TRUE);
+        emit(OP_POP);
+        if (!parseAnd())
+            return false;
+        emit(OP_TO_BOOL);
+        code[jump].operand = (int)code.size();
+    }
+    return true;
+}
+
+bool FlowExpression::parseAnd()
+{
+    if (!parseNot())
+        return false;
+    while (match("&&") || matchWord("and"))
+    {
+        emit(OP_TO_BOOL);
+        size_t jump = code.size();
+        emit(OP_JUMP_IF_FALSE);
+        emit(OP_POP);
+        if (!parseNot())
+            return false;
+        emit(OP_TO_BOOL);
+        code[jump].operand = (int)code.size();
+    }
+    return true;
+}
+
+bool FlowExpression::parseNot()
+{
+    skipSpaces();
+    // ! but not the start of !=
+    bool negate = position < source.size() && source[position] == '!' && source.compare(position, 2, "!=") != 0;
+    if (negate)
+        position++;
+    else
+        negate = matchWord("not");
+    if (negate)
+    {
+        if (!parseNot())
+            return false;
+        emit(OP_NOT);
+        return true;
+    }
+    return parseComparison();
+}
+
+bool FlowExpression::parseComparison()
+{
+    if (!parsePrimary())
+        return false;
+
+    // Two-character operators first
+    static const struct
+    {
+        const char *text;
+        Opcode op;
+    } operators[] = {{"==", OP_EQUAL}, {"!=", OP_NOT_EQUAL}, {"<=", OP_LESS_EQUAL}, {">=", OP_GREATER_EQUAL}, {"<", OP_LESS}, {">", OP_GREATER}};
+    for (const auto &comparison : operators)
+    {
+        if (match(comparison.text))
+        {
+            if (!parsePrimary())
+                return false;
+            emit(comparison.op);
+            return true;
+        }
+    }
+    return true;
+}
+
+bool FlowExpression::parsePrimary()
+{
+    skipSpaces();
+    if (position >= source.size())
+        return fail("Condition ends too early");
+
+    char c = source[position];
+    if (c == '(')
+    {
+        position++;
+        if (!parseOr())
+            return false;
+        if (!match(")"))
+            return fail("Missing )");
+        return true;
+    }
+    if (c == '"' || c == '\'')
+    {
+        std::string value;
+        if (!parseString(value))
+            return false;
+        constants.push_back(value);
+        emit(OP_PUSH_CONSTANT, (int)constants.size() - 1);
+        return true;
+    }
+    if ((c >= '0' && c <= '9') || c == '-' || c == '.')
+    {
+        size_t start = position;
+        position++;
+        while (position < source.size() && ((source[position] >= '0' && source[position] <= '9') || source[position] == '.' ||
+                                            source[position] == 'e' || source[position] == 'E'))
+        {
+            // An exponent can have a sign, like 1e-5
+            bool exponent = source[position] == 'e' || source[position] == 'E';
+            position++;
+            if (exponent && position < source.size() && (source[position] == '-' || source[position] == '+'))
+                position++;
+        }
+        json number = json::parse(source.substr(start, position - start), nullptr, false);
+        if (number.is_discarded())
+        {
+            position = start;
+            return fail("Invalid number");
+        }
+        constants.push_back(number);
+        emit(OP_PUSH_CONSTANT, (int)constants.size() - 1);
+        return true;
+    }
+    if (c == '$')
+    {
+        position++;
+        return parsePath(true);
+    }
+    if (matchWord("true"))
+    {
+        constants.push_back(true);
+        emit(OP_PUSH_CONSTANT, (int)constants.size() - 1);
+        return true;
+    }
+    if (matchWord("false"))
+    {
+        constants.push_back(false);
+        emit(OP_PUSH_CONSTANT, (int)constants.size() - 1);
+        return true;
+    }
+    if (matchWord("null"))
+    {
+        constants.push_back(nullptr);
+        emit(OP_PUSH_CONSTANT, (int)constants.size() - 1);
+        return true;
+    }
+    if (isNameStart(c))
+    {
+        return parsePath(false);
+    }
+    return fail("Unexpected \"" + source.substr(position, 1) + "\"");
+}
+
+bool FlowExpression::parsePath(bool fromRoot)
+{
+    std::vector<PathStep> steps;
+    if (!fromRoot)
+    {
+        // A bare name is a field of the payload
+        PathStep step;
+        if (!parseName(step.key))
+            return false;
+        steps.push_back(step);
+    }
+
+    while (position < source.size())
+    {
+        if (source[position] == '.')
+        {
+            position++;
+            PathStep step;
+            if (!parseName(step.key))
+                return false;
+            steps.push_back(step);
+        }
+        else if (source[position] == '[')
+        {
+            position++;
+            skipSpaces();
+            PathStep step;
+            if (position < source.size() && (source[position] == '"' || source[position] == '\''))
+            {
+                if (!parseString(step.key))
+                    return false;
+            }
+            else
+            {
+                size_t start = position;
+                int index = 0;
+                while (position < source.size() && source[position] >= '0' && source[position] <= '9')
+                {
+                    int digit = source[position] - '0';
+                    if (index > (INT_MAX - digit) / 10)
+                    {
+                        position = start;
+                        return fail("Index too large");
+                    }
+                    index = index * 10 + digit;
+                    position++;
+                }
+                if (start == position)
+                    return fail("Expected an index or a quoted key");
+                step.index = index;
+            }
+            if (!match("]"))
+                return fail("Missing ]");
+            steps.push_back(step);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    paths.push_back(steps);
+    emit(OP_LOAD_PATH, (int)paths.size() - 1);
+    return true;
+}
+
+bool FlowExpression::parseName(std::string &name)
+{
+    size_t start = position;
+    if (position >= source.size() || !isNameStart(source[position]))
+        return fail("Expected a field name");
+    while (position < source.size() && isNameChar(source[position]))
+        position++;
+    name = source.substr(start, position - start);
+    return true;
+}
+
+bool FlowExpression::parseString(std::string &value)
+{
+    char quote = source[position];
+    size_t start = position;
+    position++;
+    while (position < source.size() && source[position] != quote)
+    {
+        if (source[position] == '\\' && position + 1 < source.size())
+            position++;
+        value += source[position];
+        position++;
+    }
+    if (position >= source.size())
+    {
+        position = start;
+        return fail("Missing closing quote");
+    }
+    position++;
+    return true;
+}
+
+json FlowExpression::parsePayload(const std::string &input)
+{
+    json payload = json::parse(input, nullptr, false);
+    if (payload.is_discarded())
+        return input;
+
+    // Job outputs are often JSON that was wrapped in a JSON string on the way
+    if (payload.is_string())
+    {
+        json inner = json::parse(payload.get_ref<const std::string &>(), nullptr, false);
+        if (!inner.is_discarded() && (inner.is_object() || inner.is_array()))
+            return inner;
+    }
+    return payload;
+}
+
+bool FlowExpression::isTruthy(const json &value)
+{
+    if (value.is_null())
+        return false;
+    if (value.is_boolean())
+        return value.get<bool>();
+    if (value.is_number())
+        return value.get<double>() != 0;
+    // Strings, arrays and objects
+    return !value.empty();
+}
+
+const json *FlowExpression::run(const json &payload) const
+{
+    const json *stack[MAX_STACK_DEPTH];
+    int top = -1;
+
+    for (size_t pc = 0; pc < code.size(); pc++)
+    {
+        const Instruction &instruction = code[pc];
+        switch (instruction.op)
+        {
+        case OP_PUSH_CONSTANT:
+            stack[++top] = &constants[instruction.operand];
+            break;
+        case OP_LOAD_PATH:
+        {
+            const json *value = &payload;
+            for (const PathStep &step : paths[instruction.operand])
+            {
+                if (step.index >= 0)
+                {
+                    value = value->is_array() && step.index < (int)value->size() ? &(*value)[step.index] : &s_null;
+                }
+                else if (value->is_object())
+                {
+                    json::const_iterator field = value->find(step.key);
+                    value = field != value->end() ? &*field : &s_null;
+                }
+                else
+                {
+                    value = &s_null;
+                }
+            }
+            stack[++top] = value;
+            break;
+        }
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        {
+            const json &right = *stack[top--];
+            const json &left = *stack[top];
+            bool sameType = (left.is_number() && right.is_number()) || left.type() == right.type();
+            bool result = false;
+            if (instruction.op == OP_EQUAL)
+                result = sameType && left == right;
+            else if (instruction.op == OP_NOT_EQUAL)
+                result = !sameType || left != right;
+            else if (sameType && (left.is_number() || left.is_string()))
+            {
+                if (instruction.op == OP_LESS)
+                    result = left < right;
+                else if (instruction.op == OP_LESS_EQUAL)
+                    result = left <= right;
+                else if (instruction.op == OP_GREATER)
+                    result = left > right;
+                else
+                    result = left >= right;
+            }
+            stack[top] = result ? &s_true : &s_false;
+            break;
+        }
+        case OP_NOT:
+            stack[top] = isTruthy(*stack[top]) ? &s_false : &s_true;
+            break;
+        case OP_TO_BOOL:
+            stack[top] = isTruthy(*stack[top]) ? &s_true : &s_false;
+            break;
+        case OP_JUMP_IF_FALSE:
+            if (stack[top] == &s_false)
+                pc = instruction.operand - 1;
+            break;
+        case OP_JUMP_IF_TRUE:
+            if (stack[top] == &s_true)
+                pc = instruction.operand - 1;
+            break;
+        case OP_POP:
+            top--;
+            break;
+        }
+    }
+    return top >= 0 ? stack[top] : &s_null;
+}
+
+json FlowExpression::evaluate(const json &payload) const
+{
+    return *run(payload);
+}
+
+bool FlowExpression::test(const json &payload) const
+{
+    return isTruthy(*run(payload));
+}
+
+bool FlowExpression::test(const std::string &input) const
+{
+    if (!usesPayload())
+        return isTruthy(*run(s_null));
+    return isTruthy(*run(parsePayload(input)));
+}
+
+std::string FlowExpression::evaluateKey(const std::string &input) const
+{
+    json payload = usesPayload() ? parsePayload(input) : json();
+    const json *value = run(payload);
+    return value->is_string() ? value->get<std::string>() : value->dump();
+}
+
+json FlowExpression::toJson() const
+{
+    json saved;
+    saved["source"] = source;
+    saved["constants"] = constants;
+    saved["code"] = json::array();
+    for (const Instruction &instruction : code)
+        saved["code"].push_back({(int)instruction.op, instruction.operand});
+    saved["paths"] = json::array();
+    for (const std::vector<PathStep> &steps : paths)
+    {
+        json path = json::array();
+        for (const PathStep &step : steps)
+            path.push_back(step.index >= 0 ? json(step.index) : json(step.key));
+        saved["paths"].push_back(path);
+    }
+    return saved;
+}
+
+bool FlowExpression::fromJson(const json &saved)
+{
+    try
+    {
+        source = saved["source"];
+        constants = saved["constants"].get<std::vector<json>>();
+        code.clear();
+        paths.clear();
+        for (const json &path : saved["paths"])
+        {
+            std::vector<PathStep> steps;
+            for (const json &savedStep : path)
+            {
+                PathStep step;
+                if (savedStep.is_number_integer())
+                    step.index = savedStep;
+                else
+                    step.key = savedStep;
+                steps.push_back(step);
+            }
+            paths.push_back(steps);
+        }
+
+        // Operands have to point at something that exists, the cache file may be from elsewhere
+        for (const json &savedInstruction : saved["code"])
+        {
+            int op = savedInstruction[0].get<int>();
+            Instruction instruction = {(Opcode)op, savedInstruction[1].get<int>()};
+            int limit = op == OP_PUSH_CONSTANT ? (int)constants.size() : op == OP_LOAD_PATH ? (int)paths.size() : INT32_MAX;
+            if (op < OP_PUSH_CONSTANT || op > OP_POP || instruction.operand < 0 || instruction.operand >= limit)
+                return false;
+            code.push_back(instruction);
+        }
+    }
+    catch (const json::exception &)
+    {
+        return false;
+    }
+    return checkStack();
+}
+
+bool FlowExpression::checkStack()
+{
+    // Replay the stack depth the way run() would see it instead of trusting the saved one.
+    // Jumps only go forward and every way into an instruction has to agree on the depth.
+    std::vector<int> depthAt(code.size() + 1, -1);
+    depthAt[0] = 0;
+    maxDepth = 0;
+    for (size_t pc = 0; pc < code.size(); pc++)
+    {
+        int before = depthAt[pc];
+        const Instruction &instruction = code[pc];
+        int needed = 1, after = before;
+        if (instruction.op == OP_PUSH_CONSTANT || instruction.op == OP_LOAD_PATH)
+            needed = 0, after = before + 1;
+        else if (instruction.op >= OP_EQUAL && instruction.op <= OP_GREATER_EQUAL)
+            needed = 2, after = before - 1;
+        else if (instruction.op == OP_POP)
+            after = before - 1;
+        if (before < needed || after > MAX_STACK_DEPTH)
+            return false;
+        if (after > maxDepth)
+            maxDepth = after;
+
+        if (instruction.op == OP_JUMP_IF_FALSE || instruction.op == OP_JUMP_IF_TRUE)
+        {
+            int target = instruction.operand;
+            if (target <= (int)pc || target > (int)code.size() || (depthAt[target] != -1 && depthAt[target] != after))
+                return false;
+            depthAt[target] = after;
+        }
+        if (depthAt[pc + 1] != -1 && depthAt[pc + 1] != after)
+            return false;
+        depthAt[pc + 1] = after;
+    }
+    // Every path ends with just the result
+    return depthAt[code.size()] == 1;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "./lib/json.hpp"
+using json = nlohmann::json;
+
+// Condition of an if (or the value of a switch) node, compiled once into a small stack
+// program so every evaluation only runs instructions over the payload.
+//
+//   expression : or
+//   or         : and ('||' and)*
+//   and        : not ('&&' not)*
+//   not        : '!' not | comparison
+//   comparison : primary [('==' | '!=' | '<' | '<=' | '>' | '>=') primary]
+//   primary    : number | string | true | false | null | path | '(' expression ')'
+//   path       : ('$' | name) ('.' name | '[' (number | string) ']')*
+//
+// $ is the node's input parsed as JSON, and a bare name is a field of it (status == $.status).
+// and, or and not can be written as words too. Missing fields are null, comparing values of
+// different types is false (but != is true), and && and || give true or false.
+class FlowExpression
+{
+public:
+    bool compile(const std::string &source);
+    std::string getErrorMessage() const { return errorMessage; }
+    int getErrorColumn() const { return errorColumn; } // Column inside the source, from 1
+
+    bool usesPayload() const { return !paths.empty(); }
+    static json parsePayload(const std::string &input);
+
+    json evaluate(const json &payload) const;
+    bool test(const json &payload) const;
+    bool test(const std::string &input) const; // Parses the input only if a path needs it
+    std::string evaluateKey(const std::string &input) const; // Strings as they are, other values as JSON
+
+    static bool isTruthy(const json &value);
+
+    // The compiled program, so it can be stored and loaded without compiling the source again
+    json toJson() const;
+    bool fromJson(const json &saved);
+
+private:
+    enum Opcode : uint8_t
+    {
+        OP_PUSH_CONSTANT, // operand: constant index
+        OP_LOAD_PATH,     // operand: path index
+        OP_EQUAL,
+        OP_NOT_EQUAL,
+        OP_LESS,
+        OP_LESS_EQUAL,
+        OP_GREATER,
+        OP_GREATER_EQUAL,
+        OP_NOT,
+        OP_TO_BOOL,
+        OP_JUMP_IF_FALSE, // operand: target, the value stays on the stack
+        OP_JUMP_IF_TRUE,
+        OP_POP
+    };
+    struct Instruction
+    {
+        Opcode op;
+        int operand;
+    };
+    struct PathStep
+    {
+        std::string key; // Used when index is -1
+        int index = -1;
+    };
+
+    static constexpr int MAX_STACK_DEPTH = 64;
+
+    const json *run(const json &payload) const;
+
+    // Parser, only used while compiling
+    bool parseOr();
+    bool parseAnd();
+    bool parseNot();
+    bool parseComparison();
+    bool parsePrimary();
+    bool parsePath(bool fromRoot);
+    bool parseName(std::string &name);
+    bool parseString(std::string &value);
+    void skipSpaces();
+    bool match(const char *text);
+    bool matchWord(const char *word);
+    bool fail(const std::string &message);
+    void emit(Opcode op, int operand = 0);
+    bool checkStack(); // For loaded code, which the compiler didn't vouch for
+
+    std::vector<Instruction> code;
+    std::vector<json> constants;
+    std::vector<std::vector<PathStep>> paths;
+    int maxDepth = 0;
+
+    std::string source;
+    size_t position = 0;
+    int depth = 0;
+    std::string errorMessage;
+    int errorColumn = -1;
+};
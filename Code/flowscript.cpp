@@ -0,0 +1,888 @@
+#include <cctype>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "flowscript.h"
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Plain ASCII checks, the <cctype> ones go through the locale on every character
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool isIdStart(char c)
+{
+    // DOT also allows any byte above ASCII in names
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (unsigned char)c >= 0x80;
+}
+
+static bool isIdChar(char c)
+{
+    return isIdStart(c) || isDigit(c);
+}
+
+void FlowScriptLexer::advance()
+{
+    if (source[position] == '\n')
+    {
+        line++;
+        column = 1;
+    }
+    else
+    {
+        column++;
+    }
+    position++;
+}
+
+FlowToken FlowScriptLexer::makeToken(FlowTokenType type, size_t start, int line, int column)
+{
+    FlowToken token;
+    token.type = type;
+    token.text = std::string_view(source + start, position - start);
+    token.span = {line, column, this->line, this->column};
+    return token;
+}
+
+FlowToken FlowScriptLexer::makeError(const char *message, int line, int column)
+{
+    FlowToken token;
+    token.type = FLOW_TOKEN_INVALID;
+    token.text = message;
+    token.span = {line, column, this->line, this->column};
+    return token;
+}
+
+void FlowScriptLexer::skipWhitespaceAndComments(FlowToken &error)
+{
+    while (position < size)
+    {
+        char c = source[position];
+        if (c == ' ' || c == '\t' || c == '\r')
+        {
+            position++;
+            column++;
+        }
+        else if (c == '\n' || c == '\v' || c == '\f')
+        {
+            advance();
+        }
+        // Line comment, or a C preprocessor line as DOT allows
+        else if ((c == '/' && peek(1) == '/') || (c == '#' && column == 1))
+        {
+            while (position < size && source[position] != '\n')
+                advance();
+        }
+        else if (c == '/' && peek(1) == '*')
+        {
+            int startLine = line, startColumn = column;
+            advance();
+            advance();
+            while (position < size && !(source[position] == '*' && peek(1) == '/'))
+                advance();
+            if (position >= size)
+            {
+                error = makeError("Missing end of comment", startLine, startColumn);
+                return;
+            }
+            advance();
+            advance();
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+FlowToken FlowScriptLexer::next()
+{
+    FlowToken error;
+    skipWhitespaceAndComments(error);
+    if (error.type == FLOW_TOKEN_INVALID)
+        return error;
+
+    size_t start = position;
+    int startLine = line, startColumn = column;
+    if (position >= size)
+        return makeToken(FLOW_TOKEN_END, start, startLine, startColumn);
+
+    char c = source[position];
+
+    // Names and numbers never span lines, so only the column has to follow along
+    if (isIdStart(c))
+    {
+        while (position < size && isIdChar(source[position]))
+            position++;
+        column += (int)(position - start);
+        return makeToken(FLOW_TOKEN_ID, start, startLine, startColumn);
+    }
+
+    if (isDigit(c) || (c == '.' && isDigit(peek(1))) || (c == '-' && (isDigit(peek(1)) || peek(1) == '.')))
+    {
+        position++;
+        while (position < size && (isDigit(source[position]) || source[position] == '.'))
+            position++;
+        // A name like 2nd_pass
+        if (position < size && isIdStart(source[position]))
+        {
+            while (position < size && isIdChar(source[position]))
+                position++;
+            column += (int)(position - start);
+            return makeError("Process cannot start with digit", startLine, startColumn);
+        }
+        column += (int)(position - start);
+        return makeToken(FLOW_TOKEN_NUMBER, start, startLine, startColumn);
+    }
+
+    if (c == '"')
+    {
+        advance();
+        while (position < size && source[position] != '"')
+        {
+            if (source[position] == '\\' && position + 1 < size)
+                advance();
+            advance();
+        }
+        if (position >= size)
+            return makeError("Missing closing quote", startLine, startColumn);
+        advance();
+        return makeToken(FLOW_TOKEN_STRING, start, startLine, startColumn);
+    }
+
+    FlowTokenType type = FLOW_TOKEN_INVALID;
+    switch (c)
+    {
+    case '-':
+        if (peek(1) == '>')
+            type = FLOW_TOKEN_ARROW;
+        else if (peek(1) == '-')
+            type = FLOW_TOKEN_UNDIRECTED_EDGE;
+        if (type != FLOW_TOKEN_INVALID)
+            advance();
+        break;
+    case '{':
+        type = FLOW_TOKEN_LEFT_BRACE;
+        break;
+    case '}':
+        type = FLOW_TOKEN_RIGHT_BRACE;
+        break;
+    case '[':
+        type = FLOW_TOKEN_LEFT_BRACKET;
+        break;
+    case ']':
+        type = FLOW_TOKEN_RIGHT_BRACKET;
+        break;
+    case '=':
+        type = FLOW_TOKEN_EQUALS;
+        break;
+    case ',':
+        type = FLOW_TOKEN_COMMA;
+        break;
+    case ';':
+        type = FLOW_TOKEN_SEMICOLON;
+        break;
+    case ':':
+        type = FLOW_TOKEN_COLON;
+        break;
+    }
+    advance();
+    if (type == FLOW_TOKEN_INVALID)
+        return makeError("Unknown symbol", startLine, startColumn);
+    return makeToken(type, start, startLine, startColumn);
+}
+
+void FlowScriptParser::advance()
+{
+    previousSpan = token.span;
+    token = lexer.next();
+}
+
+bool FlowScriptParser::accept(FlowTokenType type)
+{
+    if (token.type != type)
+        return false;
+    advance();
+    return true;
+}
+
+bool FlowScriptParser::isKeyword(const char *keyword) const
+{
+    // DOT keywords are case-insensitive
+    if (token.type != FLOW_TOKEN_ID)
+        return false;
+    size_t i = 0;
+    for (; keyword[i] != '\0'; i++)
+    {
+        if (i >= token.text.size() || std::tolower((unsigned char)token.text[i]) != keyword[i])
+            return false;
+    }
+    return i == token.text.size();
+}
+
+bool FlowScriptParser::fail(std::string message, FlowSpan span)
+{
+    // Keep the first error, the ones after it are usually caused by it
+    if (errorMessage.empty())
+    {
+        errorMessage = message;
+        errorSpan = span;
+    }
+    return false;
+}
+
+FlowSpan FlowScriptParser::join(FlowSpan from, FlowSpan to)
+{
+    return {from.line, from.column, to.endLine, to.endColumn};
+}
+
+std::string FlowScriptParser::unquote(std::string_view text)
+{
+    if (text.size() < 2 || text.front() != '"')
+        return std::string(text);
+
+    std::string value;
+    value.reserve(text.size() - 2);
+    for (size_t i = 1; i + 1 < text.size(); i++)
+    {
+        // Only \" is an escape in DOT, anything else stays as written
+        if (text[i] == '\\' && i + 2 < text.size() && text[i + 1] == '"')
+            i++;
+        value += text[i];
+    }
+    return value;
+}
+
+bool FlowScriptParser::parse(std::vector<FlowGraph> &graphs)
+{
+    errorMessage = "";
+    advance();
+
+    // Files without the digraph header are one graph
+    if (!isKeyword("strict") && !isKeyword("digraph") && !isKeyword("graph"))
+    {
+        FlowGraph graph;
+        graph.span = token.span;
+        if (!parseStatements(graph, false))
+            return false;
+        graph.span = join(graph.span, previousSpan);
+        graphs.push_back(std::move(graph));
+        return true;
+    }
+
+    while (token.type != FLOW_TOKEN_END)
+    {
+        FlowGraph graph;
+        if (!parseGraph(graph))
+            return false;
+        graphs.push_back(std::move(graph));
+    }
+    return true;
+}
+
+bool FlowScriptParser::parseGraph(FlowGraph &graph)
+{
+    graph.span = token.span;
+    if (token.type == FLOW_TOKEN_INVALID)
+        return fail(std::string(token.text), token.span);
+
+    if (isKeyword("strict"))
+        advance();
+    if (isKeyword("graph"))
+        return fail("FlowScript graphs have to be a digraph", token.span);
+    if (!isKeyword("digraph"))
+        return fail("Expected digraph", token.span);
+    advance();
+
+    if (token.type == FLOW_TOKEN_ID || token.type == FLOW_TOKEN_STRING || token.type == FLOW_TOKEN_NUMBER)
+    {
+        graph.name = unquote(token.text);
+        advance();
+    }
+
+    FlowSpan open = token.span;
+    if (!accept(FLOW_TOKEN_LEFT_BRACE))
+        return fail("Expected { after digraph", token.span);
+    if (!parseStatements(graph, true))
+        return false;
+    if (!accept(FLOW_TOKEN_RIGHT_BRACE))
+        return fail("Missing closing brace", open);
+
+    graph.span = join(graph.span, previousSpan);
+    return true;
+}
+
+bool FlowScriptParser::parseStatements(FlowGraph &graph, bool braced)
+{
+    while (token.type != FLOW_TOKEN_END && !(braced && token.type == FLOW_TOKEN_RIGHT_BRACE))
+    {
+        if (!parseStatement(graph))
+            return false;
+        accept(FLOW_TOKEN_SEMICOLON);
+    }
+    if (!braced && token.type == FLOW_TOKEN_RIGHT_BRACE)
+        return fail("Unknown symbol", token.span);
+    return true;
+}
+
+bool FlowScriptParser::parseStatement(FlowGraph &graph)
+{
+    FlowStatement statement;
+    statement.span = token.span;
+
+    if (token.type == FLOW_TOKEN_INVALID)
+        return fail(std::string(token.text), token.span);
+    if (token.type == FLOW_TOKEN_RIGHT_BRACKET)
+        return fail("Closing bracket before opening bracket", token.span);
+    if (isKeyword("subgraph"))
+        return parseSubgraph(graph);
+    if (token.type == FLOW_TOKEN_LEFT_BRACE)
+        return fail("Subgraphs need to be written as subgraph name { ... }", token.span);
+
+    // Default attributes for what follows
+    if (isKeyword("node") || isKeyword("edge") || isKeyword("graph"))
+    {
+        statement.type = FLOW_STATEMENT_DEFAULTS;
+        statement.target = std::string(token.text);
+        for (char &c : statement.target)
+            c = (char)std::tolower((unsigned char)c);
+        advance();
+        if (token.type != FLOW_TOKEN_LEFT_BRACKET)
+            return fail("Expected [ after " + statement.target, token.span);
+        if (!parseAttributes(statement.attributes))
+            return false;
+        statement.span = join(statement.span, previousSpan);
+        graph.statements.push_back(std::move(statement));
+        return true;
+    }
+
+    FlowNodeRef first;
+    if (!parseNodeRef(first))
+        return false;
+
+    // name = value sets a graph attribute
+    if (token.type == FLOW_TOKEN_EQUALS)
+    {
+        advance();
+        FlowAttribute attribute;
+        attribute.name = first.id;
+        if (!parseValue(attribute.value, attribute.span))
+            return false;
+        attribute.span = join(first.span, attribute.span);
+        statement.type = FLOW_STATEMENT_GRAPH_ATTRIBUTE;
+        statement.attributes.push_back(std::move(attribute));
+        statement.span = join(statement.span, previousSpan);
+        graph.statements.push_back(std::move(statement));
+        return true;
+    }
+
+    statement.nodes.reserve(2);
+    statement.nodes.push_back(std::move(first));
+    while (token.type == FLOW_TOKEN_ARROW || token.type == FLOW_TOKEN_UNDIRECTED_EDGE)
+    {
+        if (token.type == FLOW_TOKEN_UNDIRECTED_EDGE)
+            return fail("Use -> for dependencies, -- is not valid in a digraph", token.span);
+        advance();
+        FlowNodeRef next;
+        if (!parseNodeRef(next))
+            return false;
+        statement.nodes.push_back(std::move(next));
+    }
+    statement.type = statement.nodes.size() > 1 ? FLOW_STATEMENT_EDGE : FLOW_STATEMENT_NODE;
+
+    if (token.type == FLOW_TOKEN_LEFT_BRACKET)
+    {
+        if (!parseAttributes(statement.attributes))
+            return false;
+        // The attribute list ends the statement
+        if (token.type == FLOW_TOKEN_ARROW)
+            return fail("Statements after brakets are not valid", token.span);
+    }
+
+    statement.span = join(statement.span, previousSpan);
+    graph.statements.push_back(std::move(statement));
+    return true;
+}
+
+bool FlowScriptParser::parseSubgraph(FlowGraph &graph)
+{
+    FlowGraph subgraph;
+    subgraph.span = token.span;
+    if (inSubgraph)
+        return fail("Subgraphs can't be inside other subgraphs", token.span);
+    advance();
+
+    if (token.type != FLOW_TOKEN_ID && token.type != FLOW_TOKEN_STRING)
+        return fail("Subgraphs need a name, nodes use it to include them", token.span);
+    subgraph.name = unquote(token.text);
+    advance();
+
+    FlowSpan open = token.span;
+    if (!accept(FLOW_TOKEN_LEFT_BRACE))
+        return fail("Expected { after subgraph " + subgraph.name, token.span);
+    inSubgraph = true;
+    bool parsed = parseStatements(subgraph, true);
+    inSubgraph = false;
+    if (!parsed)
+        return false;
+    if (!accept(FLOW_TOKEN_RIGHT_BRACE))
+        return fail("Missing closing brace", open);
+
+    subgraph.span = join(subgraph.span, previousSpan);
+    graph.subgraphs.push_back(std::move(subgraph));
+    return true;
+}
+
+bool FlowScriptParser::parseAttributes(std::vector<FlowAttribute> &attributes)
+{
+    while (token.type == FLOW_TOKEN_LEFT_BRACKET)
+    {
+        FlowSpan open = token.span;
+        advance();
+        while (token.type != FLOW_TOKEN_RIGHT_BRACKET)
+        {
+            if (token.type == FLOW_TOKEN_END || token.type == FLOW_TOKEN_LEFT_BRACKET || token.type == FLOW_TOKEN_RIGHT_BRACE)
+                return fail("Missing closing bracket", open);
+            if (token.type == FLOW_TOKEN_INVALID)
+                return fail(std::string(token.text), token.span);
+
+            FlowAttribute attribute;
+            FlowSpan nameSpan;
+            if (!parseValue(attribute.name, nameSpan))
+                return false;
+            attribute.span = nameSpan;
+            // A name on its own means name=true
+            attribute.value = "true";
+            if (accept(FLOW_TOKEN_EQUALS))
+            {
+                FlowSpan valueSpan;
+                if (!parseValue(attribute.value, valueSpan))
+                    return false;
+                attribute.span = join(nameSpan, valueSpan);
+            }
+            attributes.push_back(std::move(attribute));
+
+            if (!accept(FLOW_TOKEN_COMMA))
+                accept(FLOW_TOKEN_SEMICOLON);
+        }
+        advance();
+    }
+    return true;
+}
+
+bool FlowScriptParser::parseNodeRef(FlowNodeRef &node)
+{
+    node.span = token.span;
+    if (token.type == FLOW_TOKEN_INVALID)
+        return fail(std::string(token.text), token.span);
+    if (token.type == FLOW_TOKEN_NUMBER)
+        return fail("Process cannot start with digit", token.span);
+    if (token.type != FLOW_TOKEN_ID && token.type != FLOW_TOKEN_STRING)
+        return fail("Expected a process name", token.span);
+
+    node.quoted = token.type == FLOW_TOKEN_STRING;
+    node.id = unquote(token.text);
+    advance();
+
+    // Ports (name:port:compass) mean nothing to a job, skip them
+    for (int i = 0; i < 2 && token.type == FLOW_TOKEN_COLON; i++)
+    {
+        advance();
+        if (token.type != FLOW_TOKEN_ID && token.type != FLOW_TOKEN_STRING)
+            return fail("Expected a port name after :", token.span);
+        advance();
+    }
+    node.span = join(node.span, previousSpan);
+    return true;
+}
+
+bool FlowScriptParser::parseValue(std::string &value, FlowSpan &span)
+{
+    span = token.span;
+    if (token.type == FLOW_TOKEN_INVALID)
+        return fail(std::string(token.text), token.span);
+    if (token.type != FLOW_TOKEN_ID && token.type != FLOW_TOKEN_STRING && token.type != FLOW_TOKEN_NUMBER)
+        return fail("Expected a name or a quoted string", token.span);
+    value = unquote(token.text);
+    advance();
+    return true;
+}
+
+bool FlowModuleInliner::fail(std::string message, FlowSpan span)
+{
+    if (errorMessage.empty())
+    {
+        errorMessage = message;
+        errorSpan = span;
+    }
+    return false;
+}
+
+bool FlowModuleInliner::inlineModules(std::vector<FlowGraph> &graphs, std::vector<FlowStatement> &statements)
+{
+    errorMessage = "";
+    modules.clear();
+    including.clear();
+    flat.clear();
+    ports.clear();
+
+    // Modules can be used from any graph of the file
+    for (FlowGraph &graph : graphs)
+    {
+        for (FlowGraph &subgraph : graph.subgraphs)
+        {
+            for (const std::pair<std::string, FlowGraph *> &module : modules)
+            {
+                if (module.first == subgraph.name)
+                    return fail("Subgraph \"" + subgraph.name + "\" is already defined", subgraph.span);
+            }
+            modules.emplace_back(subgraph.name, &subgraph);
+        }
+    }
+
+    // The graphs' own statements are not needed afterwards, those are moved instead of copied
+    for (FlowGraph &graph : graphs)
+    {
+        if (!expand(graph, "", nullptr, true))
+            return false;
+    }
+
+    if (ports.empty())
+    {
+        statements = std::move(flat);
+        return true;
+    }
+    return splicePorts(statements);
+}
+
+bool FlowModuleInliner::expand(FlowGraph &scope, const std::string &prefix, const Parameters *parameters, bool reuse)
+{
+    // Nodes including a module, edges can name them before they are declared
+    std::unordered_map<std::string, bool> included;
+    for (const FlowStatement &statement : scope.statements)
+    {
+        for (const FlowAttribute &attribute : statement.attributes)
+        {
+            if (statement.type == FLOW_STATEMENT_NODE && attribute.name == "module")
+                included.emplace(statement.nodes[0].id, false);
+        }
+    }
+    auto rename = [&](const std::string &id, bool from)
+    {
+        if (included.count(id))
+            return prefix + id + (from ? "/output" : "/input");
+        return prefix + id;
+    };
+
+    // Nodes of a module keep running the job they are named after
+    std::unordered_set<std::string> declared;
+    auto declareJobs = [&](const FlowStatement &statement)
+    {
+        for (const FlowNodeRef &node : statement.nodes)
+        {
+            if (node.id == "input" || node.id == "output" || node.id == "split" || included.count(node.id) || !declared.insert(node.id).second)
+                continue;
+            FlowStatement job;
+            job.type = FLOW_STATEMENT_NODE;
+            job.nodes.push_back(node);
+            job.nodes[0].id = prefix + node.id;
+            job.attributes.push_back({"job", node.id, node.span});
+            job.span = node.span;
+            flat.push_back(std::move(job));
+        }
+    };
+
+    std::vector<FlowAttribute> nodeDefaults;
+    std::vector<FlowAttribute> edgeDefaults;
+    for (FlowStatement &original : scope.statements)
+    {
+        // Graph attributes do nothing, in a module they declare its parameters
+        if (original.type == FLOW_STATEMENT_GRAPH_ATTRIBUTE)
+            continue;
+        FlowStatement statement = reuse ? std::move(original) : original;
+        if (!substitute(statement.attributes, parameters))
+            return false;
+
+        if (statement.type == FLOW_STATEMENT_DEFAULTS)
+        {
+            std::vector<FlowAttribute> &defaults = statement.target == "node" ? nodeDefaults : edgeDefaults;
+            if (statement.target != "graph")
+                defaults.insert(defaults.end(), statement.attributes.begin(), statement.attributes.end());
+            continue;
+        }
+        if (!prefix.empty())
+            declareJobs(statement);
+
+        // Defaults first, so the statement's own attributes win
+        const std::vector<FlowAttribute> &defaults = statement.type == FLOW_STATEMENT_NODE ? nodeDefaults : edgeDefaults;
+        if (statement.type == FLOW_STATEMENT_NODE)
+        {
+            std::unordered_map<std::string, bool>::iterator instance = included.find(statement.nodes[0].id);
+            if (instance != included.end())
+            {
+                if (instance->second)
+                    return fail("\"" + statement.nodes[0].id + "\" already includes a module", statement.span);
+                instance->second = true;
+                if (!include(statement, prefix))
+                    return false;
+                continue;
+            }
+            statement.nodes[0].id = prefix + statement.nodes[0].id;
+            statement.attributes.insert(statement.attributes.begin(), defaults.begin(), defaults.end());
+            flat.push_back(std::move(statement));
+            continue;
+        }
+
+        // Edge chains become single edges, each with the chain's attributes
+        statement.attributes.insert(statement.attributes.begin(), defaults.begin(), defaults.end());
+        for (size_t i = 0; i + 1 < statement.nodes.size(); i++)
+        {
+            FlowNodeRef from = statement.nodes[i];
+            FlowNodeRef to = statement.nodes[i + 1];
+            if (!prefix.empty() && to.id == "input")
+                return fail("Input block cannot have a dependency", to.span);
+            if (!prefix.empty() && from.id == "output")
+                return fail("Output block cannot be a dependency", from.span);
+            from.id = rename(from.id, true);
+            to.id = rename(to.id, false);
+
+            FlowStatement edge;
+            edge.type = FLOW_STATEMENT_EDGE;
+            edge.nodes.reserve(2);
+            edge.nodes.push_back(std::move(from));
+            edge.nodes.push_back(std::move(to));
+            edge.attributes = i + 2 < statement.nodes.size() ? statement.attributes : std::move(statement.attributes);
+            edge.span = statement.span;
+            flat.push_back(std::move(edge));
+        }
+    }
+    return true;
+}
+
+bool FlowModuleInliner::include(const FlowStatement &statement, const std::string &prefix)
+{
+    const FlowNodeRef &node = statement.nodes[0];
+    const FlowAttribute *moduleName = nullptr;
+    for (const FlowAttribute &attribute : statement.attributes)
+    {
+        if (attribute.name == "module")
+            moduleName = &attribute;
+    }
+    if (!moduleName)
+        return fail("\"" + node.id + "\" already includes a module", statement.span);
+
+    FlowGraph *module = nullptr;
+    for (const std::pair<std::string, FlowGraph *> &defined : modules)
+    {
+        if (defined.first == moduleName->value)
+            module = defined.second;
+    }
+    if (!module)
+        return fail("Unknown module \"" + moduleName->value + "\"", moduleName->span);
+    if (std::find(including.begin(), including.end(), module->name) != including.end())
+        return fail("Module \"" + module->name + "\" includes itself", node.span);
+
+    // Parameters start at the module's defaults, the including node's attributes set them
+    Parameters parameters;
+    bool hasInput = false, hasOutput = false;
+    for (const FlowStatement &inner : module->statements)
+    {
+        if (inner.type == FLOW_STATEMENT_GRAPH_ATTRIBUTE)
+            parameters.emplace_back(inner.attributes[0].name, inner.attributes[0].value);
+        for (const FlowNodeRef &innerNode : inner.nodes)
+        {
+            hasInput = hasInput || innerNode.id == "input";
+            hasOutput = hasOutput || innerNode.id == "output";
+        }
+    }
+    if (!hasInput || !hasOutput)
+        return fail("Module \"" + module->name + "\" needs an input and an output", module->span);
+    for (const FlowAttribute &attribute : statement.attributes)
+    {
+        if (&attribute == moduleName)
+            continue;
+        bool found = false;
+        for (std::pair<std::string, std::string> &parameter : parameters)
+        {
+            if (parameter.first == attribute.name)
+            {
+                parameter.second = attribute.value;
+                found = true;
+            }
+        }
+        if (!found)
+            return fail("Module \"" + module->name + "\" has no parameter \"" + attribute.name + "\"", attribute.span);
+    }
+
+    std::string inner = prefix + node.id + "/";
+    ports.push_back(inner + "input");
+    ports.push_back(inner + "output");
+    including.push_back(module->name);
+    bool expanded = expand(*module, inner, &parameters, false);
+    including.pop_back();
+    return expanded;
+}
+
+bool FlowModuleInliner::substitute(std::vector<FlowAttribute> &attributes, const Parameters *parameters)
+{
+    // Outside of modules ${ is plain text
+    if (!parameters)
+        return true;
+    for (FlowAttribute &attribute : attributes)
+    {
+        std::string &value = attribute.value;
+        for (size_t start = value.find("${"); start != std::string::npos; start = value.find("${", start))
+        {
+            size_t end = value.find('}', start);
+            if (end == std::string::npos)
+                return fail("Missing } after ${", attribute.span);
+            std::string name = value.substr(start + 2, end - start - 2);
+            const std::string *found = nullptr;
+            for (const std::pair<std::string, std::string> &parameter : *parameters)
+            {
+                if (parameter.first == name)
+                    found = &parameter.second;
+            }
+            if (!found)
+                return fail("Unknown parameter \"" + name + "\"", attribute.span);
+            value.replace(start, end + 1 - start, *found);
+            start += found->size(); // Values are used as they are, not searched again
+        }
+    }
+    return true;
+}
+
+bool FlowModuleInliner::splicePorts(std::vector<FlowStatement> &statements)
+{
+    // Every edge into a port is joined with every edge out of it. The new edge sorts where
+    // the edge into the port was, so each node's successors keep their order.
+    std::vector<std::pair<size_t, size_t>> order(flat.size());
+    std::vector<uint8_t> removed(flat.size(), 0);
+    std::unordered_map<std::string, size_t> portIDs;
+    for (size_t port = 0; port < ports.size(); port++)
+        portIDs.emplace(ports[port], port);
+    std::vector<std::vector<size_t>> into(ports.size()), outOf(ports.size());
+    auto link = [&](size_t edge)
+    {
+        std::unordered_map<std::string, size_t>::iterator port = portIDs.find(flat[edge].nodes[0].id);
+        if (port != portIDs.end())
+            outOf[port->second].push_back(edge);
+        port = portIDs.find(flat[edge].nodes[1].id);
+        if (port != portIDs.end())
+            into[port->second].push_back(edge);
+    };
+    for (size_t i = 0; i < flat.size(); i++)
+    {
+        order[i] = {i, 0};
+        if (flat[i].type == FLOW_STATEMENT_EDGE)
+            link(i);
+        else if (portIDs.count(flat[i].nodes[0].id))
+            removed[i] = 1; // Attributes on a module's input or output
+    }
+
+    size_t added = 0;
+    for (size_t port = 0; port < ports.size(); port++)
+    {
+        std::vector<size_t> edgesIn = into[port], edgesOut = outOf[port];
+        for (size_t in : edgesIn)
+        {
+            for (size_t out : edgesOut)
+            {
+                if (removed[in] || removed[out])
+                    continue;
+
+                // The edge into the port comes from the node that picks the path, its attributes win
+                FlowStatement edge;
+                edge.type = FLOW_STATEMENT_EDGE;
+                edge.nodes = {flat[in].nodes[0], flat[out].nodes[1]};
+                edge.attributes = flat[out].attributes;
+                edge.attributes.insert(edge.attributes.end(), flat[in].attributes.begin(), flat[in].attributes.end());
+                edge.span = flat[in].span;
+                flat.push_back(std::move(edge));
+                order.push_back({order[in].first, ++added});
+                removed.push_back(0);
+                link(flat.size() - 1);
+            }
+        }
+        for (size_t edge : into[port])
+            removed[edge] = 1;
+        for (size_t edge : outOf[port])
+            removed[edge] = 1;
+    }
+
+    std::vector<size_t> kept;
+    for (size_t i = 0; i < flat.size(); i++)
+    {
+        if (!removed[i])
+            kept.push_back(i);
+    }
+    std::sort(kept.begin(), kept.end(), [&](size_t a, size_t b)
+              { return order[a] < order[b]; });
+    statements.clear();
+    statements.reserve(kept.size());
+    for (size_t i : kept)
+        statements.push_back(std::move(flat[i]));
+    flat.clear();
+    return true;
+}
+
+bool FlowSourceFile::open(const std::string &path)
+{
+    close();
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    contents.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    mapped = contents.data();
+    mappedSize = contents.size();
+    return true;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // An empty file can't be mapped, it simply has no bytes
+    if (fileStat.st_size > 0)
+    {
+        void *view = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED)
+        {
+            ::close(fd);
+            return false;
+        }
+        madvise(view, fileStat.st_size, MADV_SEQUENTIAL);
+        mapped = (const char *)view;
+        mappedSize = fileStat.st_size;
+    }
+    ::close(fd); // The mapping stays valid without the descriptor
+    return true;
+#endif
+}
+
+void FlowSourceFile::close()
+{
+#ifdef _WIN32
+    contents.clear();
+#else
+    if (mapped)
+        munmap((void *)mapped, mappedSize);
+#endif
+    mapped = nullptr;
+    mappedSize = 0;
+}
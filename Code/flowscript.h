@@ -0,0 +1,214 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+// FlowScript is the subset of DOT the interpreter runs. The lexer and parser below turn
+// source text into a syntax tree in one pass; every token and tree node keeps where it
+// came from, so errors and later passes can point at the exact line and column.
+
+// Lines and columns start at 1, the end is one past the last character
+struct FlowSpan
+{
+    int line = 0;
+    int column = 0;
+    int endLine = 0;
+    int endColumn = 0;
+};
+
+enum FlowTokenType
+{
+    FLOW_TOKEN_ID,     // Name, keywords included
+    FLOW_TOKEN_NUMBER, // DOT numeral
+    FLOW_TOKEN_STRING, // Quoted string, text still has its quotes and escapes
+    FLOW_TOKEN_ARROW,  // ->
+    FLOW_TOKEN_UNDIRECTED_EDGE,
+    FLOW_TOKEN_LEFT_BRACE,
+    FLOW_TOKEN_RIGHT_BRACE,
+    FLOW_TOKEN_LEFT_BRACKET,
+    FLOW_TOKEN_RIGHT_BRACKET,
+    FLOW_TOKEN_EQUALS,
+    FLOW_TOKEN_COMMA,
+    FLOW_TOKEN_SEMICOLON,
+    FLOW_TOKEN_COLON,
+    FLOW_TOKEN_END,
+    FLOW_TOKEN_INVALID // text is the error message
+};
+
+struct FlowToken
+{
+    FlowTokenType type = FLOW_TOKEN_END;
+    std::string_view text; // Points into the source (or at the error message)
+    FlowSpan span;
+};
+
+// A FlowScript file mapped read only, so the lexer runs straight over the file's pages
+// without copying or splitting it into lines. The file should not be truncated while
+// mapped; open() again to pick up changes.
+class FlowSourceFile
+{
+public:
+    FlowSourceFile() {}
+    FlowSourceFile(const FlowSourceFile &) = delete;
+    FlowSourceFile &operator=(const FlowSourceFile &) = delete;
+    ~FlowSourceFile() { close(); }
+
+    bool open(const std::string &path);
+    void close();
+
+    const char *data() const { return mapped ? mapped : ""; }
+    size_t size() const { return mappedSize; }
+
+private:
+    const char *mapped = nullptr;
+    size_t mappedSize = 0;
+#ifdef _WIN32
+    std::string contents; // No mapping here, the file is read in one go instead
+#endif
+};
+
+// Splits source into tokens, skipping whitespace and comments. The source is not copied,
+// it has to outlive the lexer and the tokens.
+class FlowScriptLexer
+{
+public:
+    FlowScriptLexer(const char *source, size_t size) : source(source), size(size) {}
+
+    FlowToken next();
+
+private:
+    char peek(size_t offset = 0) const { return position + offset < size ? source[position + offset] : '\0'; }
+    void advance();
+    void skipWhitespaceAndComments(FlowToken &error);
+    FlowToken makeToken(FlowTokenType type, size_t start, int line, int column);
+    FlowToken makeError(const char *message, int line, int column);
+
+    const char *source;
+    size_t size;
+    size_t position = 0;
+    int line = 1;
+    int column = 1;
+};
+
+struct FlowAttribute
+{
+    std::string name;
+    std::string value;
+    FlowSpan span;
+};
+
+struct FlowNodeRef
+{
+    std::string id;
+    bool quoted = false; // "123" names a node, 123 does not
+    FlowSpan span;
+};
+
+enum FlowStatementType
+{
+    FLOW_STATEMENT_NODE,            // a [attributes]
+    FLOW_STATEMENT_EDGE,            // a -> b -> c [attributes]
+    FLOW_STATEMENT_DEFAULTS,        // node/edge/graph [attributes]
+    FLOW_STATEMENT_GRAPH_ATTRIBUTE, // name = value
+};
+
+struct FlowStatement
+{
+    FlowStatementType type = FLOW_STATEMENT_NODE;
+    std::vector<FlowNodeRef> nodes; // One for a node statement, the whole chain for an edge
+    std::vector<FlowAttribute> attributes;
+    std::string target; // "node", "edge" or "graph" for defaults
+    FlowSpan span;
+};
+
+struct FlowGraph
+{
+    std::string name;
+    std::vector<FlowStatement> statements;
+    std::vector<FlowGraph> subgraphs; // subgraph name { ... } blocks, used as modules
+    FlowSpan span;
+};
+
+// Recursive-descent parser for
+//
+//   file      : graph* | stmt_list
+//   graph     : [strict] digraph [ID] '{' stmt_list '}'
+//   stmt_list : (stmt [';'])*
+//   stmt      : ID '=' ID | (node|edge|graph) attr_list | node_id ('->' node_id)* [attr_list] | subgraph
+//   subgraph  : subgraph ID '{' stmt_list '}'
+//   attr_list : ('[' (ID ['=' ID] [',' | ';'])* ']')+
+//   node_id   : ID [':' ID [':' ID]]
+//
+// Stops at the first error. A file without the digraph header is read as one graph.
+// Subgraphs can only be named blocks at the top of a graph, they are not statements.
+class FlowScriptParser
+{
+public:
+    FlowScriptParser(const char *source, size_t size) : lexer(source, size) {}
+
+    bool parse(std::vector<FlowGraph> &graphs);
+
+    std::string getErrorMessage() { return errorMessage; }
+    FlowSpan getErrorSpan() { return errorSpan; }
+
+private:
+    void advance();
+    bool accept(FlowTokenType type);
+    bool isKeyword(const char *keyword) const;
+    bool fail(std::string message, FlowSpan span);
+
+    bool parseGraph(FlowGraph &graph);
+    bool parseStatements(FlowGraph &graph, bool braced);
+    bool parseStatement(FlowGraph &graph);
+    bool parseSubgraph(FlowGraph &graph);
+    bool parseAttributes(std::vector<FlowAttribute> &attributes);
+    bool parseNodeRef(FlowNodeRef &node);
+    bool parseValue(std::string &value, FlowSpan &span);
+
+    static std::string unquote(std::string_view text);
+    static FlowSpan join(FlowSpan from, FlowSpan to);
+
+    FlowScriptLexer lexer;
+    FlowToken token;
+    FlowSpan previousSpan;
+    bool inSubgraph = false;
+
+    std::string errorMessage;
+    FlowSpan errorSpan;
+};
+
+// Turns the parsed graphs into one flat list of node statements and single edges, with
+// node and edge defaults already applied, and modules inlined.
+//
+// A subgraph is a module. A node with module="name" includes a copy of it, whose nodes
+// are named after the including node (build/compile for compile in node build). Edges
+// into the including node go to what the module's input leads to, and edges out of it
+// leave from what leads to the module's output, so a module adds no nodes of its own.
+// Parameters are declared in the module as name = default, set as attributes of the
+// including node and used as ${name} in the module's attribute values. A node of a
+// module runs the job it is named after unless it sets job="...".
+class FlowModuleInliner
+{
+public:
+    bool inlineModules(std::vector<FlowGraph> &graphs, std::vector<FlowStatement> &statements);
+
+    std::string getErrorMessage() { return errorMessage; }
+    FlowSpan getErrorSpan() { return errorSpan; }
+
+private:
+    typedef std::vector<std::pair<std::string, std::string>> Parameters;
+
+    bool expand(FlowGraph &scope, const std::string &prefix, const Parameters *parameters, bool reuse);
+    bool include(const FlowStatement &statement, const std::string &prefix);
+    bool substitute(std::vector<FlowAttribute> &attributes, const Parameters *parameters);
+    bool splicePorts(std::vector<FlowStatement> &statements);
+    bool fail(std::string message, FlowSpan span);
+
+    std::vector<std::pair<std::string, FlowGraph *>> modules;
+    std::vector<std::string> including; // Modules being inlined, to catch one including itself
+    std::vector<FlowStatement> flat;
+    std::vector<std::string> ports; // Input and output of every included module, in order
+
+    std::string errorMessage;
+    FlowSpan errorSpan;
+};
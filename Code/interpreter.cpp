@@ -2,27 +2,12 @@
 
 void Interpreter::loadFile(std::string filename)
 {
-    std::ifstream myfile(filename);
-    std::string line;
-
-    if (myfile.is_open())
-    {
-        while (getline(myfile, line))
-        {
-            // Delete double spaces
-            std::size_t doubleSpace = line.find("  ");
-            while (doubleSpace != std::string::npos)
-            {
-                line.erase(doubleSpace, 1);
-                doubleSpace = line.find("  ");
-            }
-            // Append line to code lines
-            codeLines.push_back(line);
-        }
-        myfile.close();
-    }
+    // Replaces what an earlier load mapped, the parser works on the mapped bytes as they are
+    if (sourceFile.open(filename))
+        source = std::string_view(sourceFile.data(), sourceFile.size());
     else
     {
+        source = std::string_view();
         std::cout << "Unable to open file" << std::endl;
     }
 }
@@ -32,15 +17,26 @@ void Interpreter::registerJob(std::string name, Job *ptr)
     js.RegisterJob(name, ptr);
 }
 
-void Interpreter::generateError(int errorCode, std::string errorMessage, int errorLine)
+void Interpreter::generateError(int errorCode, std::string errorMessage, int errorLine, int errorColumn)
 {
+    // Every error is kept, the first one is also the error of the whole parse
+    errors.push_back({errorMessage, errorLine, errorColumn});
+    if (this->errorCode != 0)
+        return;
     std::cout << "ERROR!" << std::endl;
     this->errorCode = errorCode;
     this->errorMessage = errorMessage;
     this->errorLine = errorLine;
+    this->errorColumn = errorColumn;
     return;
 }
 
+bool Interpreter::isSplit(const std::string &name)
+{
+    // A module's split is named after the node including it, like build/split
+    return name == "split" || (name.size() > 6 && name.compare(name.size() - 6, 6, "/split") == 0);
+}
+
 bool Interpreter::isReserved(std::string token)
 {
     for (int i = 0; i < 4; i++)
@@ -53,396 +49,1135 @@ bool Interpreter::isReserved(std::string token)
     return false;
 }
 
-std::vector<Interpreter::connection> Interpreter::findFrom(std::string find)
+void Interpreter::declareNode(const std::string &name, FlowSpan span)
 {
-    std::vector<connection> temp;
-    for (auto c : connections)
+    // Errors found while compiling point at the first place a node shows up
+    jobSpans.emplace(name, span);
+
+    // Add to list of jobs if not already there
+    if (jobs.find(name) == jobs.end())
     {
-        if (c.from == find)
+        if (name == "input")
+            jobs[name] = std::make_pair(INPUT, "");
+        else if (name == "output")
+            jobs[name] = std::make_pair(OUTPUT, "");
+        else
+            jobs[name] = std::make_pair(JOB, "");
+    }
+}
+
+bool Interpreter::enablePlanCache(std::string path)
+{
+    return planDisk.Open(path);
+}
+
+bool Interpreter::loadCachedPlan(const std::string &key)
+{
+    std::unordered_map<std::string, std::shared_ptr<const FlowPlan>>::iterator cached = planCache.find(key);
+    std::shared_ptr<const FlowPlan> found = cached != planCache.end() ? cached->second : nullptr;
+
+    // Job types may have been unregistered since the plan was cached, it is only reused
+    // while every job node still resolves to the ID it was built with
+    for (int node = 0; found && node < found->size(); node++)
+    {
+        if (found->kinds[node] == NODE_JOB && json::parse(js.GetJobTypeID(found->jobNames[node]))["id"] != found->jobTypeIDs[node])
+            found = nullptr;
+    }
+
+    std::string saved;
+    if (!found && (cached != planCache.end() || (planDisk.IsOpen() && planDisk.Lookup(key, saved))))
+    {
+        std::shared_ptr<FlowPlan> loaded;
+        if (cached != planCache.end())
+        {
+            // Running strands still hold the old plan, this one gets its own copy
+            loaded = std::make_shared<FlowPlan>(*cached->second);
+            planCache.erase(cached);
+        }
+        else
+        {
+            loaded = std::make_shared<FlowPlan>();
+            json savedPlan = json::parse(saved, nullptr, false);
+            if (savedPlan.is_discarded() || !loaded->fromJson(savedPlan))
+                return false;
+        }
+
+        // Job type IDs belong to this job system, only the names were saved
+        for (int node = 0; node < loaded->size(); node++)
         {
-            temp.push_back(c);
+            if (loaded->kinds[node] != NODE_JOB)
+                continue;
+            loaded->jobTypeIDs[node] = resolveJobType(*loaded, node);
+            if (loaded->jobTypeIDs[node] == JOB_TYPE_ID_UNKNOWN)
+                return false; // Compiling again reports it properly
         }
+        found = loaded;
+        planCache[key] = found;
     }
-    return temp;
+    if (!found)
+        return false;
+
+    planMutex.lock();
+    plan = found;
+    planMutex.unlock();
+    return true;
 }
 
 void Interpreter::parse()
 {
-    int lineNumber;
-    // For every line of code
-    for (int i = 0; i < codeLines.size(); i++)
-    {
-        // std::cout << codeLines[i] << ": ";
-        // Increment the line number
-        lineNumber = i + 1;
-        // Split each character
-        std::string leftToken = "";
-        std::string rightToken = "";
-        bool left = true;
-        std::string label = "";
-
-        // Create a temporary connection object
-        connection temp;
-        // bool isJob = true;
-        bool hasArrow = false;
-        bool argumentEnds = false;
-
-        // For each character
-        for (int j = 0; j < codeLines[i].size(); j++)
-        {
-            char c = codeLines[i][j];
-            // std::cout << c << ": ";
-            // Syntax Error
-            if (argumentEnds)
-            {
-                generateError(1, "Statements after brakets are not valid", lineNumber);
-                return;
-            }
-            if (std::isdigit(c) && leftToken.size() == 0)
-            {
-                generateError(1, "Process cannot start with digit", lineNumber);
-                return;
-            }
+    // Start over, nothing from an earlier parse carries into this one
+    errorCode = 0;
+    errorMessage = "";
+    errorLine = -1;
+    errorColumn = -1;
+    errors.clear();
 
-            // Check for keyword "digraph"
-            if (leftToken == "digraph")
-                continue;
+    // Unchanged source reuses its compiled plan without lexing, parsing or compiling
+    std::string key = "plan" + std::to_string(PLAN_CACHE_VERSION) + ":" + std::to_string(source.size()) + ":" + HashToHex(HashBytes(source.data(), source.size()));
+    if (loadCachedPlan(key))
+        return;
 
-            // Process name
-            else if (std::isalnum(c) || c == '_')
-                if (left)
-                    leftToken += c;
-                else
-                    rightToken += c;
+    parseSource();
+
+    planMutex.lock();
+    std::shared_ptr<const FlowPlan> compiled = plan;
+    planMutex.unlock();
+    if (compiled && errorCode == 0)
+    {
+        planCache[key] = compiled;
+        if (planDisk.IsOpen())
+            planDisk.Store(key, compiled->toJson().dump());
+    }
+}
+
+void Interpreter::parseSource()
+{
+    jobs.clear();
+    connections.clear();
+    jobSpans.clear();
+    stageLimits.clear();
+    stageQueues.clear();
+    unfused.clear();
+    nodeJobs.clear();
+
+    // Tokenize and parse the whole source into a syntax tree
+    std::vector<FlowGraph> graphs;
+    FlowScriptParser parser(source.data(), source.size());
+    if (!parser.parse(graphs))
+    {
+        generateError(1, parser.getErrorMessage(), parser.getErrorSpan().line, parser.getErrorSpan().column);
+        return;
+    }
+
+    // Inline modules, what is left are plain nodes and single edges
+    std::vector<FlowStatement> statements;
+    FlowModuleInliner inliner;
+    if (!inliner.inlineModules(graphs, statements))
+    {
+        generateError(1, inliner.getErrorMessage(), inliner.getErrorSpan().line, inliner.getErrorSpan().column);
+        return;
+    }
+
+    // Turn the statements into jobs and connections
+    for (const FlowStatement &statement : statements)
+    {
+        int lineNumber = statement.span.line;
 
-            // Argument list
-            else if (c == '[')
+        // Defaults are already part of the attributes, the later ones win
+        std::string shape = "", style = "", label = "", concurrency = "", queue = "", fuse = "", job = "";
+        bool isEdge = statement.type == FLOW_STATEMENT_EDGE;
+        for (const FlowAttribute &attribute : statement.attributes)
+        {
+            if (attribute.name == "shape")
+                shape = attribute.value;
+            else if (attribute.name == "style")
+                style = attribute.value;
+            else if (attribute.name == "label")
+                label = attribute.value;
+            else if (attribute.name == "concurrency")
+                concurrency = attribute.value;
+            else if (attribute.name == "queue")
+                queue = attribute.value;
+            else if (attribute.name == "fuse")
+                fuse = attribute.value;
+            else if (attribute.name == "job")
+                job = attribute.value;
+        }
+
+        if (!isEdge)
+        {
+            std::string name = statement.nodes[0].id;
+            jobSpans.emplace(name, statement.nodes[0].span);
+
+            // Stage limits: jobs of this node running at once, and inputs waiting for it
+            for (std::string *limit : {&concurrency, &queue})
             {
-                // Syntax errors
-                if (codeLines[i].find("]") == std::string::npos)
+                if (limit->empty())
+                    continue;
+                if (limit->find_first_not_of("0123456789") != std::string::npos || std::stoi(*limit) < 1)
                 {
-                    generateError(1, "Missing closing bracket", lineNumber);
-                    return;
-                }
-                if (codeLines[i].find("]") < j)
-                {
-                    generateError(1, "Closing bracket before opening bracket", lineNumber);
+                    generateError(1, std::string(limit == &concurrency ? "Concurrency" : "Queue") + " needs to be a positive number, not \"" + *limit + "\"",
+                                  lineNumber, statement.span.column);
                     return;
                 }
+                (limit == &concurrency ? stageLimits : stageQueues)[name] = std::stoi(*limit);
+            }
 
-                // Get argument
-                std::string arg = codeLines[i].substr(j + 1, codeLines[i].find("]") - codeLines[i].find("[") - 1);
-                // std::cout << arg << std::endl;
+            // job="name" runs that registered job instead of the one the node is named after
+            if (!job.empty())
+                nodeJobs[name] = job;
 
-                // Handle label
-                if (arg.find("label=\"") != std::string::npos)
-                {
-                    // Get label
-                    for (int x = arg.find("label=\"") + 7; x < arg.size(); x++)
-                    {
-                        if (arg[x] != '\"')
-                        {
-                            label += arg[x];
-                        }
-                        else
-                        {
-                            break;
-                        }
-                    }
-                    // std::cout << label << std::endl;
-                    //  Add label to connection
-                    temp.label = label;
-                }
+            // fuse=false keeps a job a separate job even in a straight chain
+            if (fuse == "false")
+                unfused.insert(name);
+            else if (fuse != "" && fuse != "true")
+            {
+                generateError(1, "Fuse needs to be true or false, not \"" + fuse + "\"", lineNumber, statement.span.column);
+                return;
+            }
 
-                // Handle process
-                if (arg.find("shape=\"square\"") != std::string::npos)
-                {
-                    // std::cout << "square" << std::endl;
-                    // std::cout << leftToken << ": JOB, " << "" << std::endl;
-                    //  Add to list of jobs
-                    jobs[leftToken] = std::make_pair(JOB, label);
-                    // isJob = false;
-                    //  Add shape to connection
-                    temp.shape = "square";
-                }
-                // Handle conditional (if statement)
-                else if (arg.find("shape=\"diamond\"") != std::string::npos)
-                {
-                    // Error
-                    if (label == "")
-                    {
-                        generateError(1, "If statement requires a condition", lineNumber);
-                        return;
-                    }
-                    if (hasArrow)
-                    {
-                        generateError(1, "If declaration cannot be declared with a dependency", lineNumber);
-                        return;
-                    }
-                    // std::cout << "diamond" << std::endl;
-                    // std::cout << leftToken << ": IF_STATEMENT, " << label << std::endl;
-                    // Add to list of jobs
-                    jobs[leftToken] = std::make_pair(IF_STATEMENT, label);
-                    // isJob = false;
-                    //  Add shape to connection
-                    temp.shape = "diamond";
-                }
-                // Handle conditional (switch statement)
-                else if (arg.find("shape=\"trapezium\"") != std::string::npos)
-                {
-                    // std::cout << "trapezium" << std::endl;
-                    // Error
-                    if (label == "")
-                    {
-                        generateError(1, "Switch statement requires a condition", lineNumber);
-                        return;
-                    }
-                    // std::cout << leftToken << ": SWITCH, " << label << std::endl;
-                    // Add to list of jobs
-                    jobs[leftToken] = std::make_pair(SWITCH, label);
-                    // isJob = false;
-                    //  Add shape to connection
-                    temp.shape = "trapezium";
-                }
-                // Handle branching (multi-process)
-                else if (arg.find("shape=\"point\"") != std::string::npos)
-                {
-                    // std::cout << "point" << std::endl;
-                    if (leftToken != "split")
-                    {
-                        generateError(1, "Point name needs to be split, not \"" + leftToken + "\"", lineNumber);
-                        return;
-                    }
-                    // std::cout << leftToken << ": MULTI, " << "" << std::endl;
-                    // Add to list of jobs
-                    jobs[leftToken] = std::make_pair(MULTI, label);
-                    // isJob = false;
-                    //  Add shape to connection
-                    temp.shape = "point";
-                }
-                // Handle branching process (multi-process)
-                else if (arg.find("style=\"dashed\"") != std::string::npos)
+            // Handle conditional (if statement)
+            if (shape == "diamond")
+            {
+                if (label == "")
                 {
-                    // std::cout << "multi" << std::endl;
-                    // Error
-                    if (rightToken != "" && leftToken != "split")
-                    {
-                        if (jobs.find(leftToken) == jobs.end())
-                        {
-                            generateError(1, "Dashed property needs to come from a split or another dashed process", lineNumber);
-                            return;
-                        }
-                        if (jobs[leftToken].first != MULTI)
-                        {
-                            generateError(1, "Dashed property needs to come from a split or another dashed process", lineNumber);
-                            return;
-                        }
-                    }
-                    // std::cout << rightToken << ": MULTI, " << "" << std::endl;
-                    // Add to list of jobs
-                    jobs[rightToken] = std::make_pair(MULTI, label);
-                    // isJob = false;
-                    //  Add shape to connection
-                    temp.style = "dashed";
+                    generateError(1, "If statement requires a condition", lineNumber, statement.span.column);
+                    return;
                 }
-
-                // Skip to the end of the argument
-                j += arg.size() + 1;
-                // STATEMENT SHOULD END AFTER THIS (EVERYTHING ELSE IS IGNORED)
-                argumentEnds = true;
-                break;
+                jobs[name] = std::make_pair(IF_STATEMENT, label);
             }
-
-            // Dependency (Arrow)
-            else if (c == '-' && codeLines[i][j + 1] == '>')
+            // Handle conditional (switch statement)
+            else if (shape == "trapezium")
             {
-                // std::cout << "arrow ";
-                hasArrow = true;
-                // STATE DEPENDENCY HERE
-                if (rightToken != "")
+                if (label == "")
                 {
-                    // Error
-                    if (rightToken == "input")
-                    {
-                        generateError(1, "Input block cannot have a dependency", lineNumber);
-                        return;
-                    }
-                    if (leftToken == "output" && rightToken != "")
-                    {
-                        generateError(1, "Output block cannot be a dependency", lineNumber);
-                        return;
-                    }
-                    // std::cout << rightToken << " depends on " << leftToken << std::endl;
-                    // Add to list of jobs if not already there
-                    if (jobs.find(leftToken) == jobs.end())
-                        if (leftToken == "input")
-                            jobs[leftToken] = std::make_pair(INPUT, label);
-                        else if (leftToken == "output")
-                            jobs[leftToken] = std::make_pair(OUTPUT, label);
-                        else
-                            jobs[leftToken] = std::make_pair(JOB, label);
-                    if (jobs.find(rightToken) == jobs.end())
-                        if (rightToken == "output")
-                            jobs[rightToken] = std::make_pair(OUTPUT, label);
-                        else
-                            jobs[rightToken] = std::make_pair(JOB, label);
-
-                    temp.from = leftToken;
-                    temp.to = rightToken;
-                    connections.push_back(temp);
-
-                    leftToken = rightToken;
-                    rightToken = "";
+                    generateError(1, "Switch statement requires a condition", lineNumber, statement.span.column);
+                    return;
                 }
-                else
+                jobs[name] = std::make_pair(SWITCH, label);
+            }
+            // Handle branching (multi-process)
+            else if (shape == "point")
+            {
+                if (!isSplit(name))
                 {
-                    // Change side
-                    left = !left;
-                    // Add to list of jobs if not already there
-                    if (jobs.find(leftToken) == jobs.end())
-                        if (leftToken == "input")
-                            jobs[leftToken] = std::make_pair(INPUT, label);
-                        else if (leftToken == "output")
-                            jobs[leftToken] = std::make_pair(OUTPUT, label);
-                        else
-                            jobs[leftToken] = std::make_pair(JOB, label);
+                    generateError(1, "Point name needs to be split, not \"" + name + "\"", lineNumber, statement.span.column);
+                    return;
                 }
-                // Skip over the > symbol
-                j++;
+                jobs[name] = std::make_pair(MULTI, label);
             }
-            // Invalid character
-            else if (c != ' ' && c != '{' && c != '}')
+            // Handle process
+            else if (shape == "square")
             {
-                generateError(1, "Unknown symbol", lineNumber);
-                return;
+                jobs[name] = std::make_pair(JOB, label);
+            }
+            else
+            {
+                declareNode(name, statement.nodes[0].span);
             }
-            // std::cout << leftToken << "|" << rightToken << std::endl;
+            continue;
         }
 
-        // STATE DEPENDENCY HERE TOO
-        if (rightToken != "")
+        if (shape == "diamond")
         {
-            // Error
-            if (rightToken == "input")
+            generateError(1, "If declaration cannot be declared with a dependency", lineNumber, statement.span.column);
+            return;
+        }
+
+        // Dependencies (arrows), one edge per statement once modules are inlined
+        for (size_t i = 0; i + 1 < statement.nodes.size(); i++)
+        {
+            const FlowNodeRef &from = statement.nodes[i];
+            const FlowNodeRef &to = statement.nodes[i + 1];
+
+            if (to.id == "input")
             {
-                generateError(1, "Input block cannot have a dependency", lineNumber);
+                generateError(1, "Input block cannot have a dependency", to.span.line, to.span.column);
                 return;
             }
-            if (leftToken == "output" && rightToken != "")
+            if (from.id == "output")
             {
-                generateError(1, "Output block cannot be a dependency", lineNumber);
+                generateError(1, "Output block cannot be a dependency", from.span.line, from.span.column);
                 return;
             }
-            // std::cout << rightToken << " depends on " << leftToken << std::endl;
-            if (jobs.find(rightToken) == jobs.end())
-                if (rightToken == "output")
-                    jobs[rightToken] = std::make_pair(OUTPUT, label);
-                else
-                    jobs[rightToken] = std::make_pair(JOB, label);
 
-            temp.from = leftToken;
-            temp.to = rightToken;
+            // Handle branching process (multi-process)
+            if (style == "dashed")
+            {
+                if (!isSplit(from.id) && (jobs.find(from.id) == jobs.end() || jobs[from.id].first != MULTI))
+                {
+                    generateError(1, "Dashed property needs to come from a split or another dashed process", from.span.line, from.span.column);
+                    return;
+                }
+                jobs[to.id] = std::make_pair(MULTI, label);
+            }
+            declareNode(from.id, from.span);
+            declareNode(to.id, to.span);
+
+            connection temp;
+            temp.from = from.id;
+            temp.to = to.id;
+            temp.shape = shape;
+            temp.style = style;
+            temp.label = label;
+            temp.span = from.span;
             connections.push_back(temp);
         }
+    }
 
-        // Lastly, check for just job declaration
-        if (rightToken != "")
+    compile();
+}
+
+void Interpreter::compile()
+{
+    // Built here, then published read-only; runs already going keep the plan they started with
+    planMutex.lock();
+    plan.reset();
+    planMutex.unlock();
+    std::shared_ptr<FlowPlan> compiled = std::make_shared<FlowPlan>();
+    FlowPlan &graph = *compiled;
+
+    // Number the nodes in the order they first show up
+    std::unordered_map<std::string, int> nodeIDs;
+    std::vector<const std::string *> order;
+    order.reserve(jobs.size());
+    for (const connection &c : connections)
+    {
+        for (const std::string *name : {&c.from, &c.to})
         {
-            // Add to list of jobs
-            if (jobs.find(rightToken) == jobs.end())
-                if (rightToken == "input")
-                    jobs[rightToken] = std::make_pair(INPUT, label);
-                else if (rightToken == "output")
-                    jobs[rightToken] = std::make_pair(OUTPUT, label);
+            if (nodeIDs.emplace(*name, (int)order.size()).second)
+                order.push_back(name);
+        }
+    }
+    for (const auto &kv : jobs)
+    {
+        if (nodeIDs.emplace(kv.first, (int)order.size()).second)
+            order.push_back(&kv.first);
+    }
+
+    for (const std::string *name : order)
+    {
+        int node = graph.size();
+        std::pair<var_def, std::string> &job = jobs[*name];
+        NodeKind kind = NODE_JOB;
+        if (job.first == INPUT)
+            kind = NODE_INPUT;
+        else if (job.first == OUTPUT)
+            kind = NODE_OUTPUT;
+        else if (job.first == IF_STATEMENT)
+            kind = NODE_IF;
+        else if (job.first == SWITCH)
+            kind = NODE_SWITCH;
+        else if (job.first == MULTI && isSplit(*name))
+            kind = NODE_SPLIT;
+
+        // Resolve job types once here instead of on every run
+        int jobTypeID = JOB_TYPE_ID_UNKNOWN;
+        std::string jobName = "";
+        if (kind == NODE_JOB)
+        {
+            std::unordered_map<std::string, std::string>::iterator named = nodeJobs.find(*name);
+            jobName = named != nodeJobs.end() ? named->second : *name;
+            jobTypeID = json::parse(js.GetJobTypeID(jobName))["id"];
+            if (jobName.find('+') != std::string::npos)
+            {
+                // '+' joins the jobs of a fused chain, no registered job can have it
+                FlowSpan span = jobSpans[*name];
+                generateError(1, "Job name \"" + jobName + "\" can't contain '+'", span.line, span.column);
+            }
+            else if (jobTypeID == JOB_TYPE_ID_UNKNOWN)
+            {
+                FlowSpan span = jobSpans[*name];
+                generateError(1, "Unknown job \"" + jobName + "\"" + (jobName != *name ? " in \"" + *name + "\"" : ""), span.line, span.column);
+            }
+        }
+        if (kind == NODE_INPUT)
+            graph.inputNode = node;
+
+        graph.kinds.push_back(kind);
+        graph.jobTypeIDs.push_back(jobTypeID);
+        graph.jobNames.push_back(jobName);
+        graph.stageJobs.push_back({});
+        graph.conditions.push_back(job.second);
+        graph.names.push_back(*name);
+        graph.stageLimits.push_back(stageLimits.count(*name) ? stageLimits[*name] : 0);
+        graph.stageQueues.push_back(stageQueues.count(*name) ? stageQueues[*name] : 0);
+    }
+
+    // Successors in CSR form: count, prefix sum, then fill in connection order
+    graph.successorOffsets.assign(graph.size() + 1, 0);
+    for (const connection &c : connections)
+        graph.successorOffsets[nodeIDs[c.from] + 1]++;
+    for (int node = 0; node < graph.size(); node++)
+        graph.successorOffsets[node + 1] += graph.successorOffsets[node];
+
+    std::vector<int> fill(graph.successorOffsets.begin(), graph.successorOffsets.end() - 1);
+    graph.successors.resize(connections.size());
+    graph.edgeLabels.resize(connections.size());
+    graph.edgeDashed.resize(connections.size());
+    std::vector<FlowSpan> edgeSpans(connections.size());
+    for (const connection &c : connections)
+    {
+        int edge = fill[nodeIDs[c.from]]++;
+        graph.successors[edge] = nodeIDs[c.to];
+        graph.edgeLabels[edge] = c.label;
+        graph.edgeDashed[edge] = c.style == "dashed";
+        edgeSpans[edge] = c.span;
+    }
+
+    // Compile conditions once, running an if or switch node only evaluates the program
+    graph.decisionIDs.assign(graph.size(), -1);
+    for (int node = 0; node < graph.size(); node++)
+    {
+        if (graph.kinds[node] == NODE_SWITCH)
+        {
+            compileSwitch(graph, node);
+            continue;
+        }
+        if (graph.kinds[node] != NODE_IF)
+            continue;
+
+        FlowIf decision;
+        if (!compileCondition(graph, node, decision.condition))
+            continue;
+        for (int edge = graph.successorOffsets[node]; edge < graph.successorOffsets[node + 1]; edge++)
+        {
+            if (graph.edgeLabels[edge] == "true" && decision.whenTrue == -1)
+                decision.whenTrue = graph.successors[edge];
+            else if (graph.edgeLabels[edge] == "false" && decision.whenFalse == -1)
+                decision.whenFalse = graph.successors[edge];
+        }
+        graph.decisionIDs[node] = (int)graph.ifs.size();
+        graph.ifs.push_back(std::move(decision));
+    }
+
+    // Everything wrong with the graph is reported now, before any job is spent on it
+    validate(graph, edgeSpans);
+    if (errorCode != 0)
+        return;
+    optimize(graph);
+
+    planMutex.lock();
+    plan = compiled;
+    planMutex.unlock();
+}
+
+bool Interpreter::compileCondition(const FlowPlan &graph, int node, FlowExpression &condition)
+{
+    if (condition.compile(graph.conditions[node]))
+        return true;
+
+    FlowSpan span = jobSpans[graph.names[node]];
+    generateError(1, "Invalid condition \"" + graph.conditions[node] + "\": " + condition.getErrorMessage() + " at column " + std::to_string(condition.getErrorColumn()),
+                  span.line, span.column);
+    return false;
+}
+
+bool Interpreter::compileSwitch(FlowPlan &graph, int node)
+{
+    FlowSwitch decision;
+    if (!compileCondition(graph, node, decision.value))
+        return false;
+
+    // Every labelled edge is a case, the jump table maps its label to the successor
+    bool valid = true;
+    decision.cases.reserve(graph.successorOffsets[node + 1] - graph.successorOffsets[node]);
+    for (int edge = graph.successorOffsets[node]; edge < graph.successorOffsets[node + 1]; edge++)
+    {
+        const std::string &label = graph.edgeLabels[edge];
+        bool duplicate = false;
+        if (label == "default")
+        {
+            duplicate = decision.otherwise != -1;
+            decision.otherwise = graph.successors[edge];
+        }
+        else if (label == "")
+        {
+            FlowSpan span = jobSpans[graph.names[node]];
+            generateError(1, "Switch edge to \"" + graph.names[graph.successors[edge]] + "\" needs a case label or \"default\"", span.line, span.column);
+            valid = false;
+        }
+        else
+        {
+            duplicate = !decision.cases.emplace(label, graph.successors[edge]).second;
+        }
+
+        if (duplicate)
+        {
+            FlowSpan span = jobSpans[graph.names[node]];
+            generateError(1, "Switch has case \"" + label + "\" more than once", span.line, span.column);
+            valid = false;
+        }
+    }
+    if (!valid)
+        return false;
+
+    graph.decisionIDs[node] = (int)graph.switches.size();
+    graph.switches.push_back(std::move(decision));
+    return true;
+}
+
+void Interpreter::validate(const FlowPlan &graph, const std::vector<FlowSpan> &edgeSpans)
+{
+    auto nodeError = [&](int node, const std::string &message)
+    {
+        FlowSpan span = jobSpans[graph.names[node]];
+        generateError(1, message, span.line, span.column);
+    };
+    auto edgeError = [&](int edge, const std::string &message)
+    {
+        generateError(1, message, edgeSpans[edge].line, edgeSpans[edge].column);
+    };
+
+    int outputNode = -1;
+    for (int node = 0; node < graph.size(); node++)
+    {
+        if (graph.kinds[node] == NODE_OUTPUT)
+            outputNode = node;
+    }
+    if (graph.inputNode == -1)
+        generateError(1, "Graph needs an input", 1, 1);
+    if (outputNode == -1)
+        generateError(1, "Graph needs an output", 1, 1);
+
+    // Nodes inside split branches may end without an edge, the branch ends there
+    std::vector<uint8_t> inBranch(graph.size(), 0);
+    std::vector<int> pending;
+    for (int node = 0; node < graph.size(); node++)
+    {
+        if (graph.kinds[node] != NODE_SPLIT)
+            continue;
+        int continuation = -1;
+        for (int edge = graph.successorOffsets[node]; edge < graph.successorOffsets[node + 1]; edge++)
+        {
+            if (!graph.edgeDashed[edge] && continuation == -1)
+                continuation = graph.successors[edge];
+        }
+        for (int edge = graph.successorOffsets[node]; edge < graph.successorOffsets[node + 1]; edge++)
+        {
+            if (graph.edgeDashed[edge])
+                pending.push_back(graph.successors[edge]);
+        }
+        while (!pending.empty())
+        {
+            int next = pending.back();
+            pending.pop_back();
+            if (next == continuation || inBranch[next])
+                continue;
+            inBranch[next] = 1;
+            for (int edge = graph.successorOffsets[next]; edge < graph.successorOffsets[next + 1]; edge++)
+                pending.push_back(graph.successors[edge]);
+        }
+    }
+
+    // Fan-out each kind of node can use
+    for (int node = 0; node < graph.size(); node++)
+    {
+        int first = graph.successorOffsets[node], last = graph.successorOffsets[node + 1];
+        const std::string &name = graph.names[node];
+        switch (graph.kinds[node])
+        {
+        case NODE_INPUT:
+        case NODE_JOB:
+            if (last - first == 0 && !inBranch[node])
+                nodeError(node, "\"" + name + "\" has no outgoing edge");
+            for (int edge = first + 1; edge < last; edge++)
+                edgeError(edge, "\"" + name + "\" already goes to \"" + graph.names[graph.successors[first]] + "\", only a split can start more than one path");
+            break;
+        case NODE_IF:
+        {
+            bool seenTrue = false, seenFalse = false;
+            if (last - first == 0)
+                nodeError(node, "If \"" + name + "\" needs a \"true\" or \"false\" edge");
+            for (int edge = first; edge < last; edge++)
+            {
+                const std::string &label = graph.edgeLabels[edge];
+                bool &seen = label == "true" ? seenTrue : seenFalse;
+                if (label != "true" && label != "false")
+                    edgeError(edge, "If edge to \"" + graph.names[graph.successors[edge]] + "\" needs the label \"true\" or \"false\"");
+                else if (seen)
+                    edgeError(edge, "If \"" + name + "\" has more than one \"" + label + "\" edge");
+                seen = true;
+            }
+            break;
+        }
+        case NODE_SWITCH:
+            if (last - first == 0)
+                nodeError(node, "Switch \"" + name + "\" has no cases");
+            break;
+        case NODE_SPLIT:
+        {
+            int dashed = 0, join = -1;
+            for (int edge = first; edge < last; edge++)
+            {
+                if (graph.edgeDashed[edge])
+                    dashed++;
+                else if (join == -1)
+                    join = graph.successors[edge];
                 else
-                    jobs[rightToken] = std::make_pair(JOB, label);
-        }
-        else if (leftToken != "")
-        {
-            // IGNORE DIGRAPH
-            if (leftToken != "digraph")
-                // Add to list of jobs
-                if (jobs.find(leftToken) == jobs.end())
-                    if (leftToken == "input")
-                        jobs[leftToken] = std::make_pair(INPUT, label);
-                    else if (leftToken == "output")
-                        jobs[leftToken] = std::make_pair(OUTPUT, label);
-                    else
-                        jobs[leftToken] = std::make_pair(JOB, label);
-        }
-    }
-
-    // for (int i = 0; i < connections.size(); i++)
-    // {
-    //     std::cout << "--------------" << std::endl;
-    //     std::cout << "From: " << connections[i].from << std::endl;
-    //     std::cout << "To: " << connections[i].to << std::endl;
-    //     std::cout << "Shape: " << connections[i].shape << std::endl;
-    //     std::cout << "Label: " << connections[i].label << std::endl;
-    //     std::cout << "Style: " << connections[i].style << std::endl;
-    //     std::cout << std::endl;
-    // }
+                    edgeError(edge, "Split can only join at one node, it already goes on to \"" + graph.names[join] + "\"");
+            }
+            if (dashed == 0)
+                nodeError(node, "Split needs at least one dashed edge");
+            break;
+        }
+        case NODE_OUTPUT:
+            break;
+        }
+    }
+
+    // Everything has to be reachable from the input
+    if (graph.inputNode != -1)
+    {
+        std::vector<uint8_t> reached(graph.size(), 0);
+        pending.assign(1, graph.inputNode);
+        reached[graph.inputNode] = 1;
+        while (!pending.empty())
+        {
+            int next = pending.back();
+            pending.pop_back();
+            for (int edge = graph.successorOffsets[next]; edge < graph.successorOffsets[next + 1]; edge++)
+            {
+                if (!reached[graph.successors[edge]])
+                {
+                    reached[graph.successors[edge]] = 1;
+                    pending.push_back(graph.successors[edge]);
+                }
+            }
+        }
+        for (int node = 0; node < graph.size(); node++)
+        {
+            if (!reached[node])
+                nodeError(node, "\"" + graph.names[node] + "\" can't be reached from input");
+        }
+    }
+
+    // Cycles, with an iterative depth-first search so big graphs can't overflow the stack
+    enum
+    {
+        UNVISITED,
+        ON_PATH,
+        FINISHED
+    };
+    std::vector<uint8_t> state(graph.size(), UNVISITED);
+    std::vector<std::pair<int, int>> path; // Node and the next edge to look at
+    for (int root = 0; root < graph.size(); root++)
+    {
+        if (state[root] != UNVISITED)
+            continue;
+        path.push_back({root, graph.successorOffsets[root]});
+        state[root] = ON_PATH;
+        while (!path.empty())
+        {
+            int node = path.back().first;
+            int edge = path.back().second++;
+            if (edge == graph.successorOffsets[node + 1])
+            {
+                state[node] = FINISHED;
+                path.pop_back();
+                continue;
+            }
+
+            int next = graph.successors[edge];
+            if (state[next] == UNVISITED)
+            {
+                state[next] = ON_PATH;
+                path.push_back({next, graph.successorOffsets[next]});
+            }
+            else if (state[next] == ON_PATH)
+            {
+                std::string cycle = "";
+                size_t start = path.size() - 1;
+                while (path[start].first != next)
+                    start--;
+                for (size_t i = start; i < path.size(); i++)
+                    cycle += "\"" + graph.names[path[i].first] + "\" -> ";
+                edgeError(edge, "Cycle " + cycle + "\"" + graph.names[next] + "\"");
+            }
+        }
+    }
 }
 
-std::string Interpreter::run()
+int Interpreter::resolveJobType(const FlowPlan &graph, int node)
+{
+    if (graph.stageJobs[node].empty())
+        return json::parse(js.GetJobTypeID(graph.jobNames[node]))["id"];
+
+    // A fused chain is registered again from its stages every time, so it runs the jobs
+    // registered under those names now and never a chain left from an earlier registration
+    json chain;
+    chain["name"] = graph.jobNames[node];
+    chain["job_types"] = graph.stageJobs[node];
+    return json::parse(js.RegisterJobChain(chain.dump()))["id"];
+}
+
+void Interpreter::optimize(FlowPlan &graph)
 {
-    // For every key and value in the jobs map
-    for (auto kv : jobs)
+    // Straight chains of plain jobs become one job running every step on one worker, which
+    // saves a queue insertion, a worker hand-off and a completion per step
+    std::vector<int> predecessors(graph.size(), 0);
+    for (int successor : graph.successors)
+        predecessors[successor]++;
+
+    auto fusible = [&](int node)
+    {
+        return graph.kinds[node] == NODE_JOB && !unfused.count(graph.names[node]) && graph.stageLimits[node] == 0 && graph.stageQueues[node] == 0;
+    };
+    auto onlySuccessor = [&](int node)
+    {
+        return graph.successorOffsets[node + 1] - graph.successorOffsets[node] == 1 ? graph.successors[graph.successorOffsets[node]] : -1;
+    };
+
+    // Chains start at nodes the previous job can't be fused into
+    std::vector<uint8_t> continues(graph.size(), 0);
+    for (int node = 0; node < graph.size(); node++)
+    {
+        int next = onlySuccessor(node);
+        if (fusible(node) && next != -1 && fusible(next) && predecessors[next] == 1)
+            continues[next] = 1;
+    }
+
+    std::vector<int> tail(graph.size());         // Node whose edges a kept node leaves by
+    std::vector<uint8_t> fused(graph.size(), 0); // Folded into the chain before it
+    bool changed = false;
+    for (int node = 0; node < graph.size(); node++)
+        tail[node] = node;
+    for (int head = 0; head < graph.size(); head++)
     {
-        std::string name = kv.first, label = kv.second.second;
-        int var_det = kv.second.first;
-        // std::cout << "-------------------" << std::endl;
-        // std::cout << "Name: " << name << std::endl;
-        // std::cout << "Var_det: " << var_det << std::endl;
-        // std::cout << "Condition (label): " << label << std::endl;
-        Node *node;
+        if (continues[head] || !fusible(head))
+            continue;
+
+        // Chains of the same jobs, like those of a module included many times, share one job
+        std::vector<int> chain(1, head);
+        std::vector<std::string> stages(1, graph.jobNames[head]);
+        std::string name = graph.names[head], jobName = graph.jobNames[head];
+        for (int next = onlySuccessor(head); next != -1 && continues[next]; next = onlySuccessor(next))
+        {
+            chain.push_back(next);
+            stages.push_back(graph.jobNames[next]);
+            name += "+" + graph.names[next];
+            jobName += "+" + graph.jobNames[next];
+        }
+        if (chain.size() < 2)
+            continue;
 
-        if (var_det == INPUT)
+        // Coroutine and plugin jobs can't be chained, those stay as they are
+        std::string stageName = graph.jobNames[head];
+        graph.jobNames[head] = jobName;
+        graph.stageJobs[head] = stages;
+        int jobTypeID = resolveJobType(graph, head);
+        if (jobTypeID == JOB_TYPE_ID_UNKNOWN)
         {
-            node = new InputNode(findFrom(name)[0].to);
-            nodes[name] = node;
+            graph.jobNames[head] = stageName;
+            graph.stageJobs[head].clear();
+            continue;
         }
-        else if (var_det == OUTPUT)
+
+        graph.jobTypeIDs[head] = jobTypeID;
+        graph.names[head] = name;
+        tail[head] = chain.back();
+        for (size_t i = 1; i < chain.size(); i++)
+            fused[chain[i]] = 1;
+        changed = true;
+    }
+    if (!changed)
+        return;
+
+    // Rebuild without the nodes that were folded away
+    FlowPlan compact;
+    std::vector<int> remap(graph.size(), -1);
+    for (int node = 0; node < graph.size(); node++)
+    {
+        if (fused[node])
+            continue;
+        remap[node] = compact.size();
+        compact.kinds.push_back(graph.kinds[node]);
+        compact.jobTypeIDs.push_back(graph.jobTypeIDs[node]);
+        compact.jobNames.push_back(graph.jobNames[node]);
+        compact.stageJobs.push_back(graph.stageJobs[node]);
+        compact.conditions.push_back(graph.conditions[node]);
+        compact.names.push_back(graph.names[node]);
+        compact.stageLimits.push_back(graph.stageLimits[node]);
+        compact.stageQueues.push_back(graph.stageQueues[node]);
+        compact.decisionIDs.push_back(graph.decisionIDs[node]);
+    }
+    compact.successorOffsets.push_back(0);
+    for (int node = 0; node < graph.size(); node++)
+    {
+        if (fused[node])
+            continue;
+        for (int edge = graph.successorOffsets[tail[node]]; edge < graph.successorOffsets[tail[node] + 1]; edge++)
         {
-            node = new OutputNode();
-            nodes[name] = node;
+            compact.successors.push_back(remap[graph.successors[edge]]);
+            compact.edgeLabels.push_back(graph.edgeLabels[edge]);
+            compact.edgeDashed.push_back(graph.edgeDashed[edge]);
         }
-        else if (var_det == JOB)
+        compact.successorOffsets.push_back((int)compact.successors.size());
+    }
+    auto moved = [&](int node)
+    {
+        return node == -1 ? -1 : remap[node];
+    };
+    for (FlowIf &decision : graph.ifs)
+    {
+        decision.whenTrue = moved(decision.whenTrue);
+        decision.whenFalse = moved(decision.whenFalse);
+    }
+    for (FlowSwitch &decision : graph.switches)
+    {
+        for (auto &selected : decision.cases)
+            selected.second = moved(selected.second);
+        decision.otherwise = moved(decision.otherwise);
+    }
+    compact.ifs = std::move(graph.ifs);
+    compact.switches = std::move(graph.switches);
+    compact.inputNode = moved(graph.inputNode);
+    graph = std::move(compact);
+}
+
+std::string Interpreter::submitJob(const FlowPlan &graph, int node, const std::string &input)
+{
+    json temp;
+    temp["job_type"] = graph.jobTypeIDs[node];
+    temp["input"] = input;
+    if (!dependencies.empty())
+        temp["dependencies"] = dependencies;
+    return js.CreateJob(temp.dump());
+}
+
+bool Interpreter::isStageFull(const execution &state, int node)
+{
+    const FlowPlan &graph = *state.plan;
+    return node != -1 && graph.kinds[node] == NODE_JOB && graph.stageQueues[node] > 0 && state.stageWaiting[node] >= graph.stageQueues[node];
+}
+
+void Interpreter::advance(strand &path, execution &state)
+{
+    const FlowPlan &graph = *state.plan;
+    // Walk nodes that need no job until the strand waits on one, forks or ends
+    int stopAt = path.join != -1 ? state.joins[path.join].continuation : -1;
+    while (!path.done && path.job.empty())
+    {
+        int node = path.node;
+        if (node == -1 || node == stopAt)
         {
-            node = new JobNode(&js, name, findFrom(name)[0].to);
-            nodes[name] = node;
+            path.done = true;
+            break;
         }
-        else if (var_det == IF_STATEMENT)
+
+        switch (graph.kinds[node])
         {
-            // Find true and false pointers
-            std::string true_ptr = "", false_ptr = "";
-            std::vector<connection> temp = findFrom(name);
-            for (auto t : temp)
+        case NODE_INPUT:
+            path.node = graph.firstSuccessor(node);
+            break;
+        case NODE_OUTPUT:
+            path.done = true;
+            break;
+        case NODE_JOB:
+            // A stage at its limit keeps the strand waiting in the stage's queue
+            if (graph.stageLimits[node] > 0 && state.stageRunning[node] >= graph.stageLimits[node])
             {
-                if (t.label == "true")
-                    true_ptr = t.to;
-                if (t.label == "false")
-                    false_ptr = t.to;
+                if (!path.waiting)
+                    state.stageWaiting[node]++;
+                path.waiting = true;
+                return;
             }
-            node = new IfNode(label, true_ptr, false_ptr);
-            nodes[name] = node;
+            if (path.waiting)
+                state.stageWaiting[node]--;
+            path.waiting = false;
+
+            path.job = submitJob(graph, node, path.input);
+            path.jobID = json::parse(path.job)["id"];
+            state.stageRunning[node]++;
+            if (path.jobID == -1)
+            {
+                // Rejected, the strand ends with the reason
+                path.input = "ERROR: " + json::parse(path.job)["error"].get<std::string>();
+                path.job = "";
+                path.done = true;
+                state.stageRunning[node]--;
+            }
+            break;
+        case NODE_SPLIT:
+            // The scheduler forks it
+            return;
+        case NODE_IF:
+        {
+            // The input goes on unchanged along the edge the condition picks
+            const FlowIf &decision = graph.ifs[graph.decisionIDs[node]];
+            path.node = decision.condition.test(path.input) ? decision.whenTrue : decision.whenFalse;
+            break;
         }
-        else if (var_det == SWITCH)
+        case NODE_SWITCH:
         {
+            const FlowSwitch &decision = graph.switches[graph.decisionIDs[node]];
+            auto selected = decision.cases.find(decision.value.evaluateKey(path.input));
+            path.node = selected != decision.cases.end() ? selected->second : decision.otherwise;
+            break;
+        }
         }
-        else if (var_det == MULTI)
+    }
+}
+
+void Interpreter::fork(const strand &path, execution &state)
+{
+    const FlowPlan &graph = *state.plan;
+    // Dashed edges start the branches, a solid edge is where they join again
+    int split = path.node;
+    joinPoint point;
+    point.join = path.join;
+    point.slot = path.slot;
+    for (int edge = graph.successorOffsets[split]; edge < graph.successorOffsets[split + 1]; edge++)
+    {
+        if (!graph.edgeDashed[edge] && point.continuation == -1)
+            point.continuation = graph.successors[edge];
+        else if (graph.edgeDashed[edge])
+            point.pending++;
+    }
+    point.outputs.resize(point.pending);
+
+    // Nothing to wait for, go on with an empty join
+    if (point.pending == 0)
+    {
+        strand next;
+        next.node = point.continuation;
+        next.input = "[]";
+        next.join = point.join;
+        next.slot = point.slot;
+        state.strands.push_back(std::move(next));
+        return;
+    }
+
+    int join = (int)state.joins.size();
+    if (!state.freeJoins.empty())
+    {
+        join = state.freeJoins.back();
+        state.freeJoins.pop_back();
+        state.joins[join] = std::move(point);
+    }
+    else
+    {
+        state.joins.push_back(std::move(point));
+    }
+
+    int slot = 0;
+    for (int edge = graph.successorOffsets[split]; edge < graph.successorOffsets[split + 1]; edge++)
+    {
+        if (!graph.edgeDashed[edge])
+            continue;
+        strand branch;
+        branch.node = graph.successors[edge];
+        branch.input = path.input;
+        branch.join = join;
+        branch.slot = slot++;
+        state.strands.push_back(std::move(branch));
+    }
+}
+
+void Interpreter::finish(const strand &path, execution &state)
+{
+    if (path.join == -1)
+    {
+        // A whole input is done, the slot says which one
+        state.finished.push_back({(size_t)path.slot, path.input, 0});
+        return;
+    }
+
+    joinPoint &point = state.joins[path.join];
+    point.outputs[path.slot] = path.input;
+    if (--point.pending > 0)
+        return;
+
+    // Last branch in: the join gets every branch output, in the order the branches were written
+    strand next;
+    next.node = point.continuation;
+    next.input = json(point.outputs).dump();
+    next.join = point.join;
+    next.slot = point.slot;
+    state.freeJoins.push_back(path.join);
+    state.strands.push_back(std::move(next));
+}
+
+void Interpreter::execution::reset(std::shared_ptr<const FlowPlan> plan)
+{
+    // Keeps the capacity, a context that is reused stops allocating for its own bookkeeping
+    this->plan = std::move(plan);
+    strands.clear();
+    joins.clear();
+    freeJoins.clear();
+    finished.clear();
+    stageRunning.assign(this->plan ? this->plan->size() : 0, 0);
+    stageWaiting.assign(this->plan ? this->plan->size() : 0, 0);
+    doneJobs.clear();
+}
+
+void Interpreter::start(execution &state, const std::string &input, size_t slot)
+{
+    strand first;
+    first.node = state.plan->inputNode;
+    first.input = input;
+    first.slot = (int)slot;
+    state.strands.push_back(std::move(first));
+}
+
+bool Interpreter::step(execution &state)
+{
+    // One loop drives every strand, so the native stack stays flat however long or nested
+    // the graph is. Every strand keeps a job in flight, so independent branches run together.
+    const FlowPlan &graph = *state.plan;
+    bool progressed = false;
+    for (size_t i = 0; i < state.strands.size();)
+    {
+        strand &path = state.strands[i];
+        if (!path.job.empty())
+        {
+            // With the next stage's queue full the strand holds on to its finished job, so its
+            // stage stays busy and the backpressure reaches the stages before it
+            if (!state.doneJobs.count(path.jobID) || isStageFull(state, graph.firstSuccessor(path.node)))
+            {
+                i++;
+                continue;
+            }
+            path.input = json::parse(js.CompleteJob(path.job))["output"];
+            state.doneJobs.erase(path.jobID);
+            path.job = "";
+            path.jobID = -1;
+            state.stageRunning[path.node]--;
+            path.node = graph.firstSuccessor(path.node);
+        }
+
+        bool wasWaiting = path.waiting;
+        advance(path, state);
+        if (!path.job.empty() || path.waiting)
         {
+            progressed = progressed || !wasWaiting || !path.waiting;
+            i++;
+            continue;
         }
+        progressed = true;
+
+        // Forked or finished, it leaves the list (new strands are appended and seen this pass)
+        strand parked = std::move(path);
+        if (i + 1 < state.strands.size())
+            state.strands[i] = std::move(state.strands.back());
+        state.strands.pop_back();
+        if (parked.done)
+            finish(parked, state);
+        else
+            fork(parked, state);
+    }
+    return progressed;
+}
+
+void Interpreter::waitForJobs(execution &state)
+{
+    // One blocking call for every job in flight instead of asking after each of them; only
+    // the strands whose jobs are reported done move on the next step
+    json wait;
+    wait["ids"] = json::array();
+    for (const strand &path : state.strands)
+    {
+        if (!path.job.empty() && !state.doneJobs.count(path.jobID))
+            wait["ids"].push_back(path.jobID);
+    }
+    if (wait["ids"].empty())
+    {
+        std::this_thread::yield();
+        return;
+    }
+    json ready = json::parse(js.WaitForJobs(wait.dump()));
+    for (int jobID : ready["ids"])
+        state.doneJobs.insert(jobID);
+}
+
+std::string Interpreter::run(const std::string &input, execution &state)
+{
+    planMutex.lock();
+    state.reset(plan);
+    planMutex.unlock();
+    if (!state.plan || state.plan->inputNode == -1)
+        return "";
+
+    start(state, input, 0);
+    while (!state.strands.empty())
+    {
+        if (!step(state))
+            waitForJobs(state);
     }
+    return state.finished.empty() ? "" : state.finished[0].output;
+}
+
+std::vector<Interpreter::batchResult> Interpreter::runBatch(const std::vector<std::string> &inputs, int maxInFlight, bool ordered, batchStats &stats)
+{
+    std::vector<batchResult> results;
+    stats = batchStats();
+    stats.inputs = inputs.size();
+
+    execution state;
+    planMutex.lock();
+    state.reset(plan);
+    planMutex.unlock();
+    if (!state.plan || state.plan->inputNode == -1)
+        return results;
 
-    // Find the input node and execute
-    for (auto kv : nodes)
+    if (maxInFlight < 1)
+        maxInFlight = 1;
+    if (ordered)
+        results.resize(inputs.size());
+    else
+        results.reserve(inputs.size());
+
+    // All inputs share one scheduler loop; a new one starts whenever one finishes
+    std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+    std::vector<std::chrono::steady_clock::time_point> started(inputs.size());
+    size_t next = 0, completed = 0;
+    int inFlight = 0;
+    double totalMilliseconds = 0;
+    while (completed < inputs.size())
     {
-        if (kv.first == "input")
+        while (inFlight < maxInFlight && next < inputs.size())
+        {
+            started[next] = std::chrono::steady_clock::now();
+            start(state, inputs[next], next);
+            next++;
+            inFlight++;
+        }
+
+        bool progressed = step(state);
+
+        for (batchResult &result : state.finished)
         {
-            this->output = kv.second->execute(input);
+            result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started[result.index]).count();
+            totalMilliseconds += result.milliseconds;
+            if (result.milliseconds > stats.maxMilliseconds)
+                stats.maxMilliseconds = result.milliseconds;
+            if (result.output.rfind("ERROR: ", 0) == 0)
+                stats.errors++;
+
+            size_t index = result.index;
+            if (ordered)
+                results[index] = std::move(result);
+            else
+                results.push_back(std::move(result));
+            completed++;
+            inFlight--;
         }
+        state.finished.clear();
+
+        if (!progressed)
+            waitForJobs(state);
     }
 
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+    stats.inputsPerSecond = stats.seconds > 0 ? inputs.size() / stats.seconds : 0;
+    stats.averageMilliseconds = inputs.empty() ? 0 : totalMilliseconds / inputs.size();
+    return results;
+}
+
+std::string Interpreter::run()
+{
+    // Execute from the input node
+    execution state;
+    this->output = run(input, state);
     return this->output;
-}
\ No newline at end of file
+}
@@ -1,7 +1,17 @@
 #pragma once
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <unordered_set>
 
 #include "nodes.h"
+#include "flowscript.h"
+#include "./lib/jobdiskcache.h"
+#include "./lib/jobresultcache.h"
+
+// Bump when FlowPlan or its saved form changes, older cached plans are then ignored
+#define PLAN_CACHE_VERSION 4
 
 class Interpreter
 {
@@ -30,34 +40,146 @@ private:
         std::string shape = "";
         std::string style = "";
         std::string label = "";
+        FlowSpan span;
     };
     std::unordered_map<std::string, std::pair<var_def, std::string>> jobs;
     std::vector<connection> connections;
+    std::unordered_map<std::string, FlowSpan> jobSpans;
+    std::unordered_map<std::string, int> stageLimits; // concurrency attribute
+    std::unordered_map<std::string, int> stageQueues; // queue attribute
+    std::unordered_set<std::string> unfused;          // fuse=false
+    std::unordered_map<std::string, std::string> nodeJobs; // job attribute
+
+    // What run() executes, compiled at the end of parse(). It is never changed once published,
+    // so any number of runs can share it; parse() swaps in a new one.
+    std::shared_ptr<const FlowPlan> plan;
+    std::mutex planMutex;
 
-    std::vector<std::string> codeLines;
+    // Compiled plans by source hash, kept in memory and, once enabled, on disk
+    std::unordered_map<std::string, std::shared_ptr<const FlowPlan>> planCache;
+    JobDiskCache planDisk;
+
+    FlowSourceFile sourceFile;
+    std::string_view source; // The mapped file, only read between loadFile() calls
 
     std::string input;
     std::string output;
     std::vector<std::string> processes;
+    std::vector<std::string> dependencies;
 
     int errorCode;
     std::string errorMessage;
     int errorLine;
+    int errorColumn;
 
-    void generateError(int errorCode, std::string errorMessage, int errorLine);
+public:
+    struct flowError
+    {
+        std::string message;
+        int line;
+        int column;
+    };
 
-    bool isReserved(std::string token);
+private:
+    std::vector<flowError> errors;
 
-    std::vector<connection> findFrom(std::string find);
+    void generateError(int errorCode, std::string errorMessage, int errorLine, int errorColumn = -1);
+    void declareNode(const std::string &name, FlowSpan span);
+    bool loadCachedPlan(const std::string &key);
+    void parseSource();
+    void compile();
+    bool compileCondition(const FlowPlan &graph, int node, FlowExpression &condition);
+    bool compileSwitch(FlowPlan &graph, int node);
+    void validate(const FlowPlan &graph, const std::vector<FlowSpan> &edgeSpans);
+    void optimize(FlowPlan &graph);
+    int resolveJobType(const FlowPlan &graph, int node); // Registers fused nodes again from their stages
+
+    // A path through the plan, parked on its job while the job runs. It is advanced until it
+    // waits on a job, reaches a split or ends.
+    struct strand
+    {
+        int node = -1;
+        std::string input = "";
+        std::string job = ""; // CreateJob reply of the job it waits on
+        int jobID = -1;
+        int join = -1;        // Split it is a branch of, -1 for the main path
+        int slot = 0;         // Where its output goes in that split's join
+        bool waiting = false; // Queued for a stage that is at its concurrency limit
+        bool done = false;
+    };
+    // Continuation record of a split: where to go once every branch has finished
+    struct joinPoint
+    {
+        int continuation = -1;
+        int pending = 0;
+        std::vector<std::string> outputs;
+        int join = -1; // The forking strand's own join and slot, the continuation inherits them
+        int slot = 0;
+    };
+    std::string submitJob(const FlowPlan &graph, int node, const std::string &input);
 
 public:
-    Interpreter()
+    // One input of a batch, index is its position in the batch
+    struct batchResult
+    {
+        size_t index = 0;
+        std::string output = "";
+        double milliseconds = 0; // From start to finish, waiting for a free slot not included
+    };
+    struct batchStats
     {
-        js.CreateJobSystem();
-        js.CreateThreads();
+        size_t inputs = 0;
+        size_t errors = 0; // Outputs that start with "ERROR: "
+        double seconds = 0;
+        double inputsPerSecond = 0;
+        double averageMilliseconds = 0;
+        double maxMilliseconds = 0;
+    };
+
+    // Everything one run needs. Nothing lives on the native stack between jobs and nothing in
+    // the Interpreter changes while running, so each thread running inputs through the same
+    // graph only needs its own execution, which can be reused from run to run.
+    struct execution
+    {
+        std::shared_ptr<const FlowPlan> plan; // Kept alive for the run even if parse() replaces it
+        std::vector<strand> strands;
+        std::vector<joinPoint> joins;
+        std::vector<int> freeJoins;
+        std::vector<batchResult> finished; // Inputs done since the last look, by slot
+        std::vector<int> stageRunning;     // Per node, jobs in flight
+        std::vector<int> stageWaiting;     // Per node, strands queued for it
+        std::unordered_set<int> doneJobs;  // Jobs of strands that can be completed
+
+        void reset(std::shared_ptr<const FlowPlan> plan);
+    };
+
+private:
+    bool isStageFull(const execution &state, int node);
+    void advance(strand &path, execution &state);
+    void fork(const strand &path, execution &state);
+    void finish(const strand &path, execution &state);
+    void start(execution &state, const std::string &input, size_t slot);
+    bool step(execution &state); // One pass over the strands, false if nothing moved
+    void waitForJobs(execution &state); // Sleeps until a job a strand waits on finishes
+
+    bool isReserved(std::string token);
+    static bool isSplit(const std::string &name);
+
+public:
+    // With a daemon socket, jobs run in a shared JobSystemDaemon instead of this process
+    Interpreter(std::string daemonSocket = "")
+    {
+        if (daemonSocket.empty() || !js.ConnectToDaemon(daemonSocket))
+        {
+            if (!daemonSocket.empty())
+                std::cout << "ERROR: Could not connect to the job system daemon, running jobs locally." << std::endl;
+            js.CreateJobSystem();
+            js.CreateThreads();
+        }
         errorCode = 0;
         errorMessage = "";
         errorLine = -1;
+        errorColumn = -1;
         input = "";
         output = "";
     }
@@ -65,12 +187,32 @@ public:
     int getErrorCode() { return errorCode; }
     std::string getErrorMessage() { return errorMessage; }
     int getErrorLine() { return errorLine; }
+    int getErrorColumn() { return errorColumn; }
+    // Every problem parse() found, the first one is the error above
+    const std::vector<flowError> &getErrors() { return errors; }
 
     void setInput(std::string input) { this->input = input; }
+    // Files the jobs read besides their input, used to key cached job results
+    void setDependencies(std::vector<std::string> dependencies) { this->dependencies = dependencies; }
     std::string getOutput() { return this->output; }
 
     void loadFile(std::string filename);
     void registerJob(std::string name, Job *ptr);
+    // Keep compiled plans in this file too, so later processes skip parsing unchanged FlowScript
+    bool enablePlanCache(std::string path);
     void parse();
+    // The plan parse() compiled (or loaded), nullptr if there is none
+    std::shared_ptr<const FlowPlan> getPlan()
+    {
+        planMutex.lock();
+        std::shared_ptr<const FlowPlan> compiled = plan;
+        planMutex.unlock();
+        return compiled;
+    }
     std::string run();
+    // Safe to call from many threads at once, each with its own state
+    std::string run(const std::string &input, execution &state);
+    // Runs every input through the graph, at most maxInFlight at a time. Results come back
+    // in input order, or in the order they finished when ordered is false.
+    std::vector<batchResult> runBatch(const std::vector<std::string> &inputs, int maxInFlight, bool ordered, batchStats &stats);
 };
\ No newline at end of file
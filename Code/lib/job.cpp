@@ -0,0 +1,12 @@
+#include "job.h"
+#include "json.hpp"
+
+std::string Job::RunChain(const std::string &input)
+{
+    std::string value = m_chain[0](input);
+    for (size_t i = 1; i < m_chain.size(); i++)
+    {
+        value = m_chain[i](nlohmann::json(value).dump());
+    }
+    return value;
+}
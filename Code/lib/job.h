@@ -7,14 +7,27 @@
 #include <vector>
 #include <thread>
 #include <string>
+#include <atomic>
+#include <memory>
+#include <functional>
+
+#include "jobcoroutine.h"
 
 typedef std::string (*fnptr)(std::string);
-static int s_nextJobID = 0;
+
+// Outputs starting with "ERROR: " report a failure, those are never reused
+inline bool IsErrorOutput(const std::string &output) { return output.compare(0, 7, "ERROR: ") == 0; }
+
+// Shared by every translation unit, jobs can be created from any thread
+inline std::atomic<int> s_nextJobID(0);
 
 class Job
 {
     friend class JobSystem;
     friend class JobWorkerThread;
+    friend class JobProcessWorker;
+    friend class JobPluginLoader;
+    friend void SuspendCurrentJob(std::function<bool()> resumeWhen);
 
 public:
     Job(fnptr ptr, int jobType = -1, unsigned long jobChannels = 0xFFFFFFFF) : ptr(ptr), m_jobChannels(jobChannels), m_jobType(jobType)
@@ -22,26 +35,85 @@ public:
         m_jobID = s_nextJobID++;
     }
 
+    Job(cofnptr coptr, int jobType = -1, unsigned long jobChannels = 0xFFFFFFFF) : coptr(coptr), m_jobChannels(jobChannels), m_jobType(jobType)
+    {
+        m_jobID = s_nextJobID++;
+    }
+
+    // Fused job: runs the functions one after the other on the same worker, each getting the
+    // previous output JSON-encoded, the way a separate job of that type would have received it
+    Job(std::vector<fnptr> chain, int jobType = -1, unsigned long jobChannels = 0xFFFFFFFF) : m_chain(chain), m_jobChannels(jobChannels), m_jobType(jobType)
+    {
+        m_jobID = s_nextJobID++;
+    }
+
     Job(Job &other)
     {
         m_jobID = s_nextJobID++;
 
         this->ptr = other.ptr;
+        this->coptr = other.coptr;
+        this->m_chain = other.m_chain;
         this->m_jobID = m_jobID;
         this->m_jobType = other.m_jobType;
         this->m_jobChannels = other.m_jobChannels;
+        this->m_module = other.m_module;
     }
 
     ~Job() {}
 
-    void Execute(std::string input) { output = ptr(input); }
+    // Returns false if a coroutine job suspended before finishing
+    bool Execute(std::string input)
+    {
+        if (ptr)
+        {
+            output = ptr(input);
+            return true;
+        }
+        if (!m_chain.empty())
+        {
+            output = RunChain(input);
+            return true;
+        }
+
+        // Start the coroutine on the first run, resume it afterwards
+        if (!m_task.IsValid())
+        {
+            m_task = coptr(input);
+        }
+        m_resumeWhen = nullptr;
+        m_task.Resume();
+
+        if (m_task.IsDone())
+        {
+            output = m_task.GetOutput();
+            m_task.Reset();
+            return true;
+        }
+        return false;
+    }
+    bool IsCoroutine() const { return coptr != NULL; }
+    bool IsChain() const { return !m_chain.empty(); }
     std::string JobCompleteCallback() { return output; };
     int GetUniqueID() const { return m_jobID; }
 
     std::string input;
 
+    // Job being executed by the current worker thread
+    inline static thread_local Job *s_currentJob = nullptr;
+
 private:
+    std::string RunChain(const std::string &input);
+
     fnptr ptr = NULL;
+    cofnptr coptr = NULL;
+    std::vector<fnptr> m_chain;
+    JobTask m_task;
+    std::function<bool()> m_resumeWhen;
+    std::string m_resultCacheKey; // Set when the output should be memoized
+    bool m_journaled = false;      // Submission was written to the job journal
+    bool m_failed = false;         // Didn't produce a real output (e.g. crashed its worker process)
+    std::shared_ptr<void> m_module; // Plugin the function lives in, kept loaded while this job exists
     std::string output;
     int m_jobID = -1;
     int m_jobType = -1;
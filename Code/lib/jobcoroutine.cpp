@@ -0,0 +1,140 @@
+#include <iostream>
+#include "jobcoroutine.h"
+#include "jobsystem.h"
+#include "job.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+void SuspendCurrentJob(std::function<bool()> resumeWhen)
+{
+    Job *currentJob = Job::s_currentJob;
+    if (currentJob == nullptr)
+    {
+        std::cout << "ERROR: A coroutine job can only suspend while running on a worker thread." << std::endl;
+        return;
+    }
+    // The worker parks the job once the coroutine hands control back
+    currentJob->m_resumeWhen = resumeWhen;
+}
+
+// Completed, or gone (never created, destroyed or already finished) so it never will be
+static bool IsAwaitedJobSettled(int jobID)
+{
+    JobStatus jobStatus = JobSystem::CreateOrGet()->GetJobStatus(jobID);
+    return jobStatus == JOB_STATUS_COMPLETED || jobStatus == JOB_STATUS_RETIRED || jobStatus == JOB_STATUS_NEVER_SEEN;
+}
+
+bool JobAwaiter::await_ready() const
+{
+    return m_jobID < 0 || IsAwaitedJobSettled(m_jobID);
+}
+
+void JobAwaiter::await_suspend(std::coroutine_handle<>) const
+{
+    int jobID = m_jobID;
+    SuspendCurrentJob([jobID]
+                      { return IsAwaitedJobSettled(jobID); });
+}
+
+std::string JobAwaiter::await_resume() const
+{
+    if (m_jobID < 0)
+        return "ERROR: The awaited job was not created";
+    if (JobSystem::CreateOrGet()->GetJobStatus(m_jobID) != JOB_STATUS_COMPLETED)
+        return "ERROR: The awaited job was destroyed or already finished";
+    return JobSystem::CreateOrGet()->FinishJob(m_jobID);
+}
+
+void TimerAwaiter::await_suspend(std::coroutine_handle<>) const
+{
+    std::chrono::steady_clock::time_point deadline = m_deadline;
+    SuspendCurrentJob([deadline]
+                      { return std::chrono::steady_clock::now() >= deadline; });
+}
+
+bool SubprocessAwaiter::await_suspend(std::coroutine_handle<>)
+{
+    // Redirect cerr to cout
+    std::string command = m_command + " 2>&1";
+
+    // Open pipe and run command
+#ifdef _WIN32
+    m_pipe = _popen(command.c_str(), "r");
+#else
+    m_pipe = popen(command.c_str(), "r");
+#endif
+
+    if (!m_pipe)
+    {
+        // Resume right away with the error
+        return false;
+    }
+
+#ifndef _WIN32
+    // Read without blocking so the pipe can be polled by any worker
+    int fd = fileno(m_pipe);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+
+    SuspendCurrentJob([this]
+                      { return ReadAvailable(); });
+    return true;
+}
+
+bool SubprocessAwaiter::ReadAvailable()
+{
+    char buffer[4096];
+#ifdef _WIN32
+    // No non-blocking pipes here, read until the end of the process
+    while (fgets(buffer, sizeof(buffer), m_pipe) != NULL)
+    {
+        m_output.append(buffer);
+    }
+    return true;
+#else
+    int fd = fileno(m_pipe);
+    while (true)
+    {
+        ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+        if (bytesRead > 0)
+        {
+            m_output.append(buffer, bytesRead);
+        }
+        else if (bytesRead == 0)
+        {
+            // End of the process output
+            return true;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return false;
+        }
+        else if (errno != EINTR)
+        {
+            return true;
+        }
+    }
+#endif
+}
+
+std::string SubprocessAwaiter::await_resume()
+{
+    if (!m_pipe)
+    {
+        return "popen Failed: Failed to open pipe";
+    }
+
+    // Close pipe
+#ifdef _WIN32
+    _pclose(m_pipe);
+#else
+    pclose(m_pipe);
+#endif
+    m_pipe = nullptr;
+
+    return m_output;
+}
@@ -0,0 +1,107 @@
+#ifndef JOB_SYSTEM_JOBCOROUTINE_H
+#define JOB_SYSTEM_JOBCOROUTINE_H
+
+#include <coroutine>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <functional>
+
+// Return type of a coroutine job body:
+//     JobTask myJob(std::string input) { ... co_return output; }
+// The body can co_await AwaitJob(), SleepFor() or RunSubprocess(). While it waits,
+// the job is parked and its worker goes on to other jobs.
+class JobTask
+{
+public:
+    struct promise_type
+    {
+        std::string output;
+
+        JobTask get_return_object() { return JobTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(std::string value) { output = value; }
+        void unhandled_exception() { output = "ERROR: Unhandled exception in coroutine job"; }
+    };
+
+    JobTask() {}
+    explicit JobTask(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    JobTask(JobTask &&other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+    JobTask &operator=(JobTask &&other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+    JobTask(const JobTask &) = delete;
+    JobTask &operator=(const JobTask &) = delete;
+    ~JobTask() { Reset(); }
+
+    bool IsValid() const { return (bool)m_handle; }
+    bool IsDone() const { return m_handle && m_handle.done(); }
+    void Resume() { m_handle.resume(); }
+    std::string GetOutput() const { return m_handle.promise().output; }
+    void Reset()
+    {
+        if (m_handle)
+            m_handle.destroy();
+        m_handle = nullptr;
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle = nullptr;
+};
+
+typedef JobTask (*cofnptr)(std::string);
+
+// Parks the current coroutine job until resumeWhen() returns true.
+// Must be called from inside a coroutine job body.
+void SuspendCurrentJob(std::function<bool()> resumeWhen);
+
+// co_await AwaitJob(jobID) resumes with the output of another job (and retires it).
+// A job that is gone (rejected, destroyed or already finished) resumes it with an error output.
+struct JobAwaiter
+{
+    int m_jobID = -1;
+
+    bool await_ready() const;
+    void await_suspend(std::coroutine_handle<>) const;
+    std::string await_resume() const;
+};
+
+// co_await SleepFor(duration) resumes once the duration has passed
+struct TimerAwaiter
+{
+    std::chrono::steady_clock::time_point m_deadline;
+
+    bool await_ready() const { return std::chrono::steady_clock::now() >= m_deadline; }
+    void await_suspend(std::coroutine_handle<>) const;
+    void await_resume() const {}
+};
+
+// co_await RunSubprocess(command) resumes with the combined stdout/stderr of the command
+struct SubprocessAwaiter
+{
+    explicit SubprocessAwaiter(std::string command) : m_command(command) {}
+
+    std::string m_command;
+    FILE *m_pipe = nullptr;
+    std::string m_output;
+
+    bool await_ready() const { return false; }
+    bool await_suspend(std::coroutine_handle<>);
+    std::string await_resume();
+
+    bool ReadAvailable();
+};
+
+inline JobAwaiter AwaitJob(int jobID) { return JobAwaiter{jobID}; }
+inline TimerAwaiter SleepFor(std::chrono::milliseconds duration) { return TimerAwaiter{std::chrono::steady_clock::now() + duration}; }
+inline SubprocessAwaiter RunSubprocess(std::string command) { return SubprocessAwaiter(command); }
+
+#endif // JOB_SYSTEM_JOBCOROUTINE_H
@@ -0,0 +1,386 @@
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <map>
+#include "jobdiskcache.h"
+#include "jobresultcache.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char s_fileMagic[8] = {'J', 'O', 'B', 'C', 'A', 'C', 'H', '1'};
+static const uint32_t s_recordMagic = 0x4A524543; // "JREC"
+static const uint32_t s_recordErased = 1;
+
+JobDiskCache::~JobDiskCache()
+{
+    Close();
+}
+
+bool JobDiskCache::Open(std::string path)
+{
+#ifdef _WIN32
+    std::cout << "ERROR: The persistent job cache is not supported on this platform." << std::endl;
+    return false;
+#else
+    Close();
+
+    m_diskCacheMutex.lock();
+
+    // Every process using the file holds its lock file shared, so getting it exclusively
+    // means nobody else has the file mapped
+    m_lockFd = open((path + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_lockFd == -1)
+    {
+        m_diskCacheMutex.unlock();
+        std::cout << "ERROR: Unable to open job cache lock file " << path << ".lock" << std::endl;
+        return false;
+    }
+    bool alone = flock(m_lockFd, LOCK_EX | LOCK_NB) == 0;
+    if (!alone)
+    {
+        flock(m_lockFd, LOCK_SH);
+    }
+
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (m_fd == -1)
+    {
+        close(m_lockFd);
+        m_lockFd = -1;
+        m_diskCacheMutex.unlock();
+        std::cout << "ERROR: Unable to open job cache file " << path << std::endl;
+        return false;
+    }
+    m_path = path;
+
+    // Write the file header once, whoever gets the lock first
+    flock(m_fd, LOCK_EX);
+    struct stat fileStat;
+    fstat(m_fd, &fileStat);
+    if (fileStat.st_size == 0)
+    {
+        write(m_fd, s_fileMagic, sizeof(s_fileMagic));
+    }
+    flock(m_fd, LOCK_UN);
+
+    char magic[sizeof(s_fileMagic)] = {};
+    if (pread(m_fd, magic, sizeof(magic), 0) != sizeof(magic) || std::memcmp(magic, s_fileMagic, sizeof(magic)) != 0)
+    {
+        close(m_fd);
+        close(m_lockFd);
+        m_fd = -1;
+        m_lockFd = -1;
+        m_diskCacheMutex.unlock();
+        std::cout << "ERROR: " << path << " is not a job cache file" << std::endl;
+        return false;
+    }
+    m_indexedSize = sizeof(s_fileMagic);
+
+    Refresh();
+    if (alone)
+    {
+        Compact();
+        flock(m_lockFd, LOCK_SH); // Others can open it from now on
+    }
+    m_diskCacheMutex.unlock();
+    return true;
+#endif
+}
+
+void JobDiskCache::Close()
+{
+#ifndef _WIN32
+    m_diskCacheMutex.lock();
+    if (m_mapped)
+    {
+        munmap((void *)m_mapped, m_mappedSize);
+    }
+    if (m_fd != -1)
+    {
+        close(m_fd);
+    }
+    if (m_lockFd != -1)
+    {
+        close(m_lockFd);
+    }
+    m_mapped = nullptr;
+    m_mappedSize = 0;
+    m_indexedSize = 0;
+    m_fd = -1;
+    m_lockFd = -1;
+    m_index.clear();
+    m_diskCacheMutex.unlock();
+#endif
+}
+
+bool JobDiskCache::IsOpen() const
+{
+    m_diskCacheMutex.lock();
+    bool open = m_fd != -1;
+    m_diskCacheMutex.unlock();
+    return open;
+}
+
+size_t JobDiskCache::GetFileSize() const
+{
+    m_diskCacheMutex.lock();
+    size_t fileSize = m_mappedSize;
+    m_diskCacheMutex.unlock();
+    return fileSize;
+}
+
+bool JobDiskCache::Lookup(const std::string &key, std::string &output)
+{
+    uint64_t keyHash = HashBytes(key.data(), key.size());
+
+    m_diskCacheMutex.lock();
+    if (m_fd == -1)
+    {
+        m_diskCacheMutex.unlock();
+        return false;
+    }
+
+    // Pick up records appended by other processes
+    Refresh();
+
+    bool found = false;
+    std::unordered_map<uint64_t, long long>::iterator indexIter = m_index.find(keyHash);
+    if (indexIter != m_index.end() && indexIter->second != -1)
+    {
+        const char *record = m_mapped + indexIter->second;
+        RecordHeader header;
+        std::memcpy(&header, record, sizeof(header));
+
+        // Hashes can collide, compare the full key
+        if (header.m_keySize == key.size() && std::memcmp(record + sizeof(header), key.data(), key.size()) == 0)
+        {
+            output.assign(record + sizeof(header) + header.m_keySize, header.m_valueSize);
+            found = true;
+        }
+    }
+    m_diskCacheMutex.unlock();
+    return found;
+}
+
+void JobDiskCache::Store(const std::string &key, const std::string &output)
+{
+    Append(key, output, 0);
+}
+
+void JobDiskCache::Erase(const std::string &key)
+{
+    // Records are never rewritten, append a tombstone instead
+    std::string output;
+    if (Lookup(key, output))
+    {
+        Append(key, "", s_recordErased);
+    }
+}
+
+bool JobDiskCache::Append(const std::string &key, const std::string &output, uint32_t flags)
+{
+#ifdef _WIN32
+    return false;
+#else
+    RecordHeader header = {};
+    header.m_magic = s_recordMagic;
+    header.m_flags = flags;
+    header.m_keySize = (uint32_t)key.size();
+    header.m_valueSize = output.size();
+    header.m_keyHash = HashBytes(key.data(), key.size());
+    header.m_checksum = HashBytes(output.data(), output.size(), HashBytes(key.data(), key.size(), header.m_keyHash));
+
+    // Build the whole record so it goes out in a single append
+    std::string record((const char *)&header, sizeof(header));
+    record += key;
+    record += output;
+
+    m_diskCacheMutex.lock();
+    if (m_fd == -1)
+    {
+        m_diskCacheMutex.unlock();
+        return false;
+    }
+    flock(m_fd, LOCK_EX);
+
+    // Nobody else can be writing now, so anything past the last complete record is a torn
+    // tail left by a crash. Other processes may have it mapped, so it is not cut off here;
+    // records behind it could never be read, so nothing is stored until the next compaction.
+    Refresh();
+    struct stat fileStat;
+    if (fstat(m_fd, &fileStat) != 0 || (size_t)fileStat.st_size > m_indexedSize)
+    {
+        flock(m_fd, LOCK_UN);
+        m_diskCacheMutex.unlock();
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < record.size())
+    {
+        ssize_t result = write(m_fd, record.data() + written, record.size() - written);
+        if (result <= 0)
+            break;
+        written += result;
+    }
+    flock(m_fd, LOCK_UN);
+
+    Refresh();
+    m_diskCacheMutex.unlock();
+    return written == record.size();
+#endif
+}
+
+bool JobDiskCache::Compact()
+{
+#ifdef _WIN32
+    return false;
+#else
+    // Live records are the newest one of every key that wasn't erased
+    std::map<long long, size_t> live; // Offset -> record size, kept in file order
+    size_t liveSize = sizeof(s_fileMagic);
+    for (const std::pair<const uint64_t, long long> &entry : m_index)
+    {
+        if (entry.second == -1)
+            continue;
+        RecordHeader header;
+        std::memcpy(&header, m_mapped + entry.second, sizeof(header));
+        size_t recordSize = sizeof(header) + header.m_keySize + header.m_valueSize;
+        live[entry.second] = recordSize;
+        liveSize += recordSize;
+    }
+
+    struct stat fileStat;
+    if (fstat(m_fd, &fileStat) != 0)
+        return false;
+    size_t fileSize = fileStat.st_size;
+
+    // Rewriting is only worth it once at least half of the file is dead
+    if (liveSize * 2 > fileSize)
+    {
+        if (fileSize > m_indexedSize)
+        {
+            // The torn tail goes, and the mapping that still covers it with it
+            ftruncate(m_fd, m_indexedSize);
+            if (m_mapped)
+            {
+                munmap((void *)m_mapped, m_mappedSize);
+            }
+            void *mapped = mmap(nullptr, m_indexedSize, PROT_READ, MAP_SHARED, m_fd, 0);
+            m_mapped = mapped != MAP_FAILED ? (const char *)mapped : nullptr;
+            m_mappedSize = m_mapped ? m_indexedSize : 0;
+            if (!m_mapped)
+            {
+                m_indexedSize = sizeof(s_fileMagic);
+                m_index.clear();
+            }
+        }
+        return true;
+    }
+
+    std::string compactPath = m_path + ".compact";
+    int compactFd = open(compactPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (compactFd == -1)
+        return false;
+    std::string contents(s_fileMagic, sizeof(s_fileMagic));
+    contents.reserve(liveSize);
+    for (const std::pair<const long long, size_t> &record : live)
+    {
+        contents.append(m_mapped + record.first, record.second);
+    }
+    size_t written = 0;
+    while (written < contents.size())
+    {
+        ssize_t result = write(compactFd, contents.data() + written, contents.size() - written);
+        if (result <= 0)
+            break;
+        written += result;
+    }
+    bool complete = written == contents.size() && fsync(compactFd) == 0;
+    close(compactFd);
+    if (!complete || rename(compactPath.c_str(), m_path.c_str()) != 0)
+    {
+        unlink(compactPath.c_str());
+        return false;
+    }
+
+    // Switch over to the compacted file
+    int compactedFd = open(m_path.c_str(), O_RDWR | O_APPEND);
+    if (compactedFd == -1)
+        return false;
+    if (m_mapped)
+    {
+        munmap((void *)m_mapped, m_mappedSize);
+    }
+    close(m_fd);
+    m_fd = compactedFd;
+    m_mapped = nullptr;
+    m_mappedSize = 0;
+    m_indexedSize = sizeof(s_fileMagic);
+    m_index.clear();
+    Refresh();
+    return true;
+#endif
+}
+
+void JobDiskCache::Refresh()
+{
+#ifndef _WIN32
+    struct stat fileStat;
+    if (fstat(m_fd, &fileStat) != 0 || (size_t)fileStat.st_size <= m_indexedSize)
+        return;
+    size_t fileSize = fileStat.st_size;
+    if (fileSize <= m_mappedSize)
+    {
+        IndexRecords(fileSize);
+        return;
+    }
+
+    // Remap the bigger file
+    if (m_mapped)
+    {
+        munmap((void *)m_mapped, m_mappedSize);
+    }
+    void *mapped = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        m_mapped = nullptr;
+        m_mappedSize = 0;
+        m_indexedSize = sizeof(s_fileMagic);
+        m_index.clear();
+        return;
+    }
+    m_mapped = (const char *)mapped;
+    m_mappedSize = fileSize;
+
+    IndexRecords(fileSize);
+#endif
+}
+
+void JobDiskCache::IndexRecords(size_t fileSize)
+{
+    // Index every complete record after the last one we saw
+    while (m_indexedSize + sizeof(RecordHeader) <= fileSize)
+    {
+        const char *record = m_mapped + m_indexedSize;
+        RecordHeader header;
+        std::memcpy(&header, record, sizeof(header));
+
+        size_t recordSize = sizeof(header) + header.m_keySize + header.m_valueSize;
+        if (header.m_magic != s_recordMagic || header.m_valueSize > fileSize || m_indexedSize + recordSize > fileSize)
+            break; // Still being written, or torn by a crashed writer
+
+        const char *key = record + sizeof(header);
+        uint64_t checksum = HashBytes(key + header.m_keySize, header.m_valueSize, HashBytes(key, header.m_keySize, header.m_keyHash));
+        if (checksum == header.m_checksum)
+        {
+            m_index[header.m_keyHash] = (header.m_flags & s_recordErased) ? -1 : (long long)m_indexedSize;
+        }
+        m_indexedSize += recordSize;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef JOB_SYSTEM_JOBDISKCACHE_H
+#define JOB_SYSTEM_JOBDISKCACHE_H
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+// Append-only file of (key, output) records that is memory-mapped for reads.
+// Any number of processes can read it while one appends at a time (flock), and the
+// newest record for a key wins. Torn records from a crashed writer fail their checksum
+// and are ignored.
+// The first process to open the file (nobody else holds the .lock file next to it)
+// compacts it: replaced and erased records are dropped and a torn tail is cut off.
+// While others have it open the file is never shrunk, they may have it mapped. A torn tail
+// then stays, and the cache is read-only (stores are dropped) until a sole opener cuts it off.
+class JobDiskCache
+{
+public:
+    JobDiskCache() {}
+    ~JobDiskCache();
+
+    bool Open(std::string path);
+    void Close();
+    bool IsOpen() const;
+
+    bool Lookup(const std::string &key, std::string &output);
+    void Store(const std::string &key, const std::string &output);
+    void Erase(const std::string &key);
+
+    size_t GetFileSize() const;
+
+private:
+    struct RecordHeader
+    {
+        uint32_t m_magic;
+        uint32_t m_flags;
+        uint32_t m_keySize;
+        uint32_t m_reserved;
+        uint64_t m_valueSize;
+        uint64_t m_keyHash;
+        uint64_t m_checksum;
+    };
+
+    bool Append(const std::string &key, const std::string &output, uint32_t flags); // False behind a torn tail
+    bool Compact(); // Only while no other process has the file open
+    void Refresh(); // Map and index whatever other writers appended since the last look
+    void IndexRecords(size_t fileSize);
+
+    std::string m_path;
+    int m_fd = -1;
+    int m_lockFd = -1; // Held shared while open, exclusively only by a sole user
+    const char *m_mapped = nullptr;
+    size_t m_mappedSize = 0;
+    size_t m_indexedSize = 0;
+
+    // Key hash -> offset of the newest record, -1 if the key was erased
+    std::unordered_map<uint64_t, long long> m_index;
+    mutable std::mutex m_diskCacheMutex;
+};
+
+#endif // JOB_SYSTEM_JOBDISKCACHE_H
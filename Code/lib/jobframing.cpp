@@ -0,0 +1,193 @@
+#include "jobframing.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+static bool SendAll(int socket, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        // Don't get killed by SIGPIPE if the other process died
+        ssize_t sent = send(socket, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool ReceiveAll(int socket, char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t received = recv(socket, data, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+bool SendFrame(int socket, uint16_t frameType, const std::string &payload, uint16_t flags)
+{
+    if (payload.size() > JOB_FRAME_MAX_PAYLOAD)
+        return false;
+
+    JobFrameHeader header;
+    header.m_payloadSize = (uint32_t)payload.size();
+    header.m_frameType = frameType;
+    header.m_flags = flags;
+
+    // Small frames go out in one send
+    if (payload.size() <= 4096)
+    {
+        std::string frame((const char *)&header, sizeof(header));
+        frame += payload;
+        return SendAll(socket, frame.data(), frame.size());
+    }
+    return SendAll(socket, (const char *)&header, sizeof(header)) && SendAll(socket, payload.data(), payload.size());
+}
+
+bool ReceiveFrame(int socket, uint16_t &frameType, std::string &payload, uint16_t *flags)
+{
+    JobFrameHeader header;
+    if (!ReceiveAll(socket, (char *)&header, sizeof(header)) || header.m_payloadSize > JOB_FRAME_MAX_PAYLOAD)
+        return false;
+
+    frameType = header.m_frameType;
+    if (flags)
+        *flags = header.m_flags;
+    payload.resize(header.m_payloadSize);
+    return header.m_payloadSize == 0 || ReceiveAll(socket, &payload[0], header.m_payloadSize);
+}
+
+bool SendDescriptors(int socket, const std::vector<int> &descriptors)
+{
+    // Descriptors ride along with a single byte of data
+    char data = 0;
+    struct iovec iov;
+    iov.iov_base = &data;
+    iov.iov_len = 1;
+
+    std::vector<char> control(CMSG_SPACE(descriptors.size() * sizeof(int)));
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+    struct cmsghdr *controlHeader = CMSG_FIRSTHDR(&message);
+    controlHeader->cmsg_level = SOL_SOCKET;
+    controlHeader->cmsg_type = SCM_RIGHTS;
+    controlHeader->cmsg_len = CMSG_LEN(descriptors.size() * sizeof(int));
+    std::memcpy(CMSG_DATA(controlHeader), descriptors.data(), descriptors.size() * sizeof(int));
+
+    while (true)
+    {
+        ssize_t sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        return sent == 1;
+    }
+}
+
+bool ReceiveDescriptors(int socket, std::vector<int> &descriptors, size_t count)
+{
+    char data;
+    struct iovec iov;
+    iov.iov_base = &data;
+    iov.iov_len = 1;
+
+    std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+    ssize_t received;
+    do
+    {
+        received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received != 1)
+        return false;
+
+    descriptors.clear();
+    for (struct cmsghdr *controlHeader = CMSG_FIRSTHDR(&message); controlHeader; controlHeader = CMSG_NXTHDR(&message, controlHeader))
+    {
+        if (controlHeader->cmsg_level != SOL_SOCKET || controlHeader->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t numDescriptors = (controlHeader->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        size_t first = descriptors.size();
+        descriptors.resize(first + numDescriptors);
+        std::memcpy(descriptors.data() + first, CMSG_DATA(controlHeader), numDescriptors * sizeof(int));
+    }
+
+    // Don't leak whatever did arrive if it isn't what was asked for
+    if (descriptors.size() != count || (message.msg_flags & MSG_CTRUNC))
+    {
+        for (int descriptor : descriptors)
+            close(descriptor);
+        descriptors.clear();
+        return false;
+    }
+    return true;
+}
+
+bool IsPeerSameUser(int socket)
+{
+    // The kernel vouches for these, unlike anything the peer could send
+#ifdef __linux__
+    struct ucred credentials;
+    socklen_t size = sizeof(credentials);
+    if (getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0)
+        return false;
+    return credentials.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(socket, &uid, &gid) != 0)
+        return false;
+    return uid == geteuid();
+#endif
+}
+
+#else
+
+bool SendDescriptors(int socket, const std::vector<int> &descriptors)
+{
+    return false;
+}
+
+bool ReceiveDescriptors(int socket, std::vector<int> &descriptors, size_t count)
+{
+    return false;
+}
+
+bool SendFrame(int socket, uint16_t frameType, const std::string &payload, uint16_t flags)
+{
+    return false;
+}
+
+bool ReceiveFrame(int socket, uint16_t &frameType, std::string &payload, uint16_t *flags)
+{
+    return false;
+}
+
+bool IsPeerSameUser(int socket)
+{
+    return false;
+}
+
+#endif
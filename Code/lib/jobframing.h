@@ -0,0 +1,47 @@
+#ifndef JOB_SYSTEM_JOBFRAMING_H
+#define JOB_SYSTEM_JOBFRAMING_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Frames sent over local sockets: an 8 byte header (payload size, frame type) then the payload
+enum JobFrameType
+{
+    JOB_FRAME_RUN = 1,           // Parent -> worker process: u64 function address, then the input (or its ring location)
+    JOB_FRAME_RESULT,            // Worker process -> parent: the output
+    JOB_FRAME_UNKNOWN_JOB,       // Worker process -> parent: the function is not in this process
+    JOB_FRAME_SHUTDOWN,          // Parent -> worker process: exit
+    JOB_FRAME_CALL,              // Client -> daemon: u32 method name size, method name, then the JSON arguments
+    JOB_FRAME_REPLY,             // Daemon -> client: the JSON result
+    JOB_FRAME_SPAWN,             // Parent -> spawner: u64 memory limit, u64 ring capacity, u64 function addresses; then both ring descriptors
+    JOB_FRAME_SPAWNED,           // Spawner -> parent: i32 pid (-1 on failure); then the worker process socket
+    JOB_FRAME_STOP_PROCESS,      // Parent -> spawner: i32 pid of a worker process to kill and reap
+    NUM_JOB_FRAME_TYPES
+};
+
+// The payload is a (u64 position, u64 size) pair into a JobSharedRing instead of the data
+constexpr uint16_t JOB_FRAME_FLAG_SHARED = 1;
+
+struct JobFrameHeader
+{
+    uint32_t m_payloadSize;
+    uint16_t m_frameType;
+    uint16_t m_flags;
+};
+
+constexpr uint32_t JOB_FRAME_MAX_PAYLOAD = 0x7FFFFFFF;
+
+// Both return false once the other end is gone
+bool SendFrame(int socket, uint16_t frameType, const std::string &payload, uint16_t flags = 0);
+bool ReceiveFrame(int socket, uint16_t &frameType, std::string &payload, uint16_t *flags = nullptr);
+
+// Hand open descriptors to the process at the other end of a Unix domain socket.
+// Received descriptors are close-on-exec.
+bool SendDescriptors(int socket, const std::vector<int> &descriptors);
+bool ReceiveDescriptors(int socket, std::vector<int> &descriptors, size_t count);
+
+// Whether the process at the other end of a Unix domain socket runs as this user
+bool IsPeerSameUser(int socket);
+
+#endif // JOB_SYSTEM_JOBFRAMING_H
@@ -0,0 +1,267 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <chrono>
+#include <unordered_map>
+#include "jobjournal.h"
+#include "jobresultcache.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const uint32_t s_journalMagic = 0x4A4A524E; // "JJRN"
+
+// Write a batch right away once it holds this much, instead of waiting for the interval
+static const size_t s_maxBatchBytes = 1024 * 1024;
+
+JobJournal::JobJournal(int flushIntervalMilliseconds) : m_flushIntervalMilliseconds(flushIntervalMilliseconds)
+{
+}
+
+JobJournal::~JobJournal()
+{
+    Close();
+}
+
+std::vector<JobJournalEntry> JobJournal::Replay(std::string path)
+{
+    std::vector<JobJournalEntry> entries;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return entries;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string bytes = contents.str();
+
+    // Job ID -> newest entry with that ID (IDs restart in every run)
+    std::unordered_map<int, size_t> entryByJobID;
+
+    size_t offset = 0;
+    while (offset + sizeof(RecordHeader) <= bytes.size())
+    {
+        RecordHeader header;
+        std::memcpy(&header, bytes.data() + offset, sizeof(header));
+        if (header.m_magic != s_journalMagic || header.m_payloadSize > bytes.size() - offset - sizeof(header))
+            break; // Torn by a crash, nothing after it can be trusted
+
+        const char *payload = bytes.data() + offset + sizeof(header);
+        if (HashBytes(payload, header.m_payloadSize) != header.m_checksum)
+            break;
+        offset += sizeof(header) + header.m_payloadSize;
+
+        // Payload is a list of length-prefixed fields
+        std::vector<std::string> fields;
+        size_t fieldOffset = 0;
+        for (uint32_t i = 0; i < header.m_numFields && fieldOffset + sizeof(uint64_t) <= header.m_payloadSize; i++)
+        {
+            uint64_t fieldSize;
+            std::memcpy(&fieldSize, payload + fieldOffset, sizeof(fieldSize));
+            fieldOffset += sizeof(fieldSize);
+            fields.emplace_back(payload + fieldOffset, fieldSize);
+            fieldOffset += fieldSize;
+        }
+
+        if (header.m_recordType == JOURNAL_RECORD_SUBMIT && fields.size() == 3)
+        {
+            JobJournalEntry entry;
+            entry.m_jobID = header.m_jobID;
+            entry.m_jobType = fields[0];
+            entry.m_key = fields[1];
+            entry.m_input = fields[2];
+            entryByJobID[entry.m_jobID] = entries.size();
+            entries.push_back(entry);
+        }
+        else if (header.m_recordType == JOURNAL_RECORD_COMPLETE && fields.size() == 1 && entryByJobID.count(header.m_jobID))
+        {
+            JobJournalEntry &entry = entries[entryByJobID[header.m_jobID]];
+            entry.m_completed = true;
+            entry.m_output = fields[0];
+        }
+        else if (header.m_recordType == JOURNAL_RECORD_RETIRE && entryByJobID.count(header.m_jobID))
+        {
+            entries[entryByJobID[header.m_jobID]].m_retired = true;
+        }
+    }
+    return entries;
+}
+
+bool JobJournal::Open(std::string path, const std::vector<JobJournalEntry> &carriedOver)
+{
+    Close();
+
+    // Write the compacted journal next to the old one and swap it in, so a crash
+    // here still leaves one complete journal behind
+    std::string compacted;
+    for (const JobJournalEntry &entry : carriedOver)
+    {
+        AppendRecord(compacted, JOURNAL_RECORD_SUBMIT, entry.m_jobID, {&entry.m_jobType, &entry.m_key, &entry.m_input});
+        if (entry.m_completed)
+            AppendRecord(compacted, JOURNAL_RECORD_COMPLETE, entry.m_jobID, {&entry.m_output});
+        if (entry.m_retired)
+            AppendRecord(compacted, JOURNAL_RECORD_RETIRE, entry.m_jobID, {});
+    }
+
+    std::string tempPath = path + ".tmp";
+    FILE *tempFile = fopen(tempPath.c_str(), "wb");
+    if (!tempFile)
+    {
+        std::cout << "ERROR: Unable to open job journal " << tempPath << std::endl;
+        return false;
+    }
+    m_file = tempFile;
+    WriteBuffered(compacted);
+    fclose(tempFile);
+    m_file = nullptr;
+
+    std::remove(path.c_str());
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        std::cout << "ERROR: Unable to replace job journal " << path << std::endl;
+        return false;
+    }
+
+    m_path = path;
+    m_file = fopen(path.c_str(), "ab");
+    if (!m_file)
+    {
+        std::cout << "ERROR: Unable to open job journal " << path << std::endl;
+        return false;
+    }
+
+    m_isStopping = false;
+    m_flushThread = new std::thread(&JobJournal::FlushThreadMain, this);
+    return true;
+}
+
+void JobJournal::Close()
+{
+    if (m_flushThread)
+    {
+        m_bufferMutex.lock();
+        m_isStopping = true;
+        m_bufferMutex.unlock();
+        m_bufferCondition.notify_all();
+
+        m_flushThread->join();
+        delete m_flushThread;
+        m_flushThread = nullptr;
+    }
+
+    // Anything recorded after the thread stopped
+    Flush();
+
+    if (m_file)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+void JobJournal::Discard()
+{
+    Close();
+    std::remove(m_path.c_str());
+}
+
+void JobJournal::RecordSubmit(int jobID, const std::string &jobType, const std::string &key, const std::string &input)
+{
+    m_bufferMutex.lock();
+    AppendRecord(m_buffer, JOURNAL_RECORD_SUBMIT, jobID, {&jobType, &key, &input});
+    bool batchFull = m_buffer.size() >= s_maxBatchBytes;
+    m_bufferMutex.unlock();
+
+    if (batchFull)
+        m_bufferCondition.notify_all();
+}
+
+void JobJournal::RecordComplete(int jobID, const std::string &output)
+{
+    m_bufferMutex.lock();
+    AppendRecord(m_buffer, JOURNAL_RECORD_COMPLETE, jobID, {&output});
+    bool batchFull = m_buffer.size() >= s_maxBatchBytes;
+    m_bufferMutex.unlock();
+
+    if (batchFull)
+        m_bufferCondition.notify_all();
+}
+
+void JobJournal::RecordRetire(int jobID)
+{
+    m_bufferMutex.lock();
+    AppendRecord(m_buffer, JOURNAL_RECORD_RETIRE, jobID, {});
+    m_bufferMutex.unlock();
+}
+
+void JobJournal::Flush()
+{
+    std::string pending;
+    m_bufferMutex.lock();
+    pending.swap(m_buffer);
+    m_bufferMutex.unlock();
+
+    WriteBuffered(pending);
+}
+
+void JobJournal::AppendRecord(std::string &buffer, uint32_t recordType, int jobID, const std::vector<const std::string *> &fields)
+{
+    std::string payload;
+    for (const std::string *field : fields)
+    {
+        uint64_t fieldSize = field->size();
+        payload.append((const char *)&fieldSize, sizeof(fieldSize));
+        payload.append(*field);
+    }
+
+    RecordHeader header = {};
+    header.m_magic = s_journalMagic;
+    header.m_recordType = recordType;
+    header.m_jobID = jobID;
+    header.m_numFields = (uint32_t)fields.size();
+    header.m_payloadSize = payload.size();
+    header.m_checksum = HashBytes(payload.data(), payload.size());
+
+    buffer.append((const char *)&header, sizeof(header));
+    buffer.append(payload);
+}
+
+void JobJournal::WriteBuffered(std::string &pending)
+{
+    if (pending.empty())
+        return;
+
+    m_fileMutex.lock();
+    if (m_file)
+    {
+        fwrite(pending.data(), 1, pending.size(), m_file);
+        fflush(m_file);
+#ifdef _WIN32
+        _commit(_fileno(m_file));
+#else
+        fsync(fileno(m_file));
+#endif
+    }
+    m_fileMutex.unlock();
+}
+
+void JobJournal::FlushThreadMain()
+{
+    std::unique_lock<std::mutex> bufferLock(m_bufferMutex);
+    while (!m_isStopping)
+    {
+        // One write and fsync for everything recorded during the interval
+        m_bufferCondition.wait_for(bufferLock, std::chrono::milliseconds(m_flushIntervalMilliseconds), [&]
+                                   { return m_isStopping || m_buffer.size() >= s_maxBatchBytes; });
+
+        std::string pending;
+        pending.swap(m_buffer);
+        bufferLock.unlock();
+        WriteBuffered(pending);
+        bufferLock.lock();
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef JOB_SYSTEM_JOBJOURNAL_H
+#define JOB_SYSTEM_JOBJOURNAL_H
+
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <condition_variable>
+
+enum JobJournalRecordType
+{
+    JOURNAL_RECORD_SUBMIT = 1,
+    JOURNAL_RECORD_COMPLETE,
+    JOURNAL_RECORD_RETIRE,
+    NUM_JOURNAL_RECORD_TYPES
+};
+
+// Everything the journal knows about one submitted job
+struct JobJournalEntry
+{
+    int m_jobID = -1;
+    std::string m_jobType;
+    std::string m_key; // Content key of the submission (see JobResultCache::MakeKey)
+    std::string m_input;
+    std::string m_output;
+    bool m_completed = false;
+    bool m_retired = false;
+};
+
+// Append-only log of job submissions and completions. Records are buffered and a
+// background thread writes and fsyncs them in batches, so recording costs no I/O on
+// the caller's thread. A crash can lose at most the last batch, whose jobs then run again.
+class JobJournal
+{
+public:
+    JobJournal(int flushIntervalMilliseconds = 5);
+    ~JobJournal();
+
+    // Read every intact record of a journal file, in submission order
+    static std::vector<JobJournalEntry> Replay(std::string path);
+
+    // Start a fresh journal holding only the given entries, then keep appending to it
+    bool Open(std::string path, const std::vector<JobJournalEntry> &carriedOver);
+    void Close();
+    void Discard(); // Clean shutdown, there is nothing to resume
+
+    void RecordSubmit(int jobID, const std::string &jobType, const std::string &key, const std::string &input);
+    void RecordComplete(int jobID, const std::string &output);
+    void RecordRetire(int jobID);
+
+    void Flush(); // Write and fsync everything recorded so far
+
+private:
+    struct RecordHeader
+    {
+        uint32_t m_magic;
+        uint32_t m_recordType;
+        int32_t m_jobID;
+        uint32_t m_numFields;
+        uint64_t m_payloadSize;
+        uint64_t m_checksum;
+    };
+
+    static void AppendRecord(std::string &buffer, uint32_t recordType, int jobID, const std::vector<const std::string *> &fields);
+    void WriteBuffered(std::string &pending);
+    void FlushThreadMain();
+
+    std::string m_path;
+    FILE *m_file = nullptr;
+    std::string m_buffer;
+    bool m_isStopping = false;
+    int m_flushIntervalMilliseconds = 5;
+    std::thread *m_flushThread = nullptr;
+    std::mutex m_bufferMutex;
+    std::mutex m_fileMutex;
+    std::condition_variable m_bufferCondition;
+};
+
+#endif // JOB_SYSTEM_JOBJOURNAL_H
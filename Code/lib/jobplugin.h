@@ -0,0 +1,34 @@
+#ifndef JOB_SYSTEM_JOBPLUGIN_H
+#define JOB_SYSTEM_JOBPLUGIN_H
+
+#include "job.h"
+
+// What a job plugin (a shared object loaded by JobPluginLoader) exports. A plugin lists
+// its jobs with JOB_PLUGIN_EXPORTS, e.g.
+//
+//     std::string resize(std::string input) { ... }
+//     JOB_PLUGIN_EXPORTS({"resize", resize, nullptr, 7, 0xFFFFFFFF})
+//
+// and is built against the same job.h, e.g. g++ -std=c++20 -shared -fPIC -o resize.so resize.cpp
+struct JobPluginExport
+{
+    const char *m_name;
+    fnptr m_function;     // Either a plain function...
+    cofnptr m_coroutine;  // ...or a coroutine, the other one is nullptr
+    int m_jobType;
+    unsigned long m_jobChannels;
+};
+
+typedef const JobPluginExport *(*JobPluginExportsFunction)(int *numExports);
+
+#define JOB_PLUGIN_ENTRY_POINT "JobPluginExports"
+
+#define JOB_PLUGIN_EXPORTS(...)                                                  \
+    extern "C" const JobPluginExport *JobPluginExports(int *numExports)          \
+    {                                                                            \
+        static const JobPluginExport exports[] = {__VA_ARGS__};                  \
+        *numExports = (int)(sizeof(exports) / sizeof(exports[0]));              \
+        return exports;                                                          \
+    }
+
+#endif // JOB_SYSTEM_JOBPLUGIN_H
@@ -0,0 +1,178 @@
+#include <iostream>
+#include <algorithm>
+#include <system_error>
+#include "jobpluginloader.h"
+#include "jobplugin.h"
+#include "jobsystem.h"
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+int JobPluginLoader::LoadDirectory(std::string directory)
+{
+    m_pluginsMutex.lock();
+    if (std::find(m_directories.begin(), m_directories.end(), directory) == m_directories.end())
+    {
+        m_directories.push_back(directory);
+    }
+    m_pluginsMutex.unlock();
+
+    int numLoaded = 0;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+    {
+        if (entry.path().extension() == ".so" && Load(entry.path().string()))
+            numLoaded++;
+    }
+    return numLoaded;
+}
+
+bool JobPluginLoader::Load(std::string path)
+{
+    m_pluginsMutex.lock();
+    bool loaded = LoadLocked(path);
+    m_pluginsMutex.unlock();
+    return loaded;
+}
+
+bool JobPluginLoader::LoadLocked(const std::string &path)
+{
+#ifndef _WIN32
+    std::error_code error;
+    std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, error);
+    if (error)
+    {
+        std::cout << "ERROR: Could not find job plugin " << path << std::endl;
+        return false;
+    }
+
+    // dlopen hands back the module it already has for a path it has seen, so every
+    // build gets loaded from its own copy
+    std::filesystem::path copyPath = std::filesystem::temp_directory_path(error) /
+                                     ("jobplugin-" + std::to_string(getpid()) + "-" + std::to_string(m_numLoads++) + "-" +
+                                      std::filesystem::path(path).filename().string());
+    if (!std::filesystem::copy_file(path, copyPath, std::filesystem::copy_options::overwrite_existing, error))
+    {
+        std::cout << "ERROR: Could not copy job plugin " << path << std::endl;
+        return false;
+    }
+    void *handle = dlopen(copyPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+    // The mapping stays valid after the copy is gone
+    std::filesystem::remove(copyPath, error);
+    if (!handle)
+    {
+        std::cout << "ERROR: Could not load job plugin " << path << ": " << dlerror() << std::endl;
+        return false;
+    }
+    std::shared_ptr<void> module(handle, [](void *handle)
+                                 { dlclose(handle); });
+
+    JobPluginExportsFunction exportsFunction = (JobPluginExportsFunction)dlsym(handle, JOB_PLUGIN_ENTRY_POINT);
+    if (!exportsFunction)
+    {
+        std::cout << "ERROR: Job plugin " << path << " does not export " << JOB_PLUGIN_ENTRY_POINT << std::endl;
+        return false;
+    }
+
+    int numExports = 0;
+    const JobPluginExport *exports = exportsFunction(&numExports);
+
+    Plugin plugin;
+    plugin.m_module = module;
+    plugin.m_modified = modified;
+    for (int i = 0; i < numExports; i++)
+    {
+        const JobPluginExport &jobExport = exports[i];
+        Job *job = nullptr;
+        if (jobExport.m_function)
+            job = new Job(jobExport.m_function, jobExport.m_jobType, jobExport.m_jobChannels);
+        else if (jobExport.m_coroutine)
+            job = new Job(jobExport.m_coroutine, jobExport.m_jobType, jobExport.m_jobChannels);
+        else
+            continue;
+
+        job->m_module = module;
+        m_jobSystem->Register(jobExport.m_name, job);
+        plugin.m_jobTypes.push_back(jobExport.m_name);
+    }
+
+    // Job types the previous build had but this one dropped
+    std::map<std::string, Plugin>::iterator previous = m_plugins.find(path);
+    if (previous != m_plugins.end())
+    {
+        for (const std::string &jobType : previous->second.m_jobTypes)
+        {
+            if (std::find(plugin.m_jobTypes.begin(), plugin.m_jobTypes.end(), jobType) == plugin.m_jobTypes.end())
+                m_jobSystem->Unregister(jobType);
+        }
+    }
+
+    std::cout << "Job plugin " << path << ": registered " << plugin.m_jobTypes.size() << " job types" << std::endl;
+    m_plugins[path] = plugin;
+    return true;
+#else
+    std::cout << "ERROR: Job plugins are not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+void JobPluginLoader::Unload(std::string path)
+{
+    m_pluginsMutex.lock();
+    std::map<std::string, Plugin>::iterator pluginIter = m_plugins.find(path);
+    if (pluginIter != m_plugins.end())
+    {
+        for (const std::string &jobType : pluginIter->second.m_jobTypes)
+        {
+            m_jobSystem->Unregister(jobType);
+        }
+        m_plugins.erase(pluginIter);
+    }
+    m_pluginsMutex.unlock();
+}
+
+int JobPluginLoader::ReloadChanged()
+{
+    m_pluginsMutex.lock();
+    std::vector<std::string> changed;
+    std::error_code error;
+
+    for (auto &kv : m_plugins)
+    {
+        std::filesystem::file_time_type modified = std::filesystem::last_write_time(kv.first, error);
+        if (!error && modified != kv.second.m_modified)
+            changed.push_back(kv.first);
+    }
+    for (const std::string &directory : m_directories)
+    {
+        for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+        {
+            std::string path = entry.path().string();
+            if (entry.path().extension() == ".so" && m_plugins.count(path) == 0)
+                changed.push_back(path);
+        }
+    }
+
+    int numReloaded = 0;
+    for (const std::string &path : changed)
+    {
+        if (LoadLocked(path))
+            numReloaded++;
+    }
+    m_pluginsMutex.unlock();
+    return numReloaded;
+}
+
+std::vector<std::string> JobPluginLoader::GetPlugins()
+{
+    std::vector<std::string> paths;
+    m_pluginsMutex.lock();
+    for (auto &kv : m_plugins)
+    {
+        paths.push_back(kv.first);
+    }
+    m_pluginsMutex.unlock();
+    return paths;
+}
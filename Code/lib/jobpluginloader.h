@@ -0,0 +1,51 @@
+#ifndef JOB_SYSTEM_JOBPLUGINLOADER_H
+#define JOB_SYSTEM_JOBPLUGINLOADER_H
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+class JobSystem;
+
+// Registers the jobs exported by plugin shared objects (see jobplugin.h) and swaps them
+// for new builds while the job system keeps running. Only the plugin's own job types are
+// re-registered; jobs already queued or running finish on the code they were created with,
+// and the old build is unloaded after the last of them is gone.
+class JobPluginLoader
+{
+public:
+    JobPluginLoader(JobSystem *jobSystem) : m_jobSystem(jobSystem) {}
+    ~JobPluginLoader() {}
+
+    // Loads every plugin in the directory and remembers it for ReloadChanged
+    int LoadDirectory(std::string directory);
+    bool Load(std::string path); // Loads the plugin, or reloads it if it was loaded before
+    void Unload(std::string path);
+
+    // Reloads plugins whose file changed and loads new ones from the loaded directories.
+    // Returns the number of plugins (re)loaded.
+    int ReloadChanged();
+
+    std::vector<std::string> GetPlugins();
+
+private:
+    struct Plugin
+    {
+        std::shared_ptr<void> m_module;
+        std::vector<std::string> m_jobTypes;
+        std::filesystem::file_time_type m_modified;
+    };
+
+    bool LoadLocked(const std::string &path);
+
+    JobSystem *m_jobSystem = nullptr;
+    std::map<std::string, Plugin> m_plugins;
+    std::vector<std::string> m_directories;
+    std::mutex m_pluginsMutex;
+    int m_numLoads = 0;
+};
+
+#endif // JOB_SYSTEM_JOBPLUGINLOADER_H
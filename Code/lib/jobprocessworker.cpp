@@ -0,0 +1,453 @@
+#include <iostream>
+#include <cstring>
+#include "jobprocessworker.h"
+#include "jobframing.h"
+#include "jobsystem.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <link.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#endif
+
+JobProcessWorker::JobProcessWorker(const char *uniqueName, unsigned long workerJobChannels, size_t memoryLimitBytes, JobSystem *jobSystem) : m_uniqueName(uniqueName),
+                                                                                                                                             m_workerJobChannels(workerJobChannels),
+                                                                                                                                             m_memoryLimitBytes(memoryLimitBytes),
+                                                                                                                                             m_jobSystem(jobSystem)
+{
+}
+
+JobProcessWorker::~JobProcessWorker()
+{
+    // If we haven't already signal thread then we should exit as soon as it can (after its current job if any)
+    ShutDown();
+
+    // Block
+    if (m_thread)
+    {
+        m_thread->join();
+        delete m_thread;
+        m_thread = nullptr;
+    }
+    StopProcess();
+}
+
+void JobProcessWorker::StartUp()
+{
+    // Shared with every child started for this worker
+    m_requestRing.Create(m_sharedRingBytes);
+    m_responseRing.Create(m_sharedRingBytes);
+
+    SpawnProcess();
+    m_thread = new std::thread(WorkerProcessMain, this);
+}
+
+void JobProcessWorker::Work()
+{
+    while (!IsStopping())
+    {
+        // Coroutines need the in-process scheduler, leave them to worker threads
+        Job *job = m_jobSystem->ClaimAJob(m_workerJobChannels, false);
+        if (job)
+        {
+            // Fused chains have no single function to send, they run here too
+            std::string output;
+            if (!job->IsChain() && RunInProcess(job, output))
+            {
+                job->output = output;
+            }
+            else
+            {
+                // The child doesn't have this function (e.g. loaded after the fork), run it here
+                job->Execute(job->input);
+            }
+            m_jobSystem->OnJobCompleted(job);
+        }
+
+        // How fast you want to pull jobs
+        std::this_thread::sleep_for(std::chrono::microseconds(1));
+    }
+}
+
+bool JobProcessWorker::RunInProcess(Job *job, std::string &output)
+{
+#ifdef _WIN32
+    return false;
+#else
+    unsigned long long functionAddress = (unsigned long long)job->ptr;
+    if (!IsInSpawnerImage(functionAddress))
+        return false;
+    std::string prefix((const char *)&functionAddress, sizeof(functionAddress));
+
+    // A second try only for functions registered after the child was forked
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (m_socket == -1 && !SpawnProcess())
+            return false;
+
+        uint16_t frameType;
+        std::string reply;
+        if (SendPayload(m_socket, JOB_FRAME_RUN, prefix, job->input, m_requestRing) && ReceivePayload(m_socket, frameType, reply, m_responseRing))
+        {
+            if (frameType == JOB_FRAME_RESULT)
+            {
+                output = reply;
+                return true;
+            }
+
+            // Registered after this child was forked, a new child will know it
+            StopProcess();
+            continue;
+        }
+
+        // The child crashed or was killed. Running the job again would most likely kill the
+        // next child too, so it fails here and the next job gets a fresh child.
+        StopProcess();
+        std::cout << "ERROR: Worker process " << m_uniqueName << " died while running job #" << job->GetUniqueID() << ", restarting it." << std::endl;
+
+        // Not an output worth caching or replaying
+        job->m_failed = true;
+        output = "ERROR: Job crashed its worker process";
+        return true;
+    }
+    return false;
+#endif
+}
+
+bool JobProcessWorker::SpawnProcess()
+{
+#ifdef _WIN32
+    return false;
+#else
+    if (!m_requestRing.IsCreated() || !m_responseRing.IsCreated())
+        return false;
+
+    // Functions the child will be able to run: registered now and present in the spawner
+    uint64_t memoryLimit = m_memoryLimitBytes;
+    uint64_t ringCapacity = m_requestRing.GetCapacity();
+    std::string request((const char *)&memoryLimit, sizeof(memoryLimit));
+    request.append((const char *)&ringCapacity, sizeof(ringCapacity));
+    for (unsigned long long functionAddress : m_jobSystem->GetRegisteredFunctions())
+    {
+        if (IsInSpawnerImage(functionAddress))
+            request.append((const char *)&functionAddress, sizeof(functionAddress));
+    }
+
+    // A dead child may have left the rings half written
+    m_requestRing.Reset();
+    m_responseRing.Reset();
+
+    int32_t pid = -1;
+    uint16_t frameType;
+    std::string reply;
+    std::vector<int> descriptors;
+    s_spawnerMutex.lock();
+    bool spawned = s_spawnerSocket != -1 &&
+                   SendFrame(s_spawnerSocket, JOB_FRAME_SPAWN, request) &&
+                   SendDescriptors(s_spawnerSocket, {m_requestRing.GetDescriptor(), m_responseRing.GetDescriptor()}) &&
+                   ReceiveFrame(s_spawnerSocket, frameType, reply) && frameType == JOB_FRAME_SPAWNED && reply.size() == sizeof(pid);
+    if (spawned)
+    {
+        std::memcpy(&pid, reply.data(), sizeof(pid));
+        spawned = pid > 0 && ReceiveDescriptors(s_spawnerSocket, descriptors, 1);
+    }
+    s_spawnerMutex.unlock();
+
+    if (!spawned)
+    {
+        std::cout << "ERROR: Unable to start worker process " << m_uniqueName << std::endl;
+        return false;
+    }
+
+    m_workerStatusMutex.lock();
+    m_socket = descriptors[0];
+    m_pid = pid;
+    m_numRestarts++;
+    m_workerStatusMutex.unlock();
+    return true;
+#endif
+}
+
+void JobProcessWorker::StopProcess()
+{
+#ifndef _WIN32
+    m_workerStatusMutex.lock();
+    int socket = m_socket;
+    int32_t pid = m_pid;
+    m_socket = -1;
+    m_pid = -1;
+    m_workerStatusMutex.unlock();
+
+    if (socket != -1)
+    {
+        SendFrame(socket, JOB_FRAME_SHUTDOWN, "");
+        close(socket);
+    }
+    if (pid != -1)
+    {
+        // The child exits once its socket closes, the spawner makes sure of it and reaps it
+        s_spawnerMutex.lock();
+        if (s_spawnerSocket != -1)
+        {
+            SendFrame(s_spawnerSocket, JOB_FRAME_STOP_PROCESS, std::string((const char *)&pid, sizeof(pid)));
+        }
+        s_spawnerMutex.unlock();
+    }
+#endif
+}
+
+void JobProcessWorker::ChildMain(int socket, JobSharedRing &requestRing, JobSharedRing &responseRing, const std::unordered_set<unsigned long long> &knownFunctions)
+{
+#ifndef _WIN32
+    uint16_t frameType;
+    std::string payload;
+    while (ReceivePayload(socket, frameType, payload, requestRing))
+    {
+        if (frameType != JOB_FRAME_RUN || payload.size() < sizeof(unsigned long long))
+            break;
+
+        unsigned long long functionAddress;
+        std::memcpy(&functionAddress, payload.data(), sizeof(functionAddress));
+        if (knownFunctions.count(functionAddress) == 0)
+        {
+            SendFrame(socket, JOB_FRAME_UNKNOWN_JOB, "");
+            continue;
+        }
+
+        // Same program image as the parent, so the function pointer is valid here
+        fnptr ptr = (fnptr)functionAddress;
+        std::string output = ptr(payload.substr(sizeof(functionAddress)));
+        if (!SendPayload(socket, JOB_FRAME_RESULT, "", output, responseRing))
+            break;
+    }
+    close(socket);
+#endif
+}
+
+#ifndef _WIN32
+static int RecordCodeSegments(struct dl_phdr_info *info, size_t, void *codeRanges)
+{
+    std::vector<std::pair<unsigned long long, unsigned long long>> *ranges = (std::vector<std::pair<unsigned long long, unsigned long long>> *)codeRanges;
+    for (int i = 0; i < info->dlpi_phnum; i++)
+    {
+        const ElfW(Phdr) &segment = info->dlpi_phdr[i];
+        if (segment.p_type == PT_LOAD && (segment.p_flags & PF_X))
+        {
+            unsigned long long start = info->dlpi_addr + segment.p_vaddr;
+            ranges->push_back({start, start + segment.p_memsz});
+        }
+    }
+    return 0;
+}
+#endif
+
+bool JobProcessWorker::StartSpawner()
+{
+#ifdef _WIN32
+    return false;
+#else
+    if (s_spawnerSocket != -1)
+        return true;
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0)
+    {
+        std::cout << "ERROR: Unable to create a socket for the worker process spawner" << std::endl;
+        return false;
+    }
+
+    // Code that is mapped now is mapped the same way in every child of the spawner
+    std::vector<std::pair<unsigned long long, unsigned long long>> codeRanges;
+    dl_iterate_phdr(RecordCodeSegments, &codeRanges);
+
+    // Don't let the spawner flush output the parent still has buffered
+    std::cout.flush();
+    fflush(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(sockets[0]);
+        close(sockets[1]);
+        std::cout << "ERROR: Unable to fork the worker process spawner" << std::endl;
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(sockets[0]);
+        SpawnerMain(sockets[1]);
+        _exit(0);
+    }
+
+    close(sockets[1]);
+    s_spawnerCode = codeRanges;
+    s_spawnerSocket = sockets[0];
+    return true;
+#endif
+}
+
+void JobProcessWorker::SpawnerMain(int spawnerSocket)
+{
+#ifndef _WIN32
+    signal(SIGTERM, SIG_DFL);
+
+    // Serves one request at a time until the parent goes away
+    uint16_t frameType;
+    std::string request;
+    while (ReceiveFrame(spawnerSocket, frameType, request))
+    {
+        if (frameType == JOB_FRAME_STOP_PROCESS && request.size() == sizeof(int32_t))
+        {
+            int32_t pid;
+            std::memcpy(&pid, request.data(), sizeof(pid));
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+            continue;
+        }
+
+        std::vector<int> rings;
+        if (frameType != JOB_FRAME_SPAWN || request.size() < 2 * sizeof(uint64_t) || !ReceiveDescriptors(spawnerSocket, rings, 2))
+            break;
+
+        uint64_t memoryLimit, ringCapacity;
+        std::memcpy(&memoryLimit, request.data(), sizeof(memoryLimit));
+        std::memcpy(&ringCapacity, request.data() + sizeof(memoryLimit), sizeof(ringCapacity));
+        std::unordered_set<unsigned long long> knownFunctions;
+        for (size_t offset = 2 * sizeof(uint64_t); offset + sizeof(unsigned long long) <= request.size(); offset += sizeof(unsigned long long))
+        {
+            unsigned long long functionAddress;
+            std::memcpy(&functionAddress, request.data() + offset, sizeof(functionAddress));
+            knownFunctions.insert(functionAddress);
+        }
+
+        int sockets[2] = {-1, -1};
+        int32_t pid = -1;
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == 0)
+        {
+            pid = fork();
+            if (pid == 0)
+            {
+                close(spawnerSocket);
+                close(sockets[0]);
+                if (memoryLimit != 0)
+                {
+                    // A memory blowup only kills this process
+                    struct rlimit limit;
+                    limit.rlim_cur = memoryLimit;
+                    limit.rlim_max = memoryLimit;
+                    setrlimit(RLIMIT_AS, &limit);
+                }
+                JobSharedRing requestRing;
+                JobSharedRing responseRing;
+                if (requestRing.Attach(rings[0], ringCapacity) && responseRing.Attach(rings[1], ringCapacity))
+                {
+                    ChildMain(sockets[1], requestRing, responseRing, knownFunctions);
+                }
+                _exit(0);
+            }
+            close(sockets[1]);
+            if (pid < 0)
+            {
+                close(sockets[0]);
+                pid = -1;
+            }
+        }
+        close(rings[0]);
+        close(rings[1]);
+
+        bool replied = SendFrame(spawnerSocket, JOB_FRAME_SPAWNED, std::string((const char *)&pid, sizeof(pid)));
+        if (pid != -1)
+        {
+            replied = replied && SendDescriptors(spawnerSocket, {sockets[0]});
+            close(sockets[0]);
+        }
+        if (!replied)
+            break;
+    }
+
+    // Children notice their sockets closing and exit on their own
+    close(spawnerSocket);
+#endif
+}
+
+bool JobProcessWorker::IsInSpawnerImage(unsigned long long functionAddress)
+{
+    for (const std::pair<unsigned long long, unsigned long long> &range : s_spawnerCode)
+    {
+        if (functionAddress >= range.first && functionAddress < range.second)
+            return true;
+    }
+    return false;
+}
+
+bool JobProcessWorker::SendPayload(int socket, uint16_t frameType, const std::string &prefix, const std::string &payload, JobSharedRing &ring)
+{
+    // Large payloads are copied once into shared memory and only their location is sent
+    uint64_t position;
+    if (payload.size() >= s_sharedPayloadThreshold && ring.Write(payload.data(), payload.size(), position))
+    {
+        uint64_t size = payload.size();
+        std::string location = prefix;
+        location.append((const char *)&position, sizeof(position));
+        location.append((const char *)&size, sizeof(size));
+        return SendFrame(socket, frameType, location, JOB_FRAME_FLAG_SHARED);
+    }
+
+    // Small payloads, or the ring is full
+    return SendFrame(socket, frameType, prefix + payload);
+}
+
+bool JobProcessWorker::ReceivePayload(int socket, uint16_t &frameType, std::string &payload, JobSharedRing &ring)
+{
+    uint16_t flags = 0;
+    if (!ReceiveFrame(socket, frameType, payload, &flags))
+        return false;
+
+    if (flags & JOB_FRAME_FLAG_SHARED)
+    {
+        // The last 16 bytes locate the data in the ring, anything before them is a prefix
+        const size_t locationSize = 2 * sizeof(uint64_t);
+        if (payload.size() < locationSize)
+            return false;
+        uint64_t position, size;
+        std::memcpy(&position, payload.data() + payload.size() - locationSize, sizeof(position));
+        std::memcpy(&size, payload.data() + payload.size() - sizeof(size), sizeof(size));
+        payload.resize(payload.size() - locationSize);
+        if (size > ring.GetCapacity())
+            return false;
+        ring.Read(position, size, payload);
+    }
+    return true;
+}
+
+void JobProcessWorker::ShutDown()
+{
+    m_workerStatusMutex.lock();
+    m_isStopping = true;
+    m_workerStatusMutex.unlock();
+}
+
+void JobProcessWorker::TurnOn()
+{
+    m_workerStatusMutex.lock();
+    m_isStopping = false;
+    m_workerStatusMutex.unlock();
+}
+
+bool JobProcessWorker::IsStopping() const
+{
+    m_workerStatusMutex.lock();
+    bool shouldClose = m_isStopping;
+    m_workerStatusMutex.unlock();
+
+    return shouldClose;
+}
+
+void JobProcessWorker::WorkerProcessMain(void *workerProcessObject)
+{
+    JobProcessWorker *thisWorker = (JobProcessWorker *)workerProcessObject;
+    thisWorker->Work();
+}
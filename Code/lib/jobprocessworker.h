@@ -0,0 +1,71 @@
+#ifndef JOB_SYSTEM_JOBPROCESSWORKER_H
+#define JOB_SYSTEM_JOBPROCESSWORKER_H
+
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include "job.h"
+#include "jobsharedring.h"
+
+class JobSystem;
+
+// Runs jobs in a child process. A dispatcher thread in this process claims jobs
+// like a JobWorkerThread would and ships them to the child over a Unix domain socket.
+// The child is restarted if it dies, so a crashing job cannot take the job system down;
+// the job that crashed it fails and is not run again.
+// Children are forked by a single-threaded spawner process (see JobSystem::EnableWorkerProcesses),
+// so no child starts out with locks held by threads it doesn't have.
+// Functions loaded after the spawner (plugins) run in this process instead.
+class JobProcessWorker
+{
+    friend class JobSystem;
+
+private:
+    JobProcessWorker(const char *uniqueName, unsigned long workerJobChannels, size_t memoryLimitBytes, JobSystem *jobSystem);
+    ~JobProcessWorker();
+
+    void StartUp();  // Fork the child and kick off the dispatcher thread
+    void Work();     // Called in the dispatcher thread, blocks until ShutDown() is called
+    void ShutDown(); // Signal that work should stop at next opportunity
+    void TurnOn();
+
+    bool IsStopping() const;
+    static void WorkerProcessMain(void *workerProcessObject);
+
+    bool SpawnProcess();
+    void StopProcess();
+    bool RunInProcess(Job *job, std::string &output); // False if the child could not run it
+    static void ChildMain(int socket, JobSharedRing &requestRing, JobSharedRing &responseRing, const std::unordered_set<unsigned long long> &knownFunctions);
+
+    static bool StartSpawner(); // Only while this process has a single thread
+    static bool IsSpawnerRunning() { return s_spawnerSocket != -1; }
+    static void SpawnerMain(int socket);
+    static bool IsInSpawnerImage(unsigned long long functionAddress); // The spawner's children have this code too
+
+    // Payloads at least this big go through the shared rings instead of the socket
+    static const size_t s_sharedPayloadThreshold = 16 * 1024;
+    static bool SendPayload(int socket, uint16_t frameType, const std::string &prefix, const std::string &payload, JobSharedRing &ring);
+    static bool ReceivePayload(int socket, uint16_t &frameType, std::string &payload, JobSharedRing &ring);
+
+    std::string m_uniqueName;
+    unsigned long m_workerJobChannels = 0xFFFFFFFF;
+    size_t m_memoryLimitBytes = 0;
+    bool m_isStopping = false;
+    JobSystem *m_jobSystem = nullptr;
+    std::thread *m_thread = nullptr;
+    int m_socket = -1;
+    int m_pid = -1;
+    int m_numRestarts = 0;
+    size_t m_sharedRingBytes = 16 * 1024 * 1024;
+    JobSharedRing m_requestRing;  // Inputs, written here and read by the child
+    JobSharedRing m_responseRing; // Outputs, written by the child and read here
+    mutable std::mutex m_workerStatusMutex;
+
+    inline static int s_spawnerSocket = -1;
+    inline static std::mutex s_spawnerMutex; // One spawn or stop request at a time
+    inline static std::vector<std::pair<unsigned long long, unsigned long long>> s_spawnerCode; // Executable ranges when the spawner was forked
+};
+
+#endif // JOB_SYSTEM_JOBPROCESSWORKER_H
@@ -0,0 +1,84 @@
+#include <cstdint>
+#include "jobreadyring.h"
+
+JobReadyRing::JobReadyRing(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+
+    m_slots = new Slot[size];
+    m_mask = size - 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        m_slots[i].m_sequence.store(i, std::memory_order_relaxed);
+        m_slots[i].m_job = nullptr;
+    }
+}
+
+JobReadyRing::~JobReadyRing()
+{
+    delete[] m_slots;
+}
+
+bool JobReadyRing::Push(Job *job)
+{
+    size_t position = m_pushPosition.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Slot &slot = m_slots[position & m_mask];
+        size_t sequence = slot.m_sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0)
+        {
+            // The slot is free for this lap, claim it
+            if (m_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                slot.m_job = job;
+                slot.m_sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            // The consumer of the previous lap hasn't emptied it yet
+            return false;
+        }
+        else
+        {
+            // Another producer got here first
+            position = m_pushPosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+Job *JobReadyRing::Pop()
+{
+    size_t position = m_popPosition.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Slot &slot = m_slots[position & m_mask];
+        size_t sequence = slot.m_sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+        if (difference == 0)
+        {
+            if (m_popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                Job *job = slot.m_job;
+                // Hand the slot to the producer of the next lap
+                slot.m_sequence.store(position + m_mask + 1, std::memory_order_release);
+                return job;
+            }
+        }
+        else if (difference < 0)
+        {
+            return nullptr;
+        }
+        else
+        {
+            position = m_popPosition.load(std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef JOB_SYSTEM_JOBREADYRING_H
+#define JOB_SYSTEM_JOBREADYRING_H
+
+#include <atomic>
+#include <cstddef>
+
+class Job;
+
+// Bounded lock-free multi-producer/multi-consumer queue of jobs (Dmitry Vyukov's ring).
+// Every slot carries a sequence number telling producers and consumers whose turn it is,
+// so a push or pop is one compare-and-swap on the shared position plus one store.
+class JobReadyRing
+{
+public:
+    JobReadyRing(size_t capacity); // Rounded up to a power of two
+    ~JobReadyRing();
+
+    bool Push(Job *job); // False when the ring is full
+    Job *Pop();          // nullptr when the ring is empty
+
+    size_t GetCapacity() const { return m_mask + 1; }
+
+private:
+    // Each slot on its own cache line, so neighbouring producers and consumers don't share one
+    struct alignas(64) Slot
+    {
+        std::atomic<size_t> m_sequence;
+        Job *m_job;
+    };
+
+    Slot *m_slots = nullptr;
+    size_t m_mask = 0;
+    alignas(64) std::atomic<size_t> m_pushPosition{0};
+    alignas(64) std::atomic<size_t> m_popPosition{0};
+};
+
+#endif // JOB_SYSTEM_JOBREADYRING_H
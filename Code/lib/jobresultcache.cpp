@@ -0,0 +1,162 @@
+#include <fstream>
+#include <sstream>
+#include "jobresultcache.h"
+
+uint64_t HashBytes(const char *data, size_t size, uint64_t seed)
+{
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string HashToHex(uint64_t hash)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(16, '0');
+    for (int i = 15; i >= 0; i--)
+    {
+        hex[i] = digits[hash & 0xF];
+        hash >>= 4;
+    }
+    return hex;
+}
+
+std::string JobResultCache::MakeKey(const std::string &jobType, const std::string &input, const std::vector<std::string> &fileDependencies)
+{
+    std::string key = jobType + ":" + std::to_string(input.size()) + ":" + HashToHex(HashBytes(input.data(), input.size()));
+
+    // Any change to a dependency changes the key
+    for (const std::string &path : fileDependencies)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+        {
+            key += ":missing";
+            continue;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string bytes = contents.str();
+        key += ":" + HashToHex(HashBytes(bytes.data(), bytes.size(), HashBytes(path.data(), path.size())));
+    }
+    return key;
+}
+
+bool JobResultCache::OpenDiskCache(std::string path)
+{
+    return m_diskCache.Open(path);
+}
+
+bool JobResultCache::Lookup(const std::string &key, std::string &output)
+{
+    m_cacheMutex.lock();
+    std::unordered_map<std::string, EntryList::iterator>::iterator found = m_index.find(key);
+    if (found == m_index.end())
+    {
+        m_cacheMutex.unlock();
+
+        // Fall back to the persistent cache and keep the result in memory
+        bool foundOnDisk = m_diskCache.Lookup(key, output);
+
+        m_cacheMutex.lock();
+        if (foundOnDisk)
+        {
+            m_stats.m_hits++;
+            m_stats.m_diskHits++;
+            StoreInMemory(key, output);
+        }
+        else
+        {
+            m_stats.m_misses++;
+        }
+        m_cacheMutex.unlock();
+        return foundOnDisk;
+    }
+
+    // Move the entry to the front of the LRU list
+    m_entries.splice(m_entries.begin(), m_entries, found->second);
+    output = found->second->second;
+    m_stats.m_hits++;
+    m_cacheMutex.unlock();
+    return true;
+}
+
+void JobResultCache::Store(const std::string &key, const std::string &output)
+{
+    m_diskCache.Store(key, output);
+
+    m_cacheMutex.lock();
+    StoreInMemory(key, output);
+    m_cacheMutex.unlock();
+}
+
+void JobResultCache::StoreInMemory(const std::string &key, const std::string &output)
+{
+    std::unordered_map<std::string, EntryList::iterator>::iterator found = m_index.find(key);
+    if (found != m_index.end())
+    {
+        m_stats.m_sizeBytes -= found->second->first.size() + found->second->second.size();
+        m_entries.erase(found->second);
+        m_index.erase(found);
+    }
+
+    // Outputs bigger than the whole cache are not kept
+    size_t entryBytes = key.size() + output.size();
+    if (entryBytes <= m_maxBytes)
+    {
+        m_entries.emplace_front(key, output);
+        m_index[key] = m_entries.begin();
+        m_stats.m_sizeBytes += entryBytes;
+        EvictToFit();
+    }
+}
+
+void JobResultCache::Erase(const std::string &key)
+{
+    m_diskCache.Erase(key);
+
+    m_cacheMutex.lock();
+    std::unordered_map<std::string, EntryList::iterator>::iterator found = m_index.find(key);
+    if (found != m_index.end())
+    {
+        m_stats.m_sizeBytes -= found->second->first.size() + found->second->second.size();
+        m_entries.erase(found->second);
+        m_index.erase(found);
+    }
+    m_cacheMutex.unlock();
+}
+
+void JobResultCache::SetMaxBytes(size_t maxBytes)
+{
+    m_cacheMutex.lock();
+    m_maxBytes = maxBytes;
+    EvictToFit();
+    m_cacheMutex.unlock();
+}
+
+JobResultCacheStats JobResultCache::GetStats() const
+{
+    m_cacheMutex.lock();
+    JobResultCacheStats stats = m_stats;
+    stats.m_numEntries = m_entries.size();
+    stats.m_maxBytes = m_maxBytes;
+    stats.m_diskBytes = m_diskCache.GetFileSize();
+    m_cacheMutex.unlock();
+    return stats;
+}
+
+void JobResultCache::EvictToFit()
+{
+    // Drop least recently used entries first
+    while (m_stats.m_sizeBytes > m_maxBytes && !m_entries.empty())
+    {
+        m_stats.m_sizeBytes -= m_entries.back().first.size() + m_entries.back().second.size();
+        m_index.erase(m_entries.back().first);
+        m_entries.pop_back();
+        m_stats.m_evictions++;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef JOB_SYSTEM_JOBRESULTCACHE_H
+#define JOB_SYSTEM_JOBRESULTCACHE_H
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "jobdiskcache.h"
+
+// 64-bit FNV-1a hash, pass a previous hash as seed to chain buffers
+uint64_t HashBytes(const char *data, size_t size, uint64_t seed = 14695981039346656037ULL);
+std::string HashToHex(uint64_t hash);
+
+struct JobResultCacheStats
+{
+    unsigned long m_hits = 0;
+    unsigned long m_misses = 0;
+    unsigned long m_diskHits = 0; // Hits served from the persistent cache (also counted in m_hits)
+    unsigned long m_evictions = 0;
+    size_t m_numEntries = 0;
+    size_t m_sizeBytes = 0;
+    size_t m_maxBytes = 0;
+    size_t m_diskBytes = 0;
+};
+
+// Size-bounded LRU map from a content key to a job output, optionally backed by a
+// persistent cache file shared with other runs
+class JobResultCache
+{
+public:
+    JobResultCache(size_t maxBytes) : m_maxBytes(maxBytes) {}
+
+    bool OpenDiskCache(std::string path);
+
+    // Key from the job type, the input and the contents of every file the job depends on
+    static std::string MakeKey(const std::string &jobType, const std::string &input, const std::vector<std::string> &fileDependencies);
+
+    bool Lookup(const std::string &key, std::string &output);
+    void Store(const std::string &key, const std::string &output);
+    void Erase(const std::string &key);
+    void SetMaxBytes(size_t maxBytes);
+    JobResultCacheStats GetStats() const;
+
+private:
+    void EvictToFit();
+
+    typedef std::list<std::pair<std::string, std::string>> EntryList;
+
+    void StoreInMemory(const std::string &key, const std::string &output);
+
+    JobDiskCache m_diskCache;
+    EntryList m_entries; // Most recently used first
+    std::unordered_map<std::string, EntryList::iterator> m_index;
+    size_t m_maxBytes = 0;
+    JobResultCacheStats m_stats;
+    mutable std::mutex m_cacheMutex;
+};
+
+#endif // JOB_SYSTEM_JOBRESULTCACHE_H
@@ -0,0 +1,137 @@
+#include <cstring>
+#include <new>
+#include "jobsharedring.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+JobSharedRing::~JobSharedRing()
+{
+    Destroy();
+}
+
+bool JobSharedRing::Create(size_t capacity)
+{
+#ifdef _WIN32
+    return false;
+#else
+    Destroy();
+
+    // Backed by a memory file so processes forked from somewhere else can map it too
+    int fd = memfd_create("jobsharedring", MFD_CLOEXEC);
+    if (fd == -1)
+        return false;
+    size_t mappedSize = sizeof(Control) + capacity;
+    if (ftruncate(fd, mappedSize) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // Pages are only committed once touched, so a big ring costs little until it's used
+    void *mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    m_control = new (mapped) Control();
+    m_data = (char *)mapped + sizeof(Control);
+    m_capacity = capacity;
+    m_mappedSize = mappedSize;
+    m_fd = fd;
+    Reset();
+    return true;
+#endif
+}
+
+bool JobSharedRing::Attach(int descriptor, size_t capacity)
+{
+#ifdef _WIN32
+    return false;
+#else
+    Destroy();
+
+    size_t mappedSize = sizeof(Control) + capacity;
+    struct stat fileStat;
+    if (fstat(descriptor, &fileStat) != 0 || (size_t)fileStat.st_size < mappedSize)
+    {
+        close(descriptor);
+        return false;
+    }
+    void *mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close(descriptor);
+        return false;
+    }
+
+    // Already set up by the creator, don't reset it
+    m_control = (Control *)mapped;
+    m_data = (char *)mapped + sizeof(Control);
+    m_capacity = capacity;
+    m_mappedSize = mappedSize;
+    m_fd = descriptor;
+    return true;
+#endif
+}
+
+void JobSharedRing::Destroy()
+{
+#ifndef _WIN32
+    if (m_control)
+    {
+        munmap((void *)m_control, m_mappedSize);
+    }
+    if (m_fd != -1)
+    {
+        close(m_fd);
+    }
+#endif
+    m_control = nullptr;
+    m_data = nullptr;
+    m_capacity = 0;
+    m_mappedSize = 0;
+    m_fd = -1;
+}
+
+void JobSharedRing::Reset()
+{
+    m_control->m_head.store(0);
+    m_control->m_tail.store(0);
+}
+
+bool JobSharedRing::Write(const char *data, size_t size, uint64_t &position)
+{
+    if (!m_control || size > m_capacity)
+        return false;
+
+    uint64_t tail = m_control->m_tail.load(std::memory_order_relaxed);
+    uint64_t head = m_control->m_head.load(std::memory_order_acquire);
+
+    // Skip the end of the ring if the payload would wrap
+    uint64_t start = tail;
+    size_t offset = start % m_capacity;
+    if (offset + size > m_capacity)
+    {
+        start += m_capacity - offset;
+        offset = 0;
+    }
+    if (start + size - head > m_capacity)
+        return false;
+
+    std::memcpy(m_data + offset, data, size);
+    m_control->m_tail.store(start + size, std::memory_order_release);
+    position = start;
+    return true;
+}
+
+void JobSharedRing::Read(uint64_t position, uint64_t size, std::string &output)
+{
+    output.append(m_data + position % m_capacity, size);
+    m_control->m_head.store(position + size, std::memory_order_release);
+}
@@ -0,0 +1,47 @@
+#ifndef JOB_SYSTEM_JOBSHAREDRING_H
+#define JOB_SYSTEM_JOBSHAREDRING_H
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+// Lock-free single-producer/single-consumer byte ring in shared memory. One process creates
+// it and hands GetDescriptor() to the other (inherited over fork() or sent over a Unix
+// domain socket), which attaches to the same bytes; only (offset, size) pairs need to be sent
+// to the other side. Payloads are always contiguous, so a payload that doesn't fit before
+// the end of the ring starts over at the beginning.
+class JobSharedRing
+{
+public:
+    JobSharedRing() {}
+    ~JobSharedRing();
+
+    bool Create(size_t capacity);
+    bool Attach(int descriptor, size_t capacity); // Ring created by another process, takes the descriptor
+    void Destroy();
+    void Reset(); // Only when neither side is using the ring
+
+    bool IsCreated() const { return m_data != nullptr; }
+    size_t GetCapacity() const { return m_capacity; }
+    int GetDescriptor() const { return m_fd; }
+
+    // Producer: copy data into the ring, false if there is no room
+    bool Write(const char *data, size_t size, uint64_t &position);
+    // Consumer: append a payload to output and give its space back (payloads are read in order)
+    void Read(uint64_t position, uint64_t size, std::string &output);
+
+private:
+    struct Control
+    {
+        alignas(64) std::atomic<uint64_t> m_head; // Everything before this was consumed
+        alignas(64) std::atomic<uint64_t> m_tail; // Everything before this was produced
+    };
+
+    Control *m_control = nullptr;
+    char *m_data = nullptr;
+    size_t m_capacity = 0;
+    size_t m_mappedSize = 0;
+    int m_fd = -1;
+};
+
+#endif // JOB_SYSTEM_JOBSHAREDRING_H
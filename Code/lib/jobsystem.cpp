@@ -1,7 +1,10 @@
 #include <iostream>
 #include <cstring>
+#include <chrono>
+#include <algorithm>
 #include "jobsystem.h"
 #include "jobworkerthread.h"
+#include "jobprocessworker.h"
 
 JobSystem *JobSystem::s_jobSystem = nullptr;
 
@@ -23,12 +26,30 @@ JobSystem::~JobSystem()
         m_workerThreads[i]->ShutDown();
     }
 
+    for (JobProcessWorker *workerProcess : m_workerProcesses)
+    {
+        workerProcess->ShutDown();
+    }
+
     while (!m_workerThreads.empty())
     {
         delete m_workerThreads.back();
         m_workerThreads.pop_back();
     }
+    while (!m_workerProcesses.empty())
+    {
+        delete m_workerProcesses.back();
+        m_workerProcesses.pop_back();
+    }
     m_workerThreadsMutex.unlock();
+
+    // Shutting down cleanly, a journal is only needed after a crash
+    if (m_journal)
+    {
+        m_journal->Discard();
+    }
+    delete m_journal;
+    delete m_resultCache;
 }
 
 void JobSystem::Stop()
@@ -41,6 +62,10 @@ void JobSystem::Stop()
     {
         m_workerThreads[i]->ShutDown();
     }
+    for (JobProcessWorker *workerProcess : m_workerProcesses)
+    {
+        workerProcess->ShutDown();
+    }
     m_workerThreadsMutex.unlock();
 }
 
@@ -54,6 +79,10 @@ void JobSystem::Resume()
     {
         m_workerThreads[i]->TurnOn();
     }
+    for (JobProcessWorker *workerProcess : m_workerProcesses)
+    {
+        workerProcess->TurnOn();
+    }
     m_workerThreadsMutex.unlock();
 }
 
@@ -108,16 +137,292 @@ void JobSystem::DestroyWorkerThread(const char *uniqueName)
     }
 }
 
-void JobSystem::QueueJob(Job *job)
+bool JobSystem::EnableWorkerProcesses()
+{
+    return JobProcessWorker::StartSpawner();
+}
+
+void JobSystem::CreateWorkerProcess(const char *uniqueName, unsigned long workerJobChannels, size_t memoryLimitBytes)
+{
+#ifdef _WIN32
+    // No fork() here, fall back to a thread
+    std::cout << "ERROR: Worker processes are not supported on this platform, creating a worker thread instead." << std::endl;
+    CreateWorkerThread(uniqueName, workerJobChannels);
+#else
+    if (!JobProcessWorker::IsSpawnerRunning())
+    {
+        std::cout << "ERROR: Call JobSystem::EnableWorkerProcesses() before starting any thread to use worker processes, creating a worker thread instead." << std::endl;
+        CreateWorkerThread(uniqueName, workerJobChannels);
+        return;
+    }
+    JobProcessWorker *newWorker = new JobProcessWorker(uniqueName, workerJobChannels, memoryLimitBytes, this);
+    m_workerThreadsMutex.lock();
+    m_workerProcesses.push_back(newWorker);
+    m_workerProcesses.back()->StartUp();
+    m_workerThreadsMutex.unlock();
+#endif
+}
+
+void JobSystem::DestroyWorkerProcess(const char *uniqueName)
+{
+    m_workerThreadsMutex.lock();
+    JobProcessWorker *doomedWorker = nullptr;
+    std::vector<JobProcessWorker *>::iterator it = m_workerProcesses.begin();
+
+    for (; it != m_workerProcesses.end(); ++it)
+    {
+        if ((*it)->m_uniqueName == uniqueName)
+        {
+            doomedWorker = *it;
+            m_workerProcesses.erase(it);
+            break;
+        }
+    }
+    m_workerThreadsMutex.unlock();
+
+    if (doomedWorker)
+    {
+        doomedWorker->ShutDown();
+        delete doomedWorker;
+    }
+}
+
+bool JobSystem::QueueJob(Job *job, JobSubmitMode submitMode, int timeoutMilliseconds)
+{
+    bool fitsRing = FitsReadyRing(job);
+    if (fitsRing)
+    {
+        // Announced before checking for capacities, so StopUsingReadyRing() can't miss this push
+        m_numRingPushes++;
+        bool pushed = false;
+        if (!m_hasQueueLimits && m_numSpilledJobs.load(std::memory_order_relaxed) == 0)
+        {
+            SetJobHistoryStatus(job, JOB_STATUS_QUEUED);
+            pushed = m_readyRing.Push(job);
+        }
+        m_numRingPushes--;
+        if (pushed)
+        {
+            return true;
+        }
+        // The ring is full or off, take the locked path
+    }
+
+    std::unique_lock<std::mutex> queuedLock(m_jobsQueuedMutex);
+
+    // Apply backpressure if the job would go over any queue capacity.
+    // NOTE: blocking from inside a job body can deadlock if every worker ends up waiting here.
+    if (!HasQueueRoom(job))
+    {
+        if (submitMode == JOB_SUBMIT_FAIL_FAST)
+        {
+            return false;
+        }
+        else if (submitMode == JOB_SUBMIT_TRY)
+        {
+            if (!m_jobsQueuedCondition.wait_for(queuedLock, std::chrono::milliseconds(timeoutMilliseconds), [&]
+                                                { return HasQueueRoom(job); }))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            m_jobsQueuedCondition.wait(queuedLock, [&]
+                                       { return HasQueueRoom(job); });
+        }
+    }
+
+    SetJobHistoryStatus(job, JOB_STATUS_QUEUED);
+
+    CountQueuedJob(job, 1);
+    m_jobsQueued.push_back(job);
+    m_numJobsQueuedLocked++;
+    if (fitsRing)
+    {
+        m_numSpilledJobs++;
+    }
+    return true;
+}
+
+bool JobSystem::FitsReadyRing(Job *job) const
+{
+    // Anything in the ring has to be claimable by every worker, threads and processes alike
+    return job->m_jobChannels == 0xFFFFFFFF && !job->IsCoroutine();
+}
+
+void JobSystem::StopUsingReadyRing()
 {
+    if (m_hasQueueLimits)
+    {
+        return;
+    }
+
+    // Pushes that didn't see the flag are waited out, nothing lands in the ring after this
+    m_hasQueueLimits = true;
+    while (m_numRingPushes != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    // Jobs still in the ring are older than anything that fits it in the locked queue, they go
+    // in front so the capacities count them
+    std::vector<Job *> ringJobs;
+    while (Job *readyJob = m_readyRing.Pop())
+    {
+        m_jobHistoryMutex.lock();
+        bool destroyed = m_jobHistory[readyJob->m_jobID].m_jobStatus != JOB_STATUS_QUEUED;
+        m_jobHistoryMutex.unlock();
+        if (!destroyed)
+        {
+            ringJobs.push_back(readyJob);
+            continue;
+        }
+
+        if (readyJob->m_journaled)
+        {
+            m_journal->RecordRetire(readyJob->m_jobID);
+        }
+        delete readyJob;
+    }
+    m_jobsQueued.insert(m_jobsQueued.begin(), ringJobs.begin(), ringJobs.end());
+    m_numJobsQueuedLocked += (int)ringJobs.size();
+    m_numSpilledJobs += (int)ringJobs.size();
+}
+
+Job *JobSystem::ClaimFromReadyRing()
+{
+    while (Job *readyJob = m_readyRing.Pop())
+    {
+        m_jobsRunningMutex.lock();
+        m_jobHistoryMutex.lock();
+        // DestroyJob can't take a job out of the ring, it marks the job retired instead
+        bool destroyed = m_jobHistory[readyJob->m_jobID].m_jobStatus != JOB_STATUS_QUEUED;
+        if (!destroyed)
+        {
+            m_jobsRunning.push_back(readyJob);
+            m_jobHistory[readyJob->m_jobID].m_jobStatus = JOB_STATUS_RUNNING;
+        }
+        m_jobHistoryMutex.unlock();
+        m_jobsRunningMutex.unlock();
+
+        if (!destroyed)
+        {
+            return readyJob;
+        }
+
+        if (readyJob->m_journaled)
+        {
+            m_journal->RecordRetire(readyJob->m_jobID);
+        }
+        delete readyJob;
+    }
+    return nullptr;
+}
+
+void JobSystem::SetJobTypeQueueCapacity(int jobType, int capacity)
+{
+    // From now on every job is counted in the locked queue
     m_jobsQueuedMutex.lock();
+    StopUsingReadyRing();
+    std::unordered_map<int, JobQueueLimit>::iterator limitIter = m_jobTypeQueueLimits.find(jobType);
+    if (limitIter == m_jobTypeQueueLimits.end())
+    {
+        // Start counting from the jobs already waiting in the queue
+        JobQueueLimit limit(0xFFFFFFFF, capacity);
+        for (Job *queuedJob : m_jobsQueued)
+        {
+            if (jobType == JOB_TYPE_ANY || queuedJob->m_jobType == jobType)
+                limit.m_numJobsQueued++;
+        }
+        m_jobTypeQueueLimits.emplace(jobType, limit);
+    }
+    else
+    {
+        limitIter->second.m_capacity = capacity;
+    }
+    m_jobsQueuedMutex.unlock();
+
+    // The limit may have been raised
+    m_jobsQueuedCondition.notify_all();
+}
 
+void JobSystem::SetChannelQueueCapacity(unsigned long jobChannels, int capacity)
+{
+    // From now on every job is counted in the locked queue
+    m_jobsQueuedMutex.lock();
+    StopUsingReadyRing();
+    bool found = false;
+    for (JobQueueLimit &limit : m_channelQueueLimits)
+    {
+        if (limit.m_jobChannels == jobChannels)
+        {
+            limit.m_capacity = capacity;
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+    {
+        // Start counting from the jobs already waiting in the queue
+        JobQueueLimit limit(jobChannels, capacity);
+        for (Job *queuedJob : m_jobsQueued)
+        {
+            if ((queuedJob->m_jobChannels & jobChannels) != 0)
+                limit.m_numJobsQueued++;
+        }
+        m_channelQueueLimits.push_back(limit);
+    }
+    m_jobsQueuedMutex.unlock();
+
+    // The limit may have been raised
+    m_jobsQueuedCondition.notify_all();
+}
+
+void JobSystem::SetJobHistoryStatus(Job *job, JobStatus jobStatus)
+{
     m_jobHistoryMutex.lock();
-    m_jobHistory.emplace_back(JobHistoryEntry(job->m_jobType, JOB_STATUS_QUEUED));
+    // Rejected jobs leave gaps in the IDs, so index the history by job ID
+    if (job->m_jobID >= (int)m_jobHistory.size())
+    {
+        m_jobHistory.resize(job->m_jobID + 1, JobHistoryEntry(JOB_TYPE_ANY, JOB_STATUS_NEVER_SEEN));
+    }
+    m_jobHistory[job->m_jobID] = JobHistoryEntry(job->m_jobType, jobStatus);
     m_jobHistoryMutex.unlock();
+}
 
-    m_jobsQueued.push_back(job);
-    m_jobsQueuedMutex.unlock();
+bool JobSystem::HasQueueRoom(Job *job) const
+{
+    for (auto &kv : m_jobTypeQueueLimits)
+    {
+        const JobQueueLimit &limit = kv.second;
+        if (kv.first != JOB_TYPE_ANY && kv.first != job->m_jobType)
+            continue;
+        if (limit.m_capacity != JOB_QUEUE_UNBOUNDED && limit.m_numJobsQueued >= limit.m_capacity)
+            return false;
+    }
+    for (const JobQueueLimit &limit : m_channelQueueLimits)
+    {
+        if ((limit.m_jobChannels & job->m_jobChannels) == 0)
+            continue;
+        if (limit.m_capacity != JOB_QUEUE_UNBOUNDED && limit.m_numJobsQueued >= limit.m_capacity)
+            return false;
+    }
+    return true;
+}
+
+void JobSystem::CountQueuedJob(Job *job, int delta)
+{
+    for (auto &kv : m_jobTypeQueueLimits)
+    {
+        if (kv.first == JOB_TYPE_ANY || kv.first == job->m_jobType)
+            kv.second.m_numJobsQueued += delta;
+    }
+    for (JobQueueLimit &limit : m_channelQueueLimits)
+    {
+        if ((limit.m_jobChannels & job->m_jobChannels) != 0)
+            limit.m_numJobsQueued += delta;
+    }
 }
 
 JobStatus JobSystem::GetJobStatus(int jobID) const
@@ -125,7 +430,7 @@ JobStatus JobSystem::GetJobStatus(int jobID) const
     m_jobHistoryMutex.lock();
 
     JobStatus jobStatus = JOB_STATUS_NEVER_SEEN;
-    if (jobID < m_jobHistory.size())
+    if (jobID >= 0 && (size_t)jobID < m_jobHistory.size())
     {
         jobStatus = (JobStatus)m_jobHistory[jobID].m_jobStatus;
     }
@@ -140,6 +445,37 @@ bool JobSystem::IsJobComplete(int jobID) const
     return (GetJobStatus(jobID)) == (JOB_STATUS_COMPLETED);
 }
 
+std::vector<int> JobSystem::WaitForJobs(const std::vector<int> &jobIDs, int timeoutMilliseconds)
+{
+    std::vector<int> readyJobs;
+    auto anyReady = [&]()
+    {
+        m_jobHistoryMutex.lock();
+        for (int jobID : jobIDs)
+        {
+            int jobStatus = jobID >= 0 && (size_t)jobID < m_jobHistory.size() ? m_jobHistory[jobID].m_jobStatus : JOB_STATUS_NEVER_SEEN;
+            if (jobStatus == JOB_STATUS_COMPLETED || jobStatus == JOB_STATUS_RETIRED || jobStatus == JOB_STATUS_NEVER_SEEN)
+            {
+                readyJobs.push_back(jobID);
+            }
+        }
+        m_jobHistoryMutex.unlock();
+        return !readyJobs.empty() || jobIDs.empty();
+    };
+
+    // Whatever makes a job ready notifies under m_jobsCompletedMutex, so no wake-up is missed
+    std::unique_lock<std::mutex> completedLock(m_jobsCompletedMutex);
+    if (timeoutMilliseconds < 0)
+    {
+        m_jobsCompletedCondition.wait(completedLock, anyReady);
+    }
+    else
+    {
+        m_jobsCompletedCondition.wait_for(completedLock, std::chrono::milliseconds(timeoutMilliseconds), anyReady);
+    }
+    return readyJobs;
+}
+
 std::string JobSystem::FinishCompletedJobs()
 {
     std::deque<Job *> jobsCompleted;
@@ -155,6 +491,10 @@ std::string JobSystem::FinishCompletedJobs()
         m_jobHistoryMutex.lock();
         m_jobHistory[job->m_jobID].m_jobStatus = JOB_STATUS_RETIRED;
         m_jobHistoryMutex.unlock();
+        if (job->m_journaled)
+        {
+            m_journal->RecordRetire(job->m_jobID);
+        }
         delete job;
     }
     return output;
@@ -174,16 +514,14 @@ std::string JobSystem::FinishJob(int jobID)
     // m_jobsCompletedMutex.unlock();
 
     std::string output = "null";
-    while (!IsJobComplete(jobID))
-    {
-        // Wait for job to complete first
-        std::this_thread::yield();
-    }
+    // Wait for job to complete first
+    WaitForJobs({jobID});
 
     JobStatus jobStatus = GetJobStatus(jobID);
     if (jobStatus == JOB_STATUS_NEVER_SEEN || jobStatus == JOB_STATUS_RETIRED)
     {
         std::cout << "ERROR: Waiting for Job (#" << jobID << ") - no such job in JobSystem." << std::endl;
+        return output;
     }
 
     m_jobsCompletedMutex.lock();
@@ -203,6 +541,7 @@ std::string JobSystem::FinishJob(int jobID)
     if (thisCompletedJob == nullptr)
     {
         std::cout << "ERROR: Job #" << jobID << " was status complete but not found in completed list." << std::endl;
+        return output;
     }
     output = thisCompletedJob->JobCompleteCallback();
 
@@ -210,6 +549,11 @@ std::string JobSystem::FinishJob(int jobID)
     m_jobHistory[thisCompletedJob->m_jobID].m_jobStatus = JOB_STATUS_RETIRED;
     m_jobHistoryMutex.unlock();
 
+    if (thisCompletedJob->m_journaled)
+    {
+        m_journal->RecordRetire(thisCompletedJob->m_jobID);
+    }
+
     delete thisCompletedJob;
 
     return output;
@@ -218,28 +562,129 @@ std::string JobSystem::FinishJob(int jobID)
 void JobSystem::OnJobCompleted(Job *jobJustExecuted)
 {
     totalJobs++;
+
+    // A failed job is neither replayed nor run again after a restart
+    if (jobJustExecuted->m_journaled && jobJustExecuted->m_failed)
+    {
+        m_journal->RecordRetire(jobJustExecuted->m_jobID);
+    }
+    else if (jobJustExecuted->m_journaled)
+    {
+        m_journal->RecordComplete(jobJustExecuted->m_jobID, jobJustExecuted->output);
+    }
+
+    // Memoize the output before anyone can retire the job, failures are worth running again
+    if (!jobJustExecuted->m_resultCacheKey.empty() && !jobJustExecuted->m_failed && !IsErrorOutput(jobJustExecuted->output))
+    {
+        m_resultCacheMutex.lock();
+        if (m_resultCache)
+        {
+            m_resultCache->Store(jobJustExecuted->m_resultCacheKey, jobJustExecuted->output);
+        }
+        m_resultCacheMutex.unlock();
+    }
+
     m_jobsCompletedMutex.lock();
     m_jobsRunningMutex.lock();
 
+    bool abandoned = false;
     std::deque<Job *>::iterator runningJobItr = m_jobsRunning.begin();
     for (; runningJobItr != m_jobsRunning.end(); ++runningJobItr)
     {
         if (jobJustExecuted == *runningJobItr)
         {
+            abandoned = m_abandonedJobs.erase(jobJustExecuted->m_jobID) != 0;
             m_jobHistoryMutex.lock();
             m_jobsRunning.erase(runningJobItr);
-            m_jobsCompleted.push_back(jobJustExecuted);
-            m_jobHistory[jobJustExecuted->m_jobID].m_jobStatus = JOB_STATUS_COMPLETED;
+            if (abandoned)
+            {
+                m_jobHistory[jobJustExecuted->m_jobID].m_jobStatus = JOB_STATUS_RETIRED;
+            }
+            else
+            {
+                m_jobsCompleted.push_back(jobJustExecuted);
+                m_jobHistory[jobJustExecuted->m_jobID].m_jobStatus = JOB_STATUS_COMPLETED;
+            }
             m_jobHistoryMutex.unlock();
             break;
         }
     }
     m_jobsRunningMutex.unlock();
     m_jobsCompletedMutex.unlock();
+    m_jobsCompletedCondition.notify_all();
+
+    // Destroyed while it ran, nobody is going to pick up the output
+    if (abandoned)
+    {
+        if (jobJustExecuted->m_journaled)
+        {
+            m_journal->RecordRetire(jobJustExecuted->m_jobID);
+        }
+        delete jobJustExecuted;
+    }
+}
+
+void JobSystem::OnJobSuspended(Job *jobJustSuspended)
+{
+    m_jobsSuspendedMutex.lock();
+    m_jobHistoryMutex.lock();
+    m_jobsSuspended.push_back(jobJustSuspended);
+    m_jobHistory[jobJustSuspended->m_jobID].m_jobStatus = JOB_STATUS_SUSPENDED;
+    m_jobHistoryMutex.unlock();
+    m_jobsSuspendedMutex.unlock();
 }
 
-Job *JobSystem::ClaimAJob(unsigned long channels)
+Job *JobSystem::ClaimAResumableJob(unsigned long channels)
 {
+    m_jobsSuspendedMutex.lock();
+
+    Job *resumedJob = nullptr;
+    std::deque<Job *>::iterator suspendedJobIter = m_jobsSuspended.begin();
+    for (; suspendedJobIter != m_jobsSuspended.end(); ++suspendedJobIter)
+    {
+        Job *suspendedJob = *suspendedJobIter;
+
+        // Resume the first parked job whose awaited result is ready (a plain co_await just yields)
+        if ((suspendedJob->m_jobChannels & channels) != 0 &&
+            (!suspendedJob->m_resumeWhen || suspendedJob->m_resumeWhen()))
+        {
+            resumedJob = suspendedJob;
+
+            m_jobHistoryMutex.lock();
+            m_jobsSuspended.erase(suspendedJobIter);
+            m_jobHistory[resumedJob->m_jobID].m_jobStatus = JOB_STATUS_RUNNING;
+            m_jobHistoryMutex.unlock();
+            break;
+        }
+    }
+
+    m_jobsSuspendedMutex.unlock();
+
+    return resumedJob;
+}
+
+Job *JobSystem::ClaimAJob(unsigned long channels, bool claimCoroutines)
+{
+    // Parked coroutines that are ready go first, they are already holding resources
+    Job *resumedJob = claimCoroutines ? ClaimAResumableJob(channels) : nullptr;
+    if (resumedJob)
+    {
+        return resumedJob;
+    }
+
+    // Ring jobs are older than any job in the locked queue that could have gone in the ring
+    Job *readyJob = ClaimFromReadyRing();
+    if (readyJob)
+    {
+        return readyJob;
+    }
+
+    // Idle workers poll constantly, don't touch the lock when there is nothing behind it
+    if (m_numJobsQueuedLocked.load(std::memory_order_relaxed) == 0)
+    {
+        return nullptr;
+    }
+
     m_jobsQueuedMutex.lock();
     m_jobsRunningMutex.lock();
 
@@ -249,12 +694,18 @@ Job *JobSystem::ClaimAJob(unsigned long channels)
     {
         Job *queuedJob = *queuedJobIter;
 
-        if ((queuedJob->m_jobChannels & channels) != 0)
+        if ((queuedJob->m_jobChannels & channels) != 0 && (claimCoroutines || !queuedJob->IsCoroutine()))
         {
             claimedJob = queuedJob;
 
             m_jobHistoryMutex.lock();
             m_jobsQueued.erase(queuedJobIter);
+            m_numJobsQueuedLocked--;
+            if (FitsReadyRing(claimedJob))
+            {
+                m_numSpilledJobs--;
+            }
+            CountQueuedJob(claimedJob, -1);
             m_jobsRunning.push_back(claimedJob);
             m_jobHistory[claimedJob->m_jobID].m_jobStatus = JOB_STATUS_RUNNING;
             m_jobHistoryMutex.unlock();
@@ -265,35 +716,487 @@ Job *JobSystem::ClaimAJob(unsigned long channels)
     m_jobsRunningMutex.unlock();
     m_jobsQueuedMutex.unlock();
 
+    // Wake up any producer waiting for room in the queue
+    if (claimedJob)
+    {
+        m_jobsQueuedCondition.notify_all();
+    }
+
     return claimedJob;
 }
 
-void JobSystem::Register(std::string name, Job *fnptr)
+int JobSystem::InternJobType(const std::string &name)
+{
+    std::unordered_map<std::string, int>::iterator idIter = m_jobTypeIDs.find(name);
+    if (idIter != m_jobTypeIDs.end())
+    {
+        return idIter->second;
+    }
+    int jobTypeID = (int)m_jobTypes.size();
+    m_jobTypes.emplace_back(name);
+    m_jobTypeIDs.emplace(name, jobTypeID);
+    return jobTypeID;
+}
+
+int JobSystem::Register(std::string name, Job *fnptr)
+{
+    // '+' joins the job types in the names of fused chains
+    if (name.find('+') != std::string::npos)
+    {
+        std::cout << "ERROR: Job name \"" << name << "\" can't contain '+', it is kept for chains." << std::endl;
+        m_jobTypesMutex.lock_shared();
+        bool registered = IsRegisteredJob(fnptr);
+        m_jobTypesMutex.unlock_shared();
+        if (!registered)
+        {
+            delete fnptr;
+        }
+        return JOB_TYPE_ID_UNKNOWN;
+    }
+    return RegisterJobType(name, fnptr, {});
+}
+
+int JobSystem::RegisterJobType(std::string name, Job *fnptr, const std::vector<int> &chainStages)
+{
+    // Intern the name and point its slot at the function pointer
+    m_jobTypesMutex.lock();
+    int jobTypeID = InternJobType(name);
+    Job *replacedJob = m_jobTypes[jobTypeID].m_job;
+    m_jobTypes[jobTypeID].m_job = fnptr;
+    m_jobTypes[jobTypeID].m_chainStages = chainStages;
+    bool replacedStillRegistered = IsRegisteredJob(replacedJob);
+    m_jobTypesMutex.unlock();
+
+    // Queued and running jobs are copies holding their own function pointer and plugin
+    // reference, so the old one can go unless another name still has it registered
+    if (!replacedStillRegistered)
+    {
+        delete replacedJob;
+    }
+
+    // Chains copied the replaced function pointer, they have to pick up the new one
+    if (replacedJob && chainStages.empty())
+    {
+        RebuildChainsUsing(jobTypeID);
+    }
+
+    // Journaled jobs of this type that were waiting for it to be registered
+    std::vector<JobJournalEntry> readyToRequeue;
+    m_journalMutex.lock();
+    for (std::vector<JobJournalEntry>::iterator pendingIter = m_journalPending.begin(); pendingIter != m_journalPending.end();)
+    {
+        if (pendingIter->m_jobType == name)
+        {
+            readyToRequeue.push_back(*pendingIter);
+            pendingIter = m_journalPending.erase(pendingIter);
+        }
+        else
+        {
+            ++pendingIter;
+        }
+    }
+    m_journalMutex.unlock();
+
+    for (const JobJournalEntry &entry : readyToRequeue)
+    {
+        RequeueJournaledJob(entry);
+    }
+    return jobTypeID;
+}
+
+bool JobSystem::EnableJournal(std::string path, int flushIntervalMilliseconds)
+{
+    // Jobs record to m_journal without holding the lock, so it can't be replaced under them.
+    // The lock is held until the new journal is in place, a second caller can't open the file meanwhile.
+    m_journalMutex.lock();
+    if (m_journal)
+    {
+        m_journalMutex.unlock();
+        std::cout << "ERROR: The job journal is already enabled" << std::endl;
+        return false;
+    }
+
+    std::vector<JobJournalEntry> entries = JobJournal::Replay(path);
+
+    // Newest outcome per submission: a completed output wins over an unfinished copy.
+    // Outputs that were already handed back (retired) and failures are not reused.
+    std::unordered_map<std::string, JobJournalEntry> completedByKey;
+    std::unordered_map<std::string, JobJournalEntry> unfinishedByKey;
+    for (const JobJournalEntry &entry : entries)
+    {
+        if (entry.m_completed && (entry.m_retired || IsErrorOutput(entry.m_output)))
+        {
+            completedByKey.erase(entry.m_key);
+            unfinishedByKey.erase(entry.m_key);
+        }
+        else if (entry.m_completed)
+        {
+            completedByKey[entry.m_key] = entry;
+            unfinishedByKey.erase(entry.m_key);
+        }
+        else if (!entry.m_retired && completedByKey.count(entry.m_key) == 0)
+        {
+            unfinishedByKey[entry.m_key] = entry;
+        }
+    }
+
+    // Everything still useful goes into the compacted journal
+    std::vector<JobJournalEntry> carriedOver;
+    for (auto &kv : completedByKey)
+        carriedOver.push_back(kv.second);
+    for (auto &kv : unfinishedByKey)
+        carriedOver.push_back(kv.second);
+
+    JobJournal *journal = new JobJournal(flushIntervalMilliseconds);
+    if (!journal->Open(path, carriedOver))
+    {
+        m_journalMutex.unlock();
+        delete journal;
+        return false;
+    }
+
+    std::vector<JobJournalEntry> readyToRequeue;
+    m_journal = journal;
+    for (auto &kv : completedByKey)
+    {
+        m_recoveredOutputs[kv.first] = kv.second.m_output;
+    }
+    for (auto &kv : unfinishedByKey)
+    {
+        if (GetJobTypeID(kv.second.m_jobType) != JOB_TYPE_ID_UNKNOWN)
+            readyToRequeue.push_back(kv.second);
+        else
+            m_journalPending.push_back(kv.second);
+    }
+    m_journalMutex.unlock();
+
+    for (const JobJournalEntry &entry : readyToRequeue)
+    {
+        RequeueJournaledJob(entry);
+    }
+
+    std::cout << "Job journal: recovered " << completedByKey.size() << " completed and " << unfinishedByKey.size() << " unfinished jobs" << std::endl;
+    return true;
+}
+
+void JobSystem::RequeueJournaledJob(const JobJournalEntry &entry)
 {
-    // Create a new key for the function pointer
-    jobs[name] = fnptr;
+    m_jobTypesMutex.lock_shared();
+    std::unordered_map<std::string, int>::const_iterator idIter = m_jobTypeIDs.find(entry.m_jobType);
+    Job *registeredJob = idIter != m_jobTypeIDs.end() ? m_jobTypes[idIter->second].m_job : nullptr;
+    Job *cloned = registeredJob ? new Job(*registeredJob) : nullptr;
+    m_jobTypesMutex.unlock_shared();
+    if (!cloned)
+    {
+        // Unregistered again in the meantime
+        return;
+    }
+    cloned->input = entry.m_input;
+    cloned->m_journaled = true;
+    m_journal->RecordSubmit(cloned->m_jobID, entry.m_jobType, entry.m_key, entry.m_input);
+    QueueJob(cloned);
+
+    // The next matching submission gets this job instead of a new one
+    m_journalMutex.lock();
+    m_recoveredJobs[entry.m_key] = cloned->m_jobID;
+    m_journalMutex.unlock();
 }
 
-int JobSystem::CreateJob(std::string jobType, std::string input)
+void JobSystem::FlushJournal()
+{
+    m_journalMutex.lock();
+    if (m_journal)
+    {
+        m_journal->Flush();
+    }
+    m_journalMutex.unlock();
+}
+
+int JobSystem::CreateJob(std::string jobType, std::string input, JobSubmitMode submitMode, int timeoutMilliseconds,
+                         const std::vector<std::string> &fileDependencies, bool useResultCache, bool useJournal)
+{
+    int jobTypeID = GetJobTypeID(jobType);
+    if (jobTypeID == JOB_TYPE_ID_UNKNOWN)
+    {
+        std::cout << "ERROR: Unknown job type \"" << jobType << "\"" << std::endl;
+        return -1;
+    }
+    return CreateJob(jobTypeID, input, submitMode, timeoutMilliseconds, fileDependencies, useResultCache, useJournal);
+}
+
+int JobSystem::CreateJob(int jobTypeID, std::string input, JobSubmitMode submitMode, int timeoutMilliseconds,
+                         const std::vector<std::string> &fileDependencies, bool useResultCache, bool useJournal)
 {
     // Clone the job from the function pointer and queue it
-    Job *newJob = jobs[jobType];
-    Job *cloned = new Job(*newJob);
+    m_jobTypesMutex.lock_shared();
+    if (jobTypeID < 0 || jobTypeID >= (int)m_jobTypes.size() || !m_jobTypes[jobTypeID].m_job)
+    {
+        m_jobTypesMutex.unlock_shared();
+        std::cout << "ERROR: Unknown job type ID " << jobTypeID << std::endl;
+        return -1;
+    }
+    const JobTypeEntry &jobTypeEntry = m_jobTypes[jobTypeID];
+    Job *cloned = new Job(*jobTypeEntry.m_job);
+    std::string jobType = jobTypeEntry.m_name;
+    bool cacheableType = jobTypeEntry.m_cacheable;
+    m_jobTypesMutex.unlock_shared();
     cloned->input = input;
-    QueueJob(cloned);
+
+    m_resultCacheMutex.lock();
+    bool cacheable = useResultCache && m_resultCache && cacheableType;
+    m_resultCacheMutex.unlock();
+    m_journalMutex.lock();
+    bool journaled = useJournal && m_journal != nullptr;
+    m_journalMutex.unlock();
+
+    std::string contentKey;
+    if (cacheable || journaled)
+    {
+        contentKey = JobResultCache::MakeKey(jobType, input, fileDependencies);
+    }
+
+    // Work done before a crash is picked up by the first matching submission, unless the
+    // caller asked for a fresh run
+    if (journaled && useResultCache)
+    {
+        m_journalMutex.lock();
+        std::unordered_map<std::string, std::string>::iterator recoveredOutput = m_recoveredOutputs.find(contentKey);
+        std::unordered_map<std::string, int>::iterator recoveredJob = m_recoveredJobs.find(contentKey);
+        if (recoveredOutput != m_recoveredOutputs.end())
+        {
+            cloned->output = recoveredOutput->second;
+            m_recoveredOutputs.erase(recoveredOutput);
+            m_journalMutex.unlock();
+
+            cloned->m_journaled = true;
+            m_journal->RecordSubmit(cloned->m_jobID, jobType, contentKey, input);
+            m_journal->RecordComplete(cloned->m_jobID, cloned->output);
+            CompleteWithoutRunning(cloned);
+            return cloned->GetUniqueID();
+        }
+        if (recoveredJob != m_recoveredJobs.end())
+        {
+            // Already requeued during replay
+            int recoveredJobID = recoveredJob->second;
+            m_recoveredJobs.erase(recoveredJob);
+            m_journalMutex.unlock();
+
+            delete cloned;
+            return recoveredJobID;
+        }
+        m_journalMutex.unlock();
+    }
+
+    // Check the result cache next
+    if (cacheable)
+    {
+        // Failures stored by older builds are run again too
+        if (m_resultCache->Lookup(contentKey, cloned->output) && !IsErrorOutput(cloned->output))
+        {
+            // Cache hit, complete the job without running it
+            if (journaled)
+            {
+                cloned->m_journaled = true;
+                m_journal->RecordSubmit(cloned->m_jobID, jobType, contentKey, input);
+                m_journal->RecordComplete(cloned->m_jobID, cloned->output);
+            }
+            CompleteWithoutRunning(cloned);
+            return cloned->GetUniqueID();
+        }
+        cloned->m_resultCacheKey = contentKey;
+    }
+
+    if (journaled)
+    {
+        // Log the submission before the job can complete
+        cloned->m_journaled = true;
+        m_journal->RecordSubmit(cloned->m_jobID, jobType, contentKey, input);
+    }
+
+    if (!QueueJob(cloned, submitMode, timeoutMilliseconds))
+    {
+        // The queue is full
+        if (journaled)
+        {
+            m_journal->RecordRetire(cloned->m_jobID);
+        }
+        delete cloned;
+        return -1;
+    }
     return cloned->GetUniqueID();
 }
 
+void JobSystem::CompleteWithoutRunning(Job *job)
+{
+    m_jobsCompletedMutex.lock();
+    SetJobHistoryStatus(job, JOB_STATUS_COMPLETED);
+    m_jobsCompleted.push_back(job);
+    m_jobsCompletedMutex.unlock();
+    m_jobsCompletedCondition.notify_all();
+}
+
+std::unordered_set<unsigned long long> JobSystem::GetRegisteredFunctions()
+{
+    std::unordered_set<unsigned long long> functions;
+    m_jobTypesMutex.lock_shared();
+    for (const JobTypeEntry &jobTypeEntry : m_jobTypes)
+    {
+        if (jobTypeEntry.m_job && jobTypeEntry.m_job->ptr)
+            functions.insert((unsigned long long)jobTypeEntry.m_job->ptr);
+    }
+    m_jobTypesMutex.unlock_shared();
+    return functions;
+}
+
 std::vector<std::string> JobSystem::GetJobTypes()
 {
     std::vector<std::string> keys;
-    for (auto key : jobs)
+    m_jobTypesMutex.lock_shared();
+    for (const JobTypeEntry &jobTypeEntry : m_jobTypes)
     {
-        keys.push_back(key.first);
+        if (jobTypeEntry.m_job)
+            keys.push_back(jobTypeEntry.m_name);
     }
+    m_jobTypesMutex.unlock_shared();
     return keys;
 }
 
+int JobSystem::GetJobTypeID(std::string name) const
+{
+    int jobTypeID = JOB_TYPE_ID_UNKNOWN;
+    m_jobTypesMutex.lock_shared();
+    std::unordered_map<std::string, int>::const_iterator idIter = m_jobTypeIDs.find(name);
+    if (idIter != m_jobTypeIDs.end() && m_jobTypes[idIter->second].m_job)
+    {
+        jobTypeID = idIter->second;
+    }
+    m_jobTypesMutex.unlock_shared();
+    return jobTypeID;
+}
+
+std::string JobSystem::GetJobTypeName(int jobTypeID) const
+{
+    std::string name;
+    m_jobTypesMutex.lock_shared();
+    if (jobTypeID >= 0 && jobTypeID < (int)m_jobTypes.size())
+    {
+        name = m_jobTypes[jobTypeID].m_name;
+    }
+    m_jobTypesMutex.unlock_shared();
+    return name;
+}
+
+int JobSystem::RegisterChain(std::string name, const std::vector<int> &jobTypeIDs)
+{
+    std::vector<fnptr> chain;
+    unsigned long jobChannels = 0xFFFFFFFF;
+    int jobType = -1;
+    bool cacheable = !jobTypeIDs.empty();
+
+    m_jobTypesMutex.lock_shared();
+    for (int jobTypeID : jobTypeIDs)
+    {
+        Job *job = jobTypeID >= 0 && jobTypeID < (int)m_jobTypes.size() ? m_jobTypes[jobTypeID].m_job : nullptr;
+        if (!job || !job->ptr || job->m_module)
+        {
+            // Unregistered, a coroutine, a chain itself, or plugin code that could be unloaded under it
+            chain.clear();
+            break;
+        }
+        chain.push_back(job->ptr);
+        jobChannels &= job->m_jobChannels;
+        cacheable = cacheable && m_jobTypes[jobTypeID].m_cacheable;
+        if (jobType == -1)
+            jobType = job->m_jobType;
+    }
+    m_jobTypesMutex.unlock_shared();
+
+    // Every worker that runs the chain has to be allowed to run each part of it
+    if (chain.empty() || jobChannels == 0)
+    {
+        return JOB_TYPE_ID_UNKNOWN;
+    }
+
+    // The stages are kept so the chain can be built again when one of them is replaced
+    int jobTypeID = RegisterJobType(name, new Job(chain, jobType, jobChannels), jobTypeIDs);
+    SetJobCacheable(name, cacheable);
+    return jobTypeID;
+}
+
+void JobSystem::RebuildChainsUsing(int jobTypeID)
+{
+    std::vector<std::pair<std::string, std::vector<int>>> chains;
+    m_jobTypesMutex.lock_shared();
+    for (const JobTypeEntry &jobTypeEntry : m_jobTypes)
+    {
+        if (jobTypeEntry.m_job && std::find(jobTypeEntry.m_chainStages.begin(), jobTypeEntry.m_chainStages.end(), jobTypeID) != jobTypeEntry.m_chainStages.end())
+            chains.push_back({jobTypeEntry.m_name, jobTypeEntry.m_chainStages});
+    }
+    m_jobTypesMutex.unlock_shared();
+
+    for (const std::pair<std::string, std::vector<int>> &chain : chains)
+    {
+        // A stage that is gone, or can't be chained anymore, takes the chain with it
+        if (RegisterChain(chain.first, chain.second) == JOB_TYPE_ID_UNKNOWN)
+        {
+            Unregister(chain.first);
+        }
+    }
+}
+
+bool JobSystem::IsRegisteredJob(Job *job) const
+{
+    if (!job)
+        return false;
+    for (const JobTypeEntry &jobTypeEntry : m_jobTypes)
+    {
+        if (jobTypeEntry.m_job == job)
+            return true;
+    }
+    return false;
+}
+
+void JobSystem::Unregister(std::string name)
+{
+    // The ID stays interned, only the slot is emptied
+    m_jobTypesMutex.lock();
+    Job *removedJob = nullptr;
+    int jobTypeID = JOB_TYPE_ID_UNKNOWN;
+    std::unordered_map<std::string, int>::iterator idIter = m_jobTypeIDs.find(name);
+    if (idIter != m_jobTypeIDs.end())
+    {
+        jobTypeID = idIter->second;
+        removedJob = m_jobTypes[jobTypeID].m_job;
+        m_jobTypes[jobTypeID].m_job = nullptr;
+        m_jobTypes[jobTypeID].m_chainStages.clear();
+    }
+    bool removedStillRegistered = IsRegisteredJob(removedJob);
+    m_jobTypesMutex.unlock();
+
+    // Jobs of this type already queued or running keep their own copy
+    if (!removedStillRegistered)
+    {
+        delete removedJob;
+    }
+
+    if (removedJob)
+    {
+        RebuildChainsUsing(jobTypeID);
+    }
+}
+
+int JobSystem::GetJobTag(int jobTypeID) const
+{
+    int jobTag = JOB_TYPE_ANY;
+    m_jobTypesMutex.lock_shared();
+    if (jobTypeID >= 0 && jobTypeID < (int)m_jobTypes.size() && m_jobTypes[jobTypeID].m_job)
+    {
+        jobTag = m_jobTypes[jobTypeID].m_job->m_jobType;
+    }
+    m_jobTypesMutex.unlock_shared();
+    return jobTag;
+}
+
 void JobSystem::DestroyJob(int jobID)
 {
     // Clear the job from any queue
@@ -306,22 +1209,38 @@ void JobSystem::DestroyJob(int jobID)
         {
             thisJob1 = someJob;
             m_jobsQueued.erase(jcIter);
+            m_numJobsQueuedLocked--;
+            if (FitsReadyRing(thisJob1))
+            {
+                m_numSpilledJobs--;
+            }
+            CountQueuedJob(thisJob1, -1);
             break;
         }
     }
     m_jobsQueuedMutex.unlock();
+    if (thisJob1)
+    {
+        m_jobsQueuedCondition.notify_all();
+    }
+    else
+    {
+        // Still queued means it is in the ready ring, whoever pops it drops it
+        m_jobHistoryMutex.lock();
+        if (jobID >= 0 && jobID < (int)m_jobHistory.size() && m_jobHistory[jobID].m_jobStatus == JOB_STATUS_QUEUED)
+        {
+            m_jobHistory[jobID].m_jobStatus = JOB_STATUS_RETIRED;
+        }
+        m_jobHistoryMutex.unlock();
+    }
 
+    // A running (or suspended) job can't be stopped, it is dropped once it completes
     m_jobsRunningMutex.lock();
-    Job *thisJob2 = nullptr;
-    for (auto jcIter = m_jobsRunning.begin(); jcIter != m_jobsRunning.end(); ++jcIter)
+    for (Job *someJob : m_jobsRunning)
     {
-        Job *someJob = *jcIter;
         if (someJob->m_jobID == jobID)
         {
-            thisJob2 = someJob;
-            // Finish the job before erasing it form the queue
-            FinishJob(thisJob2->GetUniqueID());
-            m_jobsRunning.erase(jcIter);
+            m_abandonedJobs.insert(jobID);
             break;
         }
     }
@@ -340,4 +1259,80 @@ void JobSystem::DestroyJob(int jobID)
         }
     }
     m_jobsCompletedMutex.unlock();
+
+    // A destroyed job should not come back on replay
+    Job *destroyedJob = thisJob1 ? thisJob1 : thisJob3;
+    if (destroyedJob)
+    {
+        m_jobHistoryMutex.lock();
+        m_jobHistory[jobID].m_jobStatus = JOB_STATUS_RETIRED;
+        m_jobHistoryMutex.unlock();
+        if (destroyedJob->m_journaled)
+        {
+            m_journal->RecordRetire(jobID);
+        }
+        delete destroyedJob;
+    }
+
+    // Anyone waiting on it stops, it is never going to complete
+    m_jobsCompletedMutex.lock();
+    m_jobsCompletedMutex.unlock();
+    m_jobsCompletedCondition.notify_all();
+}
+
+void JobSystem::EnableResultCache(size_t maxBytes)
+{
+    m_resultCacheMutex.lock();
+    if (m_resultCache)
+    {
+        m_resultCache->SetMaxBytes(maxBytes);
+    }
+    else
+    {
+        m_resultCache = new JobResultCache(maxBytes);
+    }
+    m_resultCacheMutex.unlock();
+}
+
+bool JobSystem::EnablePersistentCache(std::string path)
+{
+    m_resultCacheMutex.lock();
+    if (!m_resultCache)
+    {
+        // Needs the in-memory cache in front of it
+        m_resultCache = new JobResultCache(64 * 1024 * 1024);
+    }
+    bool opened = m_resultCache->OpenDiskCache(path);
+    m_resultCacheMutex.unlock();
+    return opened;
+}
+
+void JobSystem::SetJobCacheable(std::string jobType, bool cacheable)
+{
+    // May come before the job type is registered, so intern it now
+    m_jobTypesMutex.lock();
+    m_jobTypes[InternJobType(jobType)].m_cacheable = cacheable;
+    m_jobTypesMutex.unlock();
+}
+
+void JobSystem::InvalidateCachedJob(std::string jobType, std::string input, const std::vector<std::string> &fileDependencies)
+{
+    m_resultCacheMutex.lock();
+    if (m_resultCache)
+    {
+        m_resultCache->Erase(JobResultCache::MakeKey(jobType, input, fileDependencies));
+    }
+    m_resultCacheMutex.unlock();
+}
+
+JobResultCacheStats JobSystem::GetResultCacheStats() const
+{
+    JobResultCacheStats stats;
+    m_resultCacheMutex.lock();
+    if (m_resultCache)
+    {
+        stats = m_resultCache->GetStats();
+    }
+    m_resultCacheMutex.unlock();
+    return stats;
 }
\ No newline at end of file
@@ -3,13 +3,24 @@
 
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <shared_mutex>
 #include <deque>
 #include <fstream>
 #include <unordered_map>
+#include <condition_variable>
+#include <unordered_set>
+
+#include "jobresultcache.h"
+#include "jobjournal.h"
+#include "jobreadyring.h"
 
 constexpr int JOB_TYPE_ANY = -1;
+constexpr int JOB_QUEUE_UNBOUNDED = -1;
+constexpr int JOB_TYPE_ID_UNKNOWN = -1;
 
 class JobWorkerThread;
+class JobProcessWorker;
 
 enum JobStatus
 {
@@ -18,6 +29,7 @@ enum JobStatus
     JOB_STATUS_RUNNING,
     JOB_STATUS_COMPLETED,
     JOB_STATUS_RETIRED,
+    JOB_STATUS_SUSPENDED,
     NUM_JOB_STATUSES
 };
 
@@ -30,11 +42,42 @@ struct JobHistoryEntry
     int m_jobStatus = JOB_STATUS_NEVER_SEEN;
 };
 
+// How QueueJob behaves when the job would go over a queue capacity
+enum JobSubmitMode
+{
+    JOB_SUBMIT_BLOCK,     // Wait until there is room in the queue
+    JOB_SUBMIT_FAIL_FAST, // Reject the job right away
+    JOB_SUBMIT_TRY,       // Wait up to a timeout, then reject the job
+    NUM_JOB_SUBMIT_MODES
+};
+
+struct JobQueueLimit
+{
+    JobQueueLimit(unsigned long jobChannels, int capacity)
+        : m_jobChannels(jobChannels), m_capacity(capacity) {}
+
+    unsigned long m_jobChannels = 0xFFFFFFFF;
+    int m_capacity = JOB_QUEUE_UNBOUNDED;
+    int m_numJobsQueued = 0;
+};
+
 class Job;
 
+// A job type name interned to a dense ID, which indexes JobSystem::m_jobTypes
+struct JobTypeEntry
+{
+    JobTypeEntry(std::string name) : m_name(name) {}
+
+    std::string m_name;
+    Job *m_job = nullptr; // nullptr until registered, and again after Unregister
+    bool m_cacheable = false;
+    std::vector<int> m_chainStages; // Job type IDs a chain was built from, empty for anything else
+};
+
 class JobSystem
 {
     friend class JobWorkerThread;
+    friend class JobProcessWorker;
 
 public:
     JobSystem();
@@ -49,11 +92,28 @@ public:
 
     void CreateWorkerThread(const char *uniqueName, unsigned long workerJobChannels = 0xFFFFFFFF);
     void DestroyWorkerThread(const char *uniqueName);
-    void QueueJob(Job *job);
+
+    // Forks the process worker processes are started from. It has to happen while this process
+    // has no other thread yet (no worker thread, journal or daemon), so call it first thing in
+    // main(). Without it CreateWorkerProcess creates a worker thread instead.
+    static bool EnableWorkerProcesses();
+
+    // Worker running jobs in a child process (memoryLimitBytes of 0 means no limit).
+    // It serves its channels alongside any worker threads on the same channels.
+    void CreateWorkerProcess(const char *uniqueName, unsigned long workerJobChannels = 0xFFFFFFFF, size_t memoryLimitBytes = 0);
+    void DestroyWorkerProcess(const char *uniqueName);
+    bool QueueJob(Job *job, JobSubmitMode submitMode = JOB_SUBMIT_BLOCK, int timeoutMilliseconds = 0);
+
+    // Queue capacities (JOB_QUEUE_UNBOUNDED removes the limit)
+    void SetJobTypeQueueCapacity(int jobType, int capacity);
+    void SetChannelQueueCapacity(unsigned long jobChannels, int capacity);
 
     // Status queries
     JobStatus GetJobStatus(int jobID) const;
     bool IsJobComplete(int jobID) const;
+    // Blocks until at least one of the jobs has completed (or is gone, so it never will) and
+    // returns those; empty if timeoutMilliseconds (-1 waits for good) passes first
+    std::vector<int> WaitForJobs(const std::vector<int> &jobIDs, int timeoutMilliseconds = -1);
     bool areJobsRunning()
     {
         bool temp;
@@ -74,18 +134,70 @@ public:
     std::string FinishJob(int jobID);
     std::string FinishCompletedJobs();
 
-    void Register(std::string name, Job *fnptr);
-    int CreateJob(std::string jobType, std::string input);
+    // Returns the job type ID. Replaces (and deletes) a job already registered under name,
+    // the ID stays the same. Chains using the replaced job are built again from the new one.
+    // Names can't contain '+', it joins the parts of chain names (JOB_TYPE_ID_UNKNOWN).
+    int Register(std::string name, Job *fnptr);
+    void Unregister(std::string name); // Also unregisters the chains using it
+    // Registers name as the given job types run back to back on one worker. Only plain
+    // function jobs can be chained; returns JOB_TYPE_ID_UNKNOWN otherwise. The chain is
+    // cacheable if every job type in it is.
+    int RegisterChain(std::string name, const std::vector<int> &jobTypeIDs);
+    int GetJobTypeID(std::string name) const; // JOB_TYPE_ID_UNKNOWN unless registered
+    std::string GetJobTypeName(int jobTypeID) const;
+    int GetJobTag(int jobTypeID) const; // The jobType the registered Job was created with, JOB_TYPE_ANY if none
+
+    // Both return -1 if the job type is not registered or the queue is full.
+    // With useJournal false nothing about the job reaches the journal file (needed for inputs
+    // holding secrets), and it is not recovered after a crash
+    int CreateJob(int jobTypeID, std::string input, JobSubmitMode submitMode = JOB_SUBMIT_BLOCK, int timeoutMilliseconds = 0,
+                  const std::vector<std::string> &fileDependencies = {}, bool useResultCache = true, bool useJournal = true);
+    int CreateJob(std::string jobType, std::string input, JobSubmitMode submitMode = JOB_SUBMIT_BLOCK, int timeoutMilliseconds = 0,
+                  const std::vector<std::string> &fileDependencies = {}, bool useResultCache = true, bool useJournal = true);
     std::vector<std::string> GetJobTypes();
     void DestroyJob(int jobID);
 
+    // Opt-in memoization of job outputs, keyed by job type, input and file dependencies
+    void EnableResultCache(size_t maxBytes);
+    bool EnablePersistentCache(std::string path);
+    void SetJobCacheable(std::string jobType, bool cacheable = true);
+    void InvalidateCachedJob(std::string jobType, std::string input, const std::vector<std::string> &fileDependencies = {});
+    JobResultCacheStats GetResultCacheStats() const;
+
+    // Crash recovery: replays the journal at path (completed outputs are reused by matching
+    // submissions, unfinished jobs are queued again), then keeps journaling to it.
+    // Only once per job system, it fails if a journal is already enabled
+    bool EnableJournal(std::string path, int flushIntervalMilliseconds = 5);
+    void FlushJournal();
+
 private:
-    Job *ClaimAJob(unsigned long channels);
+    Job *ClaimAJob(unsigned long channels, bool claimCoroutines = true);
     void OnJobCompleted(Job *jobJustExecuted);
+    void OnJobSuspended(Job *jobJustSuspended);
+    Job *ClaimAResumableJob(unsigned long channels);
+
+    // Queue capacity bookkeeping, m_jobsQueuedMutex must be held
+    bool HasQueueRoom(Job *job) const;
+    void CountQueuedJob(Job *job, int delta);
+
+    // Jobs any worker can pick up skip the locked queue while no capacities are set
+    bool FitsReadyRing(Job *job) const;
+    Job *ClaimFromReadyRing();
+    void StopUsingReadyRing(); // m_jobsQueuedMutex must be held
+
+    void SetJobHistoryStatus(Job *job, JobStatus jobStatus);
+    int InternJobType(const std::string &name); // m_jobTypesMutex must be held exclusively
+    int RegisterJobType(std::string name, Job *fnptr, const std::vector<int> &chainStages);
+    bool IsRegisteredJob(Job *job) const;       // m_jobTypesMutex must be held
+    void RebuildChainsUsing(int jobTypeID);
+    void CompleteWithoutRunning(Job *job);
+    std::unordered_set<unsigned long long> GetRegisteredFunctions();
+    void RequeueJournaledJob(const JobJournalEntry &entry);
 
     static JobSystem *s_jobSystem;
 
     std::vector<JobWorkerThread *> m_workerThreads;
+    std::vector<JobProcessWorker *> m_workerProcesses;
     mutable std::mutex m_workerThreadsMutex;
     std::deque<Job *> m_jobsQueued;
     std::deque<Job *> m_jobsRunning;
@@ -93,12 +205,46 @@ private:
     mutable std::mutex m_jobsQueuedMutex;
     mutable std::mutex m_jobsRunningMutex;
     mutable std::mutex m_jobsCompletedMutex;
+    std::condition_variable m_jobsCompletedCondition; // A job completed or was destroyed
+    std::unordered_set<int> m_abandonedJobs; // Destroyed while running, dropped once they complete (m_jobsRunningMutex)
+
+    // Lock-free ready queue in front of m_jobsQueued, which keeps channel-specific jobs,
+    // coroutines, jobs under a capacity, and whatever doesn't fit in the ring.
+    // Ring jobs are claimed first, so once one spills over into m_jobsQueued the ones after it
+    // follow it there until it drains, to keep them in order.
+    JobReadyRing m_readyRing{4096};
+    std::atomic<int> m_numJobsQueuedLocked{0};
+    std::atomic<int> m_numSpilledJobs{0};  // Jobs in m_jobsQueued that fit the ring
+    std::atomic<int> m_numRingPushes{0};   // Pushes in flight, waited out by StopUsingReadyRing()
+    std::atomic<bool> m_hasQueueLimits{false}; // Set for good by the first capacity
+
+    // Coroutine jobs parked until what they are awaiting is ready (they still count as running)
+    std::deque<Job *> m_jobsSuspended;
+    mutable std::mutex m_jobsSuspendedMutex;
+
+    // Capacities per job type (JOB_TYPE_ANY is the whole queue) and per channel mask
+    std::unordered_map<int, JobQueueLimit> m_jobTypeQueueLimits;
+    std::vector<JobQueueLimit> m_channelQueueLimits;
+    std::condition_variable m_jobsQueuedCondition;
 
     std::vector<JobHistoryEntry> m_jobHistory;
     mutable int m_jobHistoryLowestActiveIndex = 0;
     mutable std::mutex m_jobHistoryMutex;
 
-    std::unordered_map<std::string, Job *> jobs;
+    // Registered jobs by job type ID. IDs are never reused, so one stays valid after its type
+    // is unregistered (submissions to it are rejected) and comes back if it is registered again.
+    std::vector<JobTypeEntry> m_jobTypes;
+    std::unordered_map<std::string, int> m_jobTypeIDs;
+    mutable std::shared_mutex m_jobTypesMutex; // Submissions share it, registration takes it alone
+
+    JobResultCache *m_resultCache = nullptr;
+    mutable std::mutex m_resultCacheMutex;
+
+    JobJournal *m_journal = nullptr; // Set once and kept until destruction, so recording needs no lock
+    std::unordered_map<std::string, std::string> m_recoveredOutputs; // Content key -> output from before a crash
+    std::unordered_map<std::string, int> m_recoveredJobs;            // Content key -> requeued job ID
+    std::vector<JobJournalEntry> m_journalPending;                   // Unfinished jobs of types not registered yet
+    mutable std::mutex m_journalMutex;
 };
 
 #endif // JOB_SYSTEM_JOBSYSTEM_H
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include "jobsystemclient.h"
+#include "jobframing.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#endif
+
+std::string JobSystemDefaultSocketPath()
+{
+#ifdef _WIN32
+    return "";
+#else
+    return "/tmp/jobsystem-" + std::to_string(geteuid()) + "/jobsystem.sock";
+#endif
+}
+
+JobSystemClient::~JobSystemClient()
+{
+    Disconnect();
+}
+
+bool JobSystemClient::Connect(std::string socketPath)
+{
+#ifdef _WIN32
+    std::cout << "ERROR: The job system daemon is not supported on this platform." << std::endl;
+    return false;
+#else
+    Disconnect();
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::cout << "ERROR: Socket path too long: " << socketPath << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    int clientSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (clientSocket == -1 || connect(clientSocket, (sockaddr *)&address, sizeof(address)) != 0)
+    {
+        if (clientSocket != -1)
+            close(clientSocket);
+        return false;
+    }
+
+    // Anyone can bind a socket in a shared directory, don't hand jobs to another user's process
+    if (!IsPeerSameUser(clientSocket))
+    {
+        close(clientSocket);
+        std::cout << "ERROR: The job system daemon at " << socketPath << " belongs to another user" << std::endl;
+        return false;
+    }
+    m_socket = clientSocket;
+    return true;
+#endif
+}
+
+void JobSystemClient::Disconnect()
+{
+#ifndef _WIN32
+    if (m_socket != -1)
+    {
+        close(m_socket);
+        m_socket = -1;
+    }
+#endif
+}
+
+std::string JobSystemClient::Call(const std::string &method, const std::string &args)
+{
+    uint32_t methodSize = (uint32_t)method.size();
+    std::string payload((const char *)&methodSize, sizeof(methodSize));
+    payload += method;
+    payload += args;
+
+    m_callMutex.lock();
+    uint16_t frameType = 0;
+    std::string reply;
+    bool ok = IsConnected() && SendFrame(m_socket, JOB_FRAME_CALL, payload) && ReceiveFrame(m_socket, frameType, reply) && frameType == JOB_FRAME_REPLY;
+    m_callMutex.unlock();
+
+    if (!ok)
+    {
+        std::cout << "ERROR: Lost connection to the job system daemon during " << method << std::endl;
+        return "{\"error\": \"Lost connection to the job system daemon\"}";
+    }
+    return reply;
+}
@@ -0,0 +1,30 @@
+#ifndef JOB_SYSTEM_JOBSYSTEMCLIENT_H
+#define JOB_SYSTEM_JOBSYSTEMCLIENT_H
+
+#include <mutex>
+#include <string>
+
+// /tmp/jobsystem-<uid>/jobsystem.sock, in a directory only this user can get into
+std::string JobSystemDefaultSocketPath();
+
+// Connection to a JobSystemDaemon. Each call sends a method name and its JSON arguments
+// and blocks for the JSON result, one call at a time per connection.
+// Only connects to a daemon run by the same user.
+class JobSystemClient
+{
+public:
+    JobSystemClient() {}
+    ~JobSystemClient();
+
+    bool Connect(std::string socketPath);
+    void Disconnect();
+    bool IsConnected() const { return m_socket != -1; }
+
+    std::string Call(const std::string &method, const std::string &args = "");
+
+private:
+    int m_socket = -1;
+    std::mutex m_callMutex;
+};
+
+#endif // JOB_SYSTEM_JOBSYSTEMCLIENT_H
@@ -0,0 +1,293 @@
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include "jobsystemdaemon.h"
+#include "jobsysteminterface.h"
+#include "jobframing.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#endif
+
+JobSystemDaemon::~JobSystemDaemon()
+{
+    Stop();
+}
+
+bool JobSystemDaemon::Listen(std::string socketPath)
+{
+#ifdef _WIN32
+    std::cout << "ERROR: The job system daemon is not supported on this platform." << std::endl;
+    return false;
+#else
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::cout << "ERROR: Socket path too long: " << socketPath << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    // Only one daemon per socket, but a socket file left by a dead daemon can go
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(probe, (sockaddr *)&address, sizeof(address)) == 0)
+    {
+        close(probe);
+        std::cout << "ERROR: A job system daemon is already listening on " << socketPath << std::endl;
+        return false;
+    }
+    close(probe);
+    unlink(socketPath.c_str());
+
+    // A missing directory (as for the default path) is made private to this user
+    size_t slash = socketPath.find_last_of('/');
+    if (slash != std::string::npos && slash > 0 && mkdir(socketPath.substr(0, slash).c_str(), 0700) != 0 && errno != EEXIST)
+    {
+        std::cout << "ERROR: Unable to create the directory of " << socketPath << std::endl;
+        return false;
+    }
+
+    // The socket is made owner-only before anyone can connect, ServeClient checks who connected anyway
+    m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listenSocket == -1 ||
+        bind(m_listenSocket, (sockaddr *)&address, sizeof(address)) != 0 ||
+        chmod(socketPath.c_str(), 0600) != 0 ||
+        listen(m_listenSocket, 64) != 0)
+    {
+        std::cout << "ERROR: Unable to listen on " << socketPath << std::endl;
+        if (m_listenSocket != -1)
+            close(m_listenSocket);
+        m_listenSocket = -1;
+        return false;
+    }
+    m_socketPath = socketPath;
+    m_isStopping = false;
+    return true;
+#endif
+}
+
+void JobSystemDaemon::Serve()
+{
+#ifndef _WIN32
+    while (!m_isStopping)
+    {
+        int clientSocket = accept(m_listenSocket, nullptr, nullptr);
+        if (clientSocket == -1)
+        {
+            if (m_isStopping)
+                break;
+            continue;
+        }
+
+        std::vector<std::thread *> finishedClientThreads;
+        m_clientsMutex.lock();
+        m_clientThreads[clientSocket] = new std::thread(&JobSystemDaemon::ServeClient, this, clientSocket);
+        finishedClientThreads.swap(m_finishedClientThreads);
+        m_clientsMutex.unlock();
+
+        // Clients that went away since the last connection
+        ReapClientThreads(finishedClientThreads);
+    }
+#endif
+}
+
+void JobSystemDaemon::ReapClientThreads(std::vector<std::thread *> &clientThreads)
+{
+    for (std::thread *clientThread : clientThreads)
+    {
+        clientThread->join();
+        delete clientThread;
+    }
+    clientThreads.clear();
+}
+
+void JobSystemDaemon::Stop()
+{
+#ifndef _WIN32
+    if (m_listenSocket == -1)
+        return;
+    m_isStopping = true;
+
+    // Wake up accept() and every client thread blocked on its socket
+    shutdown(m_listenSocket, SHUT_RDWR);
+    close(m_listenSocket);
+    m_listenSocket = -1;
+    unlink(m_socketPath.c_str());
+
+    m_clientsMutex.lock();
+    std::vector<std::thread *> clientThreads;
+    clientThreads.swap(m_finishedClientThreads);
+    for (const std::pair<const int, std::thread *> &client : m_clientThreads)
+    {
+        shutdown(client.first, SHUT_RDWR);
+        clientThreads.push_back(client.second);
+    }
+    m_clientThreads.clear();
+    m_clientsMutex.unlock();
+
+    ReapClientThreads(clientThreads);
+#endif
+}
+
+void JobSystemDaemon::ServeClient(int clientSocket)
+{
+#ifndef _WIN32
+    // Jobs this client still has to collect
+    std::unordered_set<int> ownedJobs;
+
+    // Clients can stop the job system and load plugins into it, other users get nothing
+    bool trusted = IsPeerSameUser(clientSocket);
+    if (!trusted)
+    {
+        std::cout << "ERROR: Refused a job system client run by another user" << std::endl;
+    }
+
+    uint16_t frameType;
+    std::string payload;
+    while (trusted && ReceiveFrame(clientSocket, frameType, payload))
+    {
+        if (frameType != JOB_FRAME_CALL || payload.size() < sizeof(uint32_t))
+            break;
+
+        uint32_t methodSize;
+        std::memcpy(&methodSize, payload.data(), sizeof(methodSize));
+        if (payload.size() < sizeof(methodSize) + methodSize)
+            break;
+        std::string method = payload.substr(sizeof(methodSize), methodSize);
+        std::string args = payload.substr(sizeof(methodSize) + methodSize);
+
+        std::string reply = Dispatch(method, args);
+        TrackOwnedJobs(method, args, reply, ownedJobs);
+        if (!SendFrame(clientSocket, JOB_FRAME_REPLY, reply))
+            break;
+    }
+
+    // Nobody is left to collect these
+    for (int jobID : ownedJobs)
+    {
+        json destroyArgs;
+        destroyArgs["id"] = jobID;
+        m_js->DestroyJob(destroyArgs.dump());
+    }
+
+    // Hand this thread over to be joined; the socket is only closed once it is no
+    // longer in m_clientThreads, so a new client can't get the same number first
+    m_clientsMutex.lock();
+    std::unordered_map<int, std::thread *>::iterator clientIter = m_clientThreads.find(clientSocket);
+    if (clientIter != m_clientThreads.end())
+    {
+        m_finishedClientThreads.push_back(clientIter->second);
+        m_clientThreads.erase(clientIter);
+    }
+    close(clientSocket);
+    m_clientsMutex.unlock();
+#endif
+}
+
+void JobSystemDaemon::TrackOwnedJobs(const std::string &method, const std::string &args, const std::string &reply, std::unordered_set<int> &ownedJobs)
+{
+    if (method != "create_job" && method != "complete_job" && method != "destroy_job")
+        return;
+    json message = json::parse(method == "create_job" ? reply : args, nullptr, false);
+    if (!message.is_object() || !message.contains("id") || !message["id"].is_number_integer())
+        return;
+
+    int jobID = message["id"];
+    if (method == "create_job" && jobID != -1)
+        ownedJobs.insert(jobID);
+    else
+        ownedJobs.erase(jobID);
+}
+
+std::string JobSystemDaemon::Dispatch(const std::string &method, const std::string &args)
+{
+    // A bad request from one client must not take the daemon down
+    try
+    {
+        if (method == "create_job")
+            return m_js->CreateJob(args);
+        if (method == "job_status")
+            return m_js->JobStatus(args);
+        if (method == "wait_for_jobs")
+            return WaitForJobs(args);
+        if (method == "complete_job")
+            return CompleteJob(args);
+        if (method == "get_job_types")
+            return m_js->GetJobTypes();
+        if (method == "get_job_type_id")
+            return m_js->GetJobTypeID(args);
+        if (method == "register_job_chain")
+            return m_js->RegisterJobChain(args);
+        if (method == "are_jobs_running")
+            return m_js->AreJobsRunning();
+        if (method == "get_cache_stats")
+            return m_js->GetCacheStats();
+        if (method == "load_plugins")
+            return LoadPlugins(args);
+        if (method == "reload_plugins")
+            return m_js->ReloadPlugins();
+
+        if (method == "destroy_job")
+            m_js->DestroyJob(args);
+        else if (method == "stop")
+            m_js->StopJobSystem();
+        else if (method == "resume")
+            m_js->ResumeJobSystem();
+        else if (method == "set_queue_capacity")
+            m_js->SetQueueCapacity(args);
+        else if (method == "set_job_cacheable")
+            m_js->SetJobCacheable(args);
+        else if (method == "invalidate_cached_job")
+            m_js->InvalidateCachedJob(args);
+        else
+            return "{\"error\": \"Unknown method " + method + "\"}";
+        return "{}";
+    }
+    catch (const std::exception &e)
+    {
+        json error;
+        error["error"] = e.what();
+        return error.dump();
+    }
+}
+
+std::string JobSystemDaemon::WaitForJobs(const std::string &args)
+{
+    // Waits are cut into short slices so Stop() never has to wait on a client thread for long
+    // (CompleteJob waits the same way), a client that gets nothing back simply asks again
+    json wait = json::parse(args);
+    int timeoutMilliseconds = wait.contains("timeout_ms") ? (int)wait["timeout_ms"] : -1;
+    if (timeoutMilliseconds < 0 || timeoutMilliseconds > JOB_DAEMON_WAIT_SLICE_MILLISECONDS)
+        wait["timeout_ms"] = JOB_DAEMON_WAIT_SLICE_MILLISECONDS;
+    return m_js->WaitForJobs(wait.dump());
+}
+
+std::string JobSystemDaemon::CompleteJob(const std::string &args)
+{
+    // FinishJob blocks until the job is done, so wait for it in slices first
+    json complete = json::parse(args);
+    json wait;
+    wait["ids"] = json::array({complete["id"]});
+    wait["timeout_ms"] = JOB_DAEMON_WAIT_SLICE_MILLISECONDS;
+    json ready;
+    do
+    {
+        if (m_isStopping)
+            return "{\"error\": \"The job system daemon is stopping\"}";
+        ready = json::parse(m_js->WaitForJobs(wait.dump()));
+    } while (ready["ids"].empty());
+    return m_js->CompleteJob(args);
+}
+
+std::string JobSystemDaemon::LoadPlugins(const std::string &directory)
+{
+    // Plugins run inside the daemon, so clients can't pick where they come from
+    if (m_pluginDirectory.empty() || (!directory.empty() && directory != m_pluginDirectory))
+        return "{\"error\": \"Plugins are only loaded from the daemon's plugin directory\"}";
+    return m_js->LoadPlugins(m_pluginDirectory);
+}
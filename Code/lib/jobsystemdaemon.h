@@ -0,0 +1,53 @@
+#ifndef JOB_SYSTEM_JOBSYSTEMDAEMON_H
+#define JOB_SYSTEM_JOBSYSTEMDAEMON_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+class JobSystemInterface;
+
+#define JOB_DAEMON_WAIT_SLICE_MILLISECONDS 200
+
+// Serves one long-lived job system to any number of local client processes over a
+// Unix domain socket. Clients use JobSystemInterface::ConnectToDaemon and the same
+// JSON calls they would make locally; each client gets its own thread here.
+// Jobs a client created and never completed or destroyed are destroyed when it disconnects.
+// Only processes of the user running the daemon are served, and the socket is kept private.
+class JobSystemDaemon
+{
+public:
+    JobSystemDaemon(JobSystemInterface *js) : m_js(js) {}
+    ~JobSystemDaemon();
+
+    // The only directory clients can load plugins from, none if never set
+    void SetPluginDirectory(std::string directory) { m_pluginDirectory = directory; }
+
+    bool Listen(std::string socketPath);
+    void Serve(); // Blocks until Stop() is called
+    void Stop();
+
+private:
+    void ServeClient(int clientSocket);
+    void ReapClientThreads(std::vector<std::thread *> &clientThreads);
+    void TrackOwnedJobs(const std::string &method, const std::string &args, const std::string &reply, std::unordered_set<int> &ownedJobs);
+    std::string Dispatch(const std::string &method, const std::string &args);
+    std::string WaitForJobs(const std::string &args);
+    std::string CompleteJob(const std::string &args);
+    std::string LoadPlugins(const std::string &directory);
+
+    JobSystemInterface *m_js = nullptr;
+    std::string m_socketPath;
+    std::string m_pluginDirectory;
+    int m_listenSocket = -1;
+    std::atomic<bool> m_isStopping{false};
+    std::unordered_map<int, std::thread *> m_clientThreads; // Client socket -> thread serving it
+    std::vector<std::thread *> m_finishedClientThreads;     // Disconnected, joined by Serve() or Stop()
+    std::mutex m_clientsMutex;
+};
+
+#endif // JOB_SYSTEM_JOBSYSTEMDAEMON_H
@@ -1,31 +1,69 @@
+#include <algorithm>
 #include "jobsysteminterface.h"
 
+bool JobSystemInterface::ConnectToDaemon(std::string socketPath)
+{
+    JobSystemClient *client = new JobSystemClient();
+    if (!client->Connect(socketPath))
+    {
+        delete client;
+        return false;
+    }
+    delete m_client;
+    m_client = client;
+    return true;
+}
+
 void JobSystemInterface::CreateJobSystem()
 {
+    if (m_client)
+        return;
     // Create job system object
     js = JobSystem::CreateOrGet();
 }
 
 void JobSystemInterface::StopJobSystem()
 {
+    if (m_client)
+    {
+        m_client->Call("stop");
+        return;
+    }
     // Stop Job System
     js->Stop();
 }
 
 void JobSystemInterface::ResumeJobSystem()
 {
+    if (m_client)
+    {
+        m_client->Call("resume");
+        return;
+    }
     // Resume Job System
     js->Resume();
 }
 
 void JobSystemInterface::DestroyJobSystem()
 {
+    if (m_client)
+    {
+        // Only this connection goes away, the daemon keeps running
+        delete m_client;
+        m_client = nullptr;
+        return;
+    }
+    delete m_plugins;
+    m_plugins = nullptr;
+
     // Destroy Job System
     js->Destroy();
 }
 
 void JobSystemInterface::CreateThreads()
 {
+    if (m_client)
+        return;
     // Create the maximum thread amount supported by the system
     for (int i = 0; i < std::thread::hardware_concurrency() - 1; i++)
     {
@@ -33,30 +71,97 @@ void JobSystemInterface::CreateThreads()
     }
 }
 
+void JobSystemInterface::CreateProcesses(int numProcesses, size_t memoryLimitBytes)
+{
+    if (m_client)
+        return;
+    // Worker processes isolate crashes and memory use of the jobs they run
+    for (int i = 0; i < numProcesses; i++)
+    {
+        js->CreateWorkerProcess(("Process" + std::to_string(i)).c_str(), 0xFFFFFFFF, memoryLimitBytes);
+    }
+}
+
 std::string JobSystemInterface::CreateJob(std::string input)
 {
+    if (m_client)
+        return m_client->Call("create_job", input);
     json temp = json::parse(input);
-    int jobID = js->CreateJob(temp["job_type"], temp["input"].dump());
+
+    // Optional backpressure behavior: "block" (default), "fail_fast" or "try" with "timeout_ms"
+    JobSubmitMode submitMode = JOB_SUBMIT_BLOCK;
+    int timeoutMilliseconds = 0;
+    if (temp.contains("submit"))
+    {
+        if (temp["submit"] == "fail_fast")
+            submitMode = JOB_SUBMIT_FAIL_FAST;
+        else if (temp["submit"] == "try")
+            submitMode = JOB_SUBMIT_TRY;
+    }
+    if (temp.contains("timeout_ms"))
+    {
+        timeoutMilliseconds = temp["timeout_ms"];
+    }
+
+    // Optional files the output depends on, and a way to skip the result cache
+    std::vector<std::string> fileDependencies;
+    if (temp.contains("dependencies"))
+    {
+        fileDependencies = temp["dependencies"].get<std::vector<std::string>>();
+    }
+    bool useResultCache = !temp.contains("cache") || temp["cache"] == true;
+
+    // "journal": false keeps the job out of the crash journal, for inputs holding secrets
+    bool useJournal = !temp.contains("journal") || temp["journal"] == true;
+
+    // "job_type" is a name or, to skip the name lookup, the ID from GetJobTypeID
+    bool byID = temp["job_type"].is_number_integer();
+    std::string jobTypeName = byID ? js->GetJobTypeName(temp["job_type"]) : temp["job_type"].get<std::string>();
+    int jobID = byID ? js->CreateJob(temp["job_type"].get<int>(), temp["input"].dump(), submitMode, timeoutMilliseconds, fileDependencies, useResultCache, useJournal)
+                     : js->CreateJob(jobTypeName, temp["input"].dump(), submitMode, timeoutMilliseconds, fileDependencies, useResultCache, useJournal);
     temp["id"] = jobID;
+    if (jobID == -1)
+    {
+        temp["error"] = js->GetJobTypeID(jobTypeName) != JOB_TYPE_ID_UNKNOWN ? "Job queue is full" : "Unknown job type";
+    }
     return temp.dump();
 }
 
 void JobSystemInterface::DestroyJob(std::string input)
 {
+    if (m_client)
+    {
+        m_client->Call("destroy_job", input);
+        return;
+    }
     // Destroy Job
     js->DestroyJob(json::parse(input)["id"]);
 }
 
 std::string JobSystemInterface::JobStatus(std::string input)
 {
+    if (m_client)
+        return m_client->Call("job_status", input);
     // Return the job status
     json temp = json::parse(input);
     temp["status"] = (int)js->GetJobStatus(json::parse(input)["id"]);
     return temp.dump();
 }
 
+std::string JobSystemInterface::WaitForJobs(std::string input)
+{
+    if (m_client)
+        return m_client->Call("wait_for_jobs", input);
+    json temp = json::parse(input);
+    int timeoutMilliseconds = temp.contains("timeout_ms") ? (int)temp["timeout_ms"] : -1;
+    temp["ids"] = js->WaitForJobs(temp["ids"].get<std::vector<int>>(), timeoutMilliseconds);
+    return temp.dump();
+}
+
 std::string JobSystemInterface::CompleteJob(std::string input)
 {
+    if (m_client)
+        return m_client->Call("complete_job", input);
     json temp = json::parse(input);
     temp["output"] = js->FinishJob(temp["id"]);
     // Finish job
@@ -65,20 +170,163 @@ std::string JobSystemInterface::CompleteJob(std::string input)
 
 std::string JobSystemInterface::AreJobsRunning()
 {
+    if (m_client)
+        return m_client->Call("are_jobs_running");
     json temp;
     temp["are_jobs_running"] = js->areJobsRunning();
     // Return if jobs are running or completed
     return temp.dump();
 }
 
+void JobSystemInterface::SetQueueCapacity(std::string input)
+{
+    if (m_client)
+    {
+        m_client->Call("set_queue_capacity", input);
+        return;
+    }
+    // Set a queue capacity for a channel mask, a job tag (the jobType a Job was created with)
+    // or the tag of a "job_type", which is a name or an ID from GetJobTypeID as in CreateJob
+    json temp = json::parse(input);
+    int capacity = temp.contains("capacity") ? (int)temp["capacity"] : JOB_QUEUE_UNBOUNDED;
+    if (temp.contains("channels"))
+    {
+        js->SetChannelQueueCapacity(temp["channels"], capacity);
+    }
+    else if (temp.contains("job_type"))
+    {
+        int jobTypeID = temp["job_type"].is_number_integer() ? temp["job_type"].get<int>() : js->GetJobTypeID(temp["job_type"].get<std::string>());
+        int jobTag = js->GetJobTag(jobTypeID);
+        if (jobTag == JOB_TYPE_ANY)
+        {
+            // Untagged jobs can't be told apart from the rest of the queue
+            std::cout << "ERROR: No queue capacity can be set for job type " << temp["job_type"] << ", it is unknown or has no tag." << std::endl;
+            return;
+        }
+        js->SetJobTypeQueueCapacity(jobTag, capacity);
+    }
+    else
+    {
+        js->SetJobTypeQueueCapacity(temp.contains("job_tag") ? (int)temp["job_tag"] : JOB_TYPE_ANY, capacity);
+    }
+}
+
+void JobSystemInterface::EnableResultCache(size_t maxBytes)
+{
+    if (m_client)
+        return;
+    // Memoize outputs of cacheable jobs, up to maxBytes
+    js->EnableResultCache(maxBytes);
+}
+
+bool JobSystemInterface::EnablePersistentCache(std::string path)
+{
+    if (m_client)
+        return true;
+    // Share cached outputs with other runs through a file
+    return js->EnablePersistentCache(path);
+}
+
+void JobSystemInterface::SetJobCacheable(std::string name)
+{
+    if (m_client)
+    {
+        m_client->Call("set_job_cacheable", name);
+        return;
+    }
+    js->SetJobCacheable(name);
+}
+
+void JobSystemInterface::InvalidateCachedJob(std::string input)
+{
+    if (m_client)
+    {
+        m_client->Call("invalidate_cached_job", input);
+        return;
+    }
+    // Takes the same JSON as CreateJob
+    json temp = json::parse(input);
+    std::vector<std::string> fileDependencies;
+    if (temp.contains("dependencies"))
+    {
+        fileDependencies = temp["dependencies"].get<std::vector<std::string>>();
+    }
+    js->InvalidateCachedJob(temp["job_type"], temp["input"].dump(), fileDependencies);
+}
+
+std::string JobSystemInterface::GetCacheStats()
+{
+    if (m_client)
+        return m_client->Call("get_cache_stats");
+    json temp;
+    JobResultCacheStats stats = js->GetResultCacheStats();
+    temp["hits"] = stats.m_hits;
+    temp["misses"] = stats.m_misses;
+    temp["evictions"] = stats.m_evictions;
+    temp["entries"] = stats.m_numEntries;
+    temp["size_bytes"] = stats.m_sizeBytes;
+    temp["max_bytes"] = stats.m_maxBytes;
+    temp["disk_hits"] = stats.m_diskHits;
+    temp["disk_bytes"] = stats.m_diskBytes;
+    return temp.dump();
+}
+
+bool JobSystemInterface::EnableJournal(std::string path)
+{
+    if (m_client)
+        return true;
+    // Resume from a previous run's journal and keep journaling to it
+    return js->EnableJournal(path);
+}
+
 void JobSystemInterface::RegisterJob(std::string name, Job *ptr)
 {
+    if (m_client)
+    {
+        // Functions can't be sent to another process, the daemon must have registered it
+        json jobTypes = json::parse(m_client->Call("get_job_types"));
+        if (std::find(jobTypes.begin(), jobTypes.end(), name) == jobTypes.end())
+        {
+            std::cout << "ERROR: The job system daemon does not have a \"" << name << "\" job." << std::endl;
+        }
+        delete ptr;
+        return;
+    }
+
     // Register job
     js->Register(name, ptr);
 }
 
+std::string JobSystemInterface::RegisterJobChain(std::string input)
+{
+    if (m_client)
+        return m_client->Call("register_job_chain", input);
+
+    json temp = json::parse(input);
+    std::vector<int> jobTypeIDs;
+    for (const json &jobType : temp["job_types"])
+    {
+        jobTypeIDs.push_back(jobType.is_number_integer() ? jobType.get<int>() : js->GetJobTypeID(jobType.get<std::string>()));
+    }
+    temp["id"] = js->RegisterChain(temp["name"], jobTypeIDs);
+    temp.erase("job_types");
+    return temp.dump();
+}
+
+std::string JobSystemInterface::GetJobTypeID(std::string name)
+{
+    if (m_client)
+        return m_client->Call("get_job_type_id", name);
+    json temp;
+    temp["job_type"] = name;
+    temp["id"] = js->GetJobTypeID(name);
+    return temp.dump();
+}
+
 std::string JobSystemInterface::GetJobTypes()
 {
+    if (m_client)
+        return m_client->Call("get_job_types");
     json temp;
     std::vector<std::string> jobTypes = js->GetJobTypes();
     for (int i = 0; i < jobTypes.size(); i++)
@@ -86,4 +334,24 @@ std::string JobSystemInterface::GetJobTypes()
         temp += jobTypes[i];
     }
     return temp.dump();
-}
\ No newline at end of file
+}
+
+std::string JobSystemInterface::LoadPlugins(std::string directory)
+{
+    if (m_client)
+        return m_client->Call("load_plugins", directory);
+    if (!m_plugins)
+        m_plugins = new JobPluginLoader(js);
+    json temp;
+    temp["loaded"] = m_plugins->LoadDirectory(directory);
+    return temp.dump();
+}
+
+std::string JobSystemInterface::ReloadPlugins()
+{
+    if (m_client)
+        return m_client->Call("reload_plugins");
+    json temp;
+    temp["reloaded"] = m_plugins ? m_plugins->ReloadChanged() : 0;
+    return temp.dump();
+}
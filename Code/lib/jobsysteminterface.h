@@ -3,6 +3,8 @@
 #include <string>
 
 #include "jobsystem.h"
+#include "jobsystemclient.h"
+#include "jobpluginloader.h"
 #include "job.h"
 
 #include "json.hpp"
@@ -12,22 +14,51 @@ class JobSystemInterface
 {
 
 public:
+    // Use a shared JobSystemDaemon instead of a job system in this process. Every call
+    // below is then forwarded to the daemon; the daemon owns workers, caches and job types.
+    bool ConnectToDaemon(std::string socketPath = JobSystemDefaultSocketPath());
+    bool IsRemote() const { return m_client != nullptr; }
+
     void CreateJobSystem();
     void StopJobSystem();
     void ResumeJobSystem();
     void DestroyJobSystem();
 
     void CreateThreads();
+    // Only after JobSystem::EnableWorkerProcesses(), which has to run before any thread starts
+    void CreateProcesses(int numProcesses, size_t memoryLimitBytes = 0);
 
     std::string CreateJob(std::string input);
     void DestroyJob(std::string input);
     std::string JobStatus(std::string id);
+    // {"ids": [...], "timeout_ms"}: blocks until at least one of the jobs can be completed (or is
+    // gone) and returns {"ids": [those]}, empty once the timeout passes (none or -1 waits for good)
+    std::string WaitForJobs(std::string input);
     std::string CompleteJob(std::string input);
     std::string GetJobTypes();
+    std::string GetJobTypeID(std::string name); // The ID can stand in for the name in CreateJob
     std::string AreJobsRunning();
+    void SetQueueCapacity(std::string input);
+
+    void EnableResultCache(size_t maxBytes);
+    bool EnablePersistentCache(std::string path);
+    void SetJobCacheable(std::string name);
+    void InvalidateCachedJob(std::string input);
+    std::string GetCacheStats();
+
+    bool EnableJournal(std::string path);
 
     void RegisterJob(std::string name, Job *ptr);
+    // {"name", "job_types": [names or IDs]}: one job type that runs them back to back on a
+    // single worker. Returns {"name", "id"}, the id is -1 if they can't be chained.
+    std::string RegisterJobChain(std::string input);
+
+    // Job types from plugin shared objects, reloaded in place when the files change
+    std::string LoadPlugins(std::string directory);
+    std::string ReloadPlugins();
 
 private:
-    JobSystem *js;
+    JobSystem *js = nullptr;
+    JobSystemClient *m_client = nullptr;
+    JobPluginLoader *m_plugins = nullptr;
 };
\ No newline at end of file
@@ -34,8 +34,15 @@ void JobWorkerThread::Work()
         Job *job = m_jobSystem->ClaimAJob(m_workerJobChannels);
         if (job)
         {
-            job->Execute(job->input);
-            m_jobSystem->OnJobCompleted(job);
+            Job::s_currentJob = job;
+            bool finished = job->Execute(job->input);
+            Job::s_currentJob = nullptr;
+
+            // A coroutine that is awaiting something is parked instead of holding this thread
+            if (finished)
+                m_jobSystem->OnJobCompleted(job);
+            else
+                m_jobSystem->OnJobSuspended(job);
         }
 
         // How fast you want to pull jobs
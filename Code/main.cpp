@@ -1,4 +1,7 @@
+#include <filesystem>
+#include <algorithm>
 #include "interpreter.h"
+#include "lib/jobsystemdaemon.h"
 
 using namespace std;
 
@@ -192,6 +195,44 @@ string parseFile(string output)
     return tempJson.dump();
 }
 
+// Function to list the source files of a project (make target "project1" builds compilecode/Project1)
+vector<string> listProjectFiles(string projectName)
+{
+    vector<string> files;
+    if (projectName.empty())
+        return files;
+    projectName[0] = toupper(projectName[0]);
+
+    error_code ec;
+    for (const auto &entry : filesystem::directory_iterator("../Data/compilecode/" + projectName, ec))
+    {
+        string extension = entry.path().extension().string();
+        if (extension == ".cpp" || extension == ".h" || extension == ".hpp")
+            files.push_back(entry.path().string());
+    }
+    if (!files.empty())
+        files.push_back("./makefile");
+    return files;
+}
+
+// Compile and parse Job.
+// string command: A Makefile command.
+// Runs the compile and parse_file jobs back to back. The worker is free to run other jobs
+// while this one waits on them.
+// Returns the same JSON as the parse_file job.
+JobTask compileAndParse(string command)
+{
+    JobSystem *js = JobSystem::CreateOrGet();
+
+    // Both results are only reusable while the project's sources are unchanged
+    string makeCommand = command;
+    cleanJson(makeCommand);
+    vector<string> projectFiles = listProjectFiles(makeCommand.substr(makeCommand.find_last_of(' ') + 1));
+
+    string compileOutput = co_await AwaitJob(js->CreateJob("compile", command, JOB_SUBMIT_BLOCK, 0, projectFiles));
+    co_return co_await AwaitJob(js->CreateJob("parse_file", json(compileOutput).dump(), JOB_SUBMIT_BLOCK, 0, projectFiles));
+}
+
 // Output errors to a file.
 // string output: A JSON object that contains the formatted error for each file, and the project name.
 // Returns a string that indicates that the job is done.
@@ -357,27 +398,230 @@ string openFile(string path)
     return output;
 }
 
-int main()
+// Function to list the make targets of every project under compilecode (Project1 builds with "project1")
+vector<string> listProjects()
+{
+    vector<string> projects;
+    error_code ec;
+    for (const auto &entry : filesystem::directory_iterator("../Data/compilecode", ec))
+    {
+        if (!entry.is_directory())
+            continue;
+        string name = entry.path().filename().string();
+        name[0] = tolower(name[0]);
+        projects.push_back(name);
+    }
+    sort(projects.begin(), projects.end());
+    return projects;
+}
+
+// Function to block until a job is done. Only this job is waited on, a daemon has other
+// clients' jobs running too, and it answers in short slices so it may take a few calls.
+void waitForJob(JobSystemInterface &js, int jobID)
+{
+    json wait;
+    wait["ids"] = json::array({jobID});
+    json ready;
+    do
+        ready = json::parse(js.WaitForJobs(wait.dump()));
+    while (!ready.contains("error") && ready["ids"].empty());
+}
+
+// Function to print every problem found in the FlowScript
+void printFlowScriptErrors(Interpreter &interpreter)
+{
+    for (const Interpreter::flowError &error : interpreter.getErrors())
+        cout << error.message << " (line " << error.line << ", column " << error.column << ")" << endl;
+}
+
+// Function to run the current FlowScript over many projects at once and report throughput
+int runBatch(Interpreter &interpreter, string listFile, int maxInFlight, bool ordered)
+{
+    // Projects come one per line from the list file, or are every project under compilecode
+    vector<string> projects;
+    if (listFile.empty())
+    {
+        projects = listProjects();
+    }
+    else
+    {
+        ifstream list(listFile);
+        string line;
+        while (getline(list, line))
+        {
+            if (!line.empty())
+                projects.push_back(line);
+        }
+    }
+    if (projects.empty())
+    {
+        cout << "ERROR: No projects to run" << endl;
+        return 1;
+    }
+
+    interpreter.loadFile("../Data/compiling_pipeline.dot");
+    interpreter.parse();
+    if (interpreter.getErrorCode() != 0)
+    {
+        cout << "Couldn't compile flowscript: " << endl;
+        printFlowScriptErrors(interpreter);
+        return 1;
+    }
+
+    vector<string> inputs;
+    for (const string &project : projects)
+    {
+#ifdef _WIN32
+        inputs.push_back("MinGW32-make " + project);
+#else
+        inputs.push_back("make " + project);
+#endif
+    }
+
+    Interpreter::batchStats stats;
+    vector<Interpreter::batchResult> results = interpreter.runBatch(inputs, maxInFlight, ordered, stats);
+    for (const Interpreter::batchResult &result : results)
+        cout << projects[result.index] << " (" << result.milliseconds << " ms): " << result.output << endl;
+
+    cout << endl
+         << stats.inputs << " inputs in " << stats.seconds << " s, " << stats.inputsPerSecond << " inputs/s, "
+         << "average " << stats.averageMilliseconds << " ms, max " << stats.maxMilliseconds << " ms, "
+         << stats.errors << " errors" << endl;
+    return stats.errors == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
 {
+    // --daemon [socket]: keep one job system running for other processes to share
+    // --connect [socket]: run the pipeline against a running daemon
+    // --batch [list file] [--in-flight n] [--unordered]: run the existing FlowScript over many
+    //   projects (one per line, or all of compilecode) at once instead of asking for one
+    bool daemonMode = false;
+    string daemonSocket = "";
+    bool batchMode = false, batchOrdered = true;
+    string batchList = "";
+    int batchInFlight = 8;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--daemon" || arg == "--connect")
+        {
+            daemonMode = arg == "--daemon";
+            daemonSocket = JobSystemDefaultSocketPath();
+            if (i + 1 < argc && string(argv[i + 1]).rfind("--", 0) != 0)
+                daemonSocket = argv[++i];
+        }
+        else if (arg == "--batch")
+        {
+            batchMode = true;
+            if (i + 1 < argc && string(argv[i + 1]).rfind("--", 0) != 0)
+                batchList = argv[++i];
+        }
+        else if (arg == "--in-flight" && i + 1 < argc)
+        {
+            batchInFlight = atoi(argv[++i]);
+        }
+        else if (arg == "--unordered")
+        {
+            batchOrdered = false;
+        }
+    }
+
     // Create job system object
     JobSystemInterface js;
 
+    if (daemonMode)
+    {
+        js.CreateJobSystem();
+        js.CreateThreads();
+
+        js.EnableResultCache(64 * 1024 * 1024);
+        js.EnablePersistentCache("../Data/.jobcache");
+        js.SetJobCacheable("call_LLM");
+
+        // Clients can't send functions, so the daemon registers every job they use
+        js.RegisterJob("call_LLM", new Job(callLLM, 1));
+        js.RegisterJob("output_to_file", new Job(outputToFile, 2));
+        js.RegisterJob("compile", new Job(compile, 3));
+        js.RegisterJob("parse_file", new Job(parseFile, 4));
+        js.RegisterJob("compile_and_parse", new Job(compileAndParse, 6));
+
+        // Extra job types from plugins, clients can call reload_plugins after deploying new builds
+        string pluginDirectory = "../Data/plugins";
+        js.LoadPlugins(pluginDirectory);
+
+        js.EnableJournal("../Data/.jobjournal");
+
+        JobSystemDaemon daemon(&js);
+        daemon.SetPluginDirectory(pluginDirectory);
+        if (!daemon.Listen(daemonSocket))
+        {
+            js.DestroyJobSystem();
+            return 1;
+        }
+        cout << "Job system daemon listening on " << daemonSocket << endl;
+        daemon.Serve();
+
+        js.DestroyJobSystem();
+        return 0;
+    }
+
+    if (!daemonSocket.empty() && !js.ConnectToDaemon(daemonSocket))
+    {
+        cout << "ERROR: Could not connect to the job system daemon at " << daemonSocket << endl;
+        return 1;
+    }
+
     // Create interpreter object
-    Interpreter interpreter;
+    Interpreter interpreter(daemonSocket);
 
     js.CreateJobSystem();
     js.CreateThreads();
 
+    // Reuse outputs of jobs that run again on identical inputs, in this run (up to 64 MB) and across runs
+    js.EnableResultCache(64 * 1024 * 1024);
+    js.EnablePersistentCache("../Data/.jobcache");
+    js.SetJobCacheable("call_LLM");
+
     // Register all jobs
     js.RegisterJob("call_LLM", new Job(callLLM, 1));
     js.RegisterJob("output_to_file", new Job(outputToFile, 2));
 
+    // Register all jobs for interpreter, once; retries below only reload the FlowScript
+    interpreter.registerJob("compile", new Job(compile, 3));
+    interpreter.registerJob("parse_file", new Job(parseFile, 4));
+    interpreter.registerJob("output_to_file", new Job(outputToFile, 5));
+    interpreter.registerJob("compile_and_parse", new Job(compileAndParse, 6));
+
+    // FlowScript that was already compiled once (in this run or an earlier one) isn't parsed again
+    interpreter.enablePlanCache("../Data/.plancache");
+
+    // Pick up where a crashed run left off (the interpreter's jobs are requeued once registered)
+    js.EnableJournal("../Data/.jobjournal");
+
+    if (batchMode)
+    {
+        int status = runBatch(interpreter, batchList, batchInFlight, batchOrdered);
+        js.DestroyJobSystem();
+        return status;
+    }
+
     // Ask the user to input a project
     cout << "Enter the name of the make command: ";
     string projectName = "";
     cin >> projectName;
     cout << endl;
 
+    // Compile results can only be reused while the project sources are unchanged
+    vector<string> projectFiles = listProjectFiles(projectName);
+    if (!projectFiles.empty())
+    {
+        js.SetJobCacheable("compile");
+        js.SetJobCacheable("parse_file");
+        js.SetJobCacheable("compile_and_parse");
+        interpreter.setDependencies(projectFiles);
+    }
+
     /// ---------------------- LLM FLOWSCRIPT GENERATION ---------------------- ///
 
     // Import prompt and error files
@@ -388,16 +632,14 @@ int main()
     do
     {
         // Spin off job and get job ID
-        string jobFlowscript = js.CreateJob("{\"job_type\": \"call_LLM\", \"input\": {\"ip\": \"http://localhost:4891/v1/chat/completions\", \"prompt\": \"" + promptFlowscript + "\", \"model\": \"mistral-7b-instruct-v0.1.Q4_0\"}}");
+        string requestFlowscript = "{\"job_type\": \"call_LLM\", \"input\": {\"ip\": \"http://localhost:4891/v1/chat/completions\", \"prompt\": \"" + promptFlowscript + "\", \"model\": \"mistral-7b-instruct-v0.1.Q4_0\"}}";
+        string jobFlowscript = js.CreateJob(requestFlowscript);
         int jobFlowscriptID = json::parse(jobFlowscript)["id"];
 
         cout << "Generate FlowScript Job running... ";
 
-        // Check job status and try to complete the jobs
-        while (json::parse(js.AreJobsRunning())["are_jobs_running"])
-        {
-            //  Wait to complete all the jobs
-        }
+        // Wait for the job to finish
+        waitForJob(js, jobFlowscriptID);
 
         // // Get job outputs
         string outputFlowscript;
@@ -409,8 +651,11 @@ int main()
             outputFlowscript == "Output JSON error" ||
             outputFlowscript == "Failed to open pipe")
         {
+            // Don't keep failed calls around
+            js.InvalidateCachedJob(requestFlowscript);
             cout << "LLM call failed" << endl
                  << endl;
+            js.DestroyJobSystem(); // Also discards the job journal, nothing is left to resume
             return 0;
         }
 
@@ -440,11 +685,8 @@ int main()
 
         cout << "FlowScript to File Job running... ";
 
-        // Check job status and try to complete the jobs
-        while (json::parse(js.AreJobsRunning())["are_jobs_running"])
-        {
-            //  Wait to complete all the jobs
-        }
+        // Wait for the job to finish
+        waitForJob(js, jobFlowscriptFileID);
 
         // Get job outputs
         string outputFlowscriptFile;
@@ -458,11 +700,6 @@ int main()
         // Load flowscript file
         interpreter.loadFile("../Data/compiling_pipeline.dot");
 
-        // Register all jobs for interpreter
-        interpreter.registerJob("compile", new Job(compile, 3));
-        interpreter.registerJob("parse_file", new Job(parseFile, 4));
-        interpreter.registerJob("output_to_file", new Job(outputToFile, 5));
-
         // Pass the input
 #ifdef __linux__
         interpreter.setInput("make " + projectName);
@@ -479,11 +716,13 @@ int main()
         if (interpreter.getErrorCode() != 0)
         {
             cout << "Couldn't compile flowscript: " << endl;
-            cout << interpreter.getErrorMessage() << endl;
-            cout << "Error line: " << interpreter.getErrorLine() << endl;
+            printFlowScriptErrors(interpreter);
 
             cout << "Generating FlowScript again" << endl
                  << endl;
+
+            // Ask the LLM again instead of reusing the bad FlowScript
+            js.InvalidateCachedJob(requestFlowscript);
             continue;
         }
         else
@@ -513,6 +752,7 @@ int main()
         else
         {
             cout << "FlowScript did not generate any output";
+            js.DestroyJobSystem();
             return 0;
         }
         errorJson = json::parse(error);
@@ -521,6 +761,7 @@ int main()
         if (errorJson.is_null())
         {
             cout << "All errors fixed!" << endl;
+            js.DestroyJobSystem();
             return 0;
         }
         else
@@ -552,23 +793,23 @@ int main()
         else
         {
             cout << "You need an API key to call the LLM" << endl;
+            js.DestroyJobSystem();
             return 0;
         }
         if (apiKey == "")
         {
             cout << "You need an API key to call the LLM" << endl;
+            js.DestroyJobSystem();
             return 0;
         }
 
-        // Call LLM to fix the code
-        string jobFixCode = js.CreateJob("{\"job_type\": \"call_LLM\", \"input\": {\"ip\": \"https://api.openai.com/v1/chat/completions\", \"prompt\": \"" + prompt + error + "\", \"model\": \"gpt-3.5-turbo\", \"key\": \"" + apiKey + "\"}}");
+        // Call LLM to fix the code (not cached, the same prompt again means the last fix did not work).
+        // The input holds the API key, so it must stay out of the journal file
+        string jobFixCode = js.CreateJob("{\"job_type\": \"call_LLM\", \"input\": {\"ip\": \"https://api.openai.com/v1/chat/completions\", \"prompt\": \"" + prompt + error + "\", \"model\": \"gpt-3.5-turbo\", \"key\": \"" + apiKey + "\"}, \"cache\": false, \"journal\": false}");
         int jobFixCodeID = json::parse(jobFixCode)["id"];
 
-        // Check job status and try to complete the job
-        while (json::parse(js.AreJobsRunning())["are_jobs_running"])
-        {
-            //  Wait to complete all the jobs
-        }
+        // Wait for the job to finish
+        waitForJob(js, jobFixCodeID);
 
         // Get job output
         string outputFixCode = json::parse(js.CompleteJob(jobFixCode))["output"];
@@ -581,6 +822,7 @@ int main()
         {
             cout << "LLM call failed" << endl
                  << endl;
+            js.DestroyJobSystem();
             return 0;
         }
 
@@ -0,0 +1,148 @@
+#include "nodes.h"
+
+json FlowPlan::toJson() const
+{
+    json saved;
+    saved["kinds"] = json::array();
+    for (NodeKind kind : kinds)
+        saved["kinds"].push_back((int)kind);
+    saved["job_names"] = jobNames;
+    saved["stage_jobs"] = stageJobs;
+    saved["conditions"] = conditions;
+    saved["names"] = names;
+    saved["stage_limits"] = stageLimits;
+    saved["stage_queues"] = stageQueues;
+    saved["successor_offsets"] = successorOffsets;
+    saved["successors"] = successors;
+    saved["edge_labels"] = edgeLabels;
+    saved["edge_dashed"] = edgeDashed;
+    saved["decision_ids"] = decisionIDs;
+
+    saved["ifs"] = json::array();
+    for (const FlowIf &decision : ifs)
+        saved["ifs"].push_back({{"condition", decision.condition.toJson()}, {"when_true", decision.whenTrue}, {"when_false", decision.whenFalse}});
+    saved["switches"] = json::array();
+    for (const FlowSwitch &decision : switches)
+        saved["switches"].push_back({{"value", decision.value.toJson()}, {"cases", decision.cases}, {"otherwise", decision.otherwise}});
+
+    saved["input_node"] = inputNode;
+    return saved;
+}
+
+bool FlowPlan::fromJson(const json &saved)
+{
+    clear();
+    try
+    {
+        for (const json &kind : saved["kinds"])
+        {
+            if (kind.get<int>() < NODE_INPUT || kind.get<int>() > NODE_SPLIT)
+                return false;
+            kinds.push_back((NodeKind)kind.get<int>());
+        }
+        jobTypeIDs.assign(kinds.size(), JOB_TYPE_ID_UNKNOWN);
+        jobNames = saved["job_names"].get<std::vector<std::string>>();
+        stageJobs = saved["stage_jobs"].get<std::vector<std::vector<std::string>>>();
+        conditions = saved["conditions"].get<std::vector<std::string>>();
+        names = saved["names"].get<std::vector<std::string>>();
+        stageLimits = saved["stage_limits"].get<std::vector<int>>();
+        stageQueues = saved["stage_queues"].get<std::vector<int>>();
+        successorOffsets = saved["successor_offsets"].get<std::vector<int>>();
+        successors = saved["successors"].get<std::vector<int>>();
+        edgeLabels = saved["edge_labels"].get<std::vector<std::string>>();
+        edgeDashed = saved["edge_dashed"].get<std::vector<uint8_t>>();
+        decisionIDs = saved["decision_ids"].get<std::vector<int>>();
+
+        for (const json &savedIf : saved["ifs"])
+        {
+            FlowIf decision;
+            if (!decision.condition.fromJson(savedIf["condition"]))
+                return false;
+            decision.whenTrue = savedIf["when_true"];
+            decision.whenFalse = savedIf["when_false"];
+            if (decision.whenTrue < -1 || decision.whenTrue >= (int)kinds.size() || decision.whenFalse < -1 || decision.whenFalse >= (int)kinds.size())
+                return false;
+            ifs.push_back(std::move(decision));
+        }
+        for (const json &savedSwitch : saved["switches"])
+        {
+            FlowSwitch decision;
+            if (!decision.value.fromJson(savedSwitch["value"]))
+                return false;
+            decision.cases = savedSwitch["cases"].get<std::unordered_map<std::string, int>>();
+            decision.otherwise = savedSwitch["otherwise"];
+            for (const auto &selected : decision.cases)
+            {
+                if (selected.second < 0 || selected.second >= (int)kinds.size())
+                    return false;
+            }
+            if (decision.otherwise < -1 || decision.otherwise >= (int)kinds.size())
+                return false;
+            switches.push_back(std::move(decision));
+        }
+        inputNode = saved["input_node"];
+    }
+    catch (const json::exception &)
+    {
+        clear();
+        return false;
+    }
+
+    // Every array has to line up with the node count before anything indexes into them
+    size_t nodes = kinds.size();
+    bool consistent = jobNames.size() == nodes && stageJobs.size() == nodes && conditions.size() == nodes && names.size() == nodes && stageLimits.size() == nodes && stageQueues.size() == nodes &&
+                      decisionIDs.size() == nodes && successorOffsets.size() == nodes + 1 && successorOffsets[0] == 0 && successorOffsets.back() == (int)successors.size() &&
+                      edgeLabels.size() == successors.size() && edgeDashed.size() == successors.size() && inputNode >= -1 && inputNode < (int)nodes;
+    for (size_t node = 0; consistent && node < nodes; node++)
+    {
+        consistent = successorOffsets[node] <= successorOffsets[node + 1];
+        // Only job nodes are fused, and always from at least two jobs
+        consistent = consistent && (stageJobs[node].empty() || (kinds[node] == NODE_JOB && stageJobs[node].size() >= 2));
+        if (kinds[node] == NODE_IF)
+            consistent = consistent && decisionIDs[node] >= 0 && decisionIDs[node] < (int)ifs.size();
+        else if (kinds[node] == NODE_SWITCH)
+            consistent = consistent && decisionIDs[node] >= 0 && decisionIDs[node] < (int)switches.size();
+    }
+    for (int successor : successors)
+        consistent = consistent && successor >= 0 && successor < (int)nodes;
+
+    // What validate() would have rejected when compiling: no input or output, negative
+    // limits, or a cycle a strand would go around forever
+    int outputs = 0;
+    for (size_t node = 0; consistent && node < nodes; node++)
+    {
+        outputs += kinds[node] == NODE_OUTPUT;
+        consistent = stageLimits[node] >= 0 && stageQueues[node] >= 0;
+    }
+    consistent = consistent && inputNode != -1 && kinds[inputNode] == NODE_INPUT && outputs == 1 && isAcyclic();
+    if (!consistent)
+        clear();
+    return consistent;
+}
+
+bool FlowPlan::isAcyclic() const
+{
+    // Kahn's algorithm: peel off nodes nothing points at, a cycle never runs out of predecessors
+    std::vector<int> predecessors(size(), 0);
+    for (int successor : successors)
+        predecessors[successor]++;
+    std::vector<int> ready;
+    for (int node = 0; node < size(); node++)
+    {
+        if (predecessors[node] == 0)
+            ready.push_back(node);
+    }
+    int peeled = 0;
+    while (!ready.empty())
+    {
+        int node = ready.back();
+        ready.pop_back();
+        peeled++;
+        for (int edge = successorOffsets[node]; edge < successorOffsets[node + 1]; edge++)
+        {
+            if (--predecessors[successors[edge]] == 0)
+                ready.push_back(successors[edge]);
+        }
+    }
+    return peeled == size();
+}
@@ -1,109 +1,98 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <unordered_map>
 
 #include "./lib/jobsysteminterface.h"
+#include "flowexpression.h"
 
-class Node
+// What a node of a compiled FlowScript graph does
+enum NodeKind : uint8_t
 {
-public:
-    virtual std::string execute(std::string input) { return ""; }
+    NODE_INPUT,
+    NODE_OUTPUT,
+    NODE_JOB,
+    NODE_IF,
+    NODE_SWITCH,
+    NODE_SPLIT
 };
 
-static std::unordered_map<std::string, Node *> nodes;
-
-class JobNode : public Node
+// If node with its condition compiled and its "true" and "false" edges resolved.
+// A missing edge is -1, which ends the path with the input it had.
+struct FlowIf
 {
-public:
-    std::string name;
-    std::string next_ptr;
-    JobSystemInterface *js;
-
-    JobNode(JobSystemInterface *js, std::string name, std::string next_ptr) : js(js), name(name), next_ptr(next_ptr) {}
-    std::string execute(std::string input)
-    {
-        json temp;
-        temp["job_type"] = name;
-        temp["input"] = input;
-
-        // Spin off the job and wait to complete
-        std::string job = js->CreateJob(temp.dump());
-        while (json::parse(js->AreJobsRunning())["are_jobs_running"])
-        {
-        }
-        std::string result = json::parse(js->CompleteJob(job))["output"];
-
-        if (next_ptr != "")
-        {
-            return nodes[next_ptr]->execute(result);
-        }
-        return result;
-    }
-};
-
-class IfNode : public Node
-{
-public:
-    std::string condition;
-    std::string true_ptr;
-    std::string false_ptr;
-
-    IfNode(std::string condition, std::string true_ptr, std::string false_ptr) : condition(condition), true_ptr(true_ptr), false_ptr(false_ptr) {}
-    std::string execute(std::string input)
-    {
-        return "";
-    }
+    FlowExpression condition;
+    int whenTrue = -1;
+    int whenFalse = -1;
 };
 
-class SwitchNode : public Node
+// Switch node with its value compiled and a hashed jump table from case value (the edge
+// label) to successor, so dispatch costs one lookup however many cases there are. String
+// values are looked up as they are, other values by their JSON text (42, true). The edge
+// labelled "default" is taken when no case matches.
+struct FlowSwitch
 {
-public:
-    std::string condition;
-    // Value, ptr
-    std::vector<std::pair<std::string, std::string>> ptrs;
-
-    SwitchNode(std::vector<std::pair<std::string, std::string>> ptrs, std::string condition) : ptrs(ptrs), condition(condition) {}
-    std::string execute(std::string input)
-    {
-        return "";
-    }
+    FlowExpression value;
+    std::unordered_map<std::string, int> cases;
+    int otherwise = -1;
 };
 
-class MultiNode : public Node
+// FlowScript graph compiled into flat arrays indexed by node ID (0 to size() - 1).
+// The successors of node n are successors[successorOffsets[n]] up to, not including,
+// successors[successorOffsets[n + 1]] (compressed sparse rows), so running the graph
+// only walks contiguous memory with integer indices.
+struct FlowPlan
 {
-public:
-    std::vector<std::string> jobs;
-    std::string next_ptr;
-
-    MultiNode(std::vector<std::string> jobs, std::string next_node) : jobs(jobs), next_ptr(next_ptr) {}
-    std::string execute(std::string input)
+    std::vector<NodeKind> kinds;
+    std::vector<int> jobTypeIDs;         // Resolved job type, JOB_TYPE_ID_UNKNOWN for other kinds
+    std::vector<std::string> jobNames;   // Registered job a job node runs, empty for other kinds
+    std::vector<std::vector<std::string>> stageJobs; // Jobs a fused node runs one after the other, empty if not fused
+    std::vector<std::string> conditions; // Label of if and switch nodes
+    std::vector<std::string> names;      // Only for messages
+    std::vector<int> stageLimits;        // Jobs of a node running at once across inputs, 0 for no limit
+    std::vector<int> stageQueues;        // Inputs that may wait for a limited node, 0 for no limit
+
+    std::vector<int> successorOffsets; // size() + 1 entries
+    std::vector<int> successors;
+    std::vector<std::string> edgeLabels; // Per edge, parallel to successors
+    std::vector<uint8_t> edgeDashed;
+
+    std::vector<int> decisionIDs; // Per node, index into ifs or switches, -1 for other kinds
+    std::vector<FlowIf> ifs;
+    std::vector<FlowSwitch> switches;
+
+    int inputNode = -1;
+
+    int size() const { return (int)kinds.size(); }
+    int firstSuccessor(int node) const
     {
-        return "";
+        return successorOffsets[node] < successorOffsets[node + 1] ? successors[successorOffsets[node]] : -1;
     }
-};
 
-class InputNode : public Node
-{
-public:
-    std::string next_ptr;
+    // Everything but jobTypeIDs, which only mean something inside one job system and are
+    // resolved again from jobNames after loading
+    json toJson() const;
+    bool fromJson(const json &saved);
+    bool isAcyclic() const;
 
-    InputNode(std::string next_ptr) : next_ptr(next_ptr) {}
-    std::string execute(std::string input)
+    void clear()
     {
-        if (next_ptr != "")
-        {
-            return nodes[next_ptr]->execute(input);
-        }
-        return input;
+        kinds.clear();
+        jobTypeIDs.clear();
+        jobNames.clear();
+        stageJobs.clear();
+        conditions.clear();
+        names.clear();
+        stageLimits.clear();
+        stageQueues.clear();
+        successorOffsets.clear();
+        successors.clear();
+        edgeLabels.clear();
+        edgeDashed.clear();
+        decisionIDs.clear();
+        ifs.clear();
+        switches.clear();
+        inputNode = -1;
     }
 };
-
-class OutputNode : public Node
-{
-public:
-    std::string execute(std::string input)
-    {
-        return input;
-    }
-};
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include "test.h"
+#include "../lib/job.h"
+#include "../lib/jobsystem.h"
+#include "../lib/jobcoroutine.h"
+#include "../lib/json.hpp"
+using json = nlohmann::json;
+
+// Coroutine jobs awaiting other jobs
+
+static std::string coroutineEcho(std::string input)
+{
+    return input;
+}
+
+static JobTask awaitEcho(std::string input)
+{
+    std::string output = co_await AwaitJob(JobSystem::CreateOrGet()->CreateJob("coroutineEcho", input));
+    co_return output + "!";
+}
+
+static JobTask awaitGivenJob(std::string input)
+{
+    // The input is the ID of the job to wait for
+    co_return co_await AwaitJob(json::parse(input).get<int>());
+}
+
+static JobTask throwFromCoroutine(std::string input)
+{
+    throw std::runtime_error("broken");
+    co_return input;
+}
+
+TEST(coroutineAwaitsAnotherJob)
+{
+    JobSystem *js = JobSystem::CreateOrGet();
+    js->Register("coroutineEcho", new Job(coroutineEcho, 4108));
+    js->Register("awaitEcho", new Job(awaitEcho, 4109));
+
+    int jobID = js->CreateJob("awaitEcho", "\"x\"");
+    CHECK(js->FinishJob(jobID) == "\"x\"!");
+
+    // Several at once on the same worker, each parked while its job runs
+    std::vector<int> jobIDs;
+    for (int i = 0; i < 8; i++)
+        jobIDs.push_back(js->CreateJob("awaitEcho", std::to_string(i)));
+    for (int i = 0; i < 8; i++)
+        CHECK(js->FinishJob(jobIDs[i]) == std::to_string(i) + "!");
+
+    js->Unregister("awaitEcho");
+    js->Unregister("coroutineEcho");
+}
+
+TEST(coroutineResumesWhenTheAwaitedJobIsGone)
+{
+    JobSystem *js = JobSystem::CreateOrGet();
+    js->Register("awaitGivenJob", new Job(awaitGivenJob, 4110));
+    js->Register("coroutineParked", new Job(coroutineEcho, 4111, 0)); // No worker serves channel mask 0
+
+    // Never created
+    int neverSeen = js->CreateJob("awaitGivenJob", "1000000");
+    CHECK(IsErrorOutput(js->FinishJob(neverSeen)));
+
+    // Destroyed while the coroutine waits on it
+    int parked = js->CreateJob("coroutineParked", "1");
+    int waiting = js->CreateJob("awaitGivenJob", std::to_string(parked));
+    for (int i = 0; i < 100 && js->GetJobStatus(waiting) != JOB_STATUS_SUSPENDED; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(js->GetJobStatus(waiting) == JOB_STATUS_SUSPENDED);
+    js->DestroyJob(parked);
+    CHECK(IsErrorOutput(js->FinishJob(waiting)));
+
+    js->Unregister("awaitGivenJob");
+    js->Unregister("coroutineParked");
+}
+
+TEST(coroutineExceptionIsAnError)
+{
+    JobSystem *js = JobSystem::CreateOrGet();
+    js->Register("throwFromCoroutine", new Job(throwFromCoroutine, 4112));
+    int jobID = js->CreateJob("throwFromCoroutine", "1");
+    std::string output = js->FinishJob(jobID);
+    CHECK(output == "ERROR: Unhandled exception in coroutine job");
+    CHECK(IsErrorOutput(output));
+    js->Unregister("throwFromCoroutine");
+}
@@ -0,0 +1,64 @@
+#include <chrono>
+#include <thread>
+#include <sys/stat.h>
+#include "test.h"
+#include "../lib/job.h"
+#include "../lib/jobsystem.h"
+#include "../lib/jobsysteminterface.h"
+#include "../lib/jobsystemdaemon.h"
+
+// The daemon and its clients, all in this process
+
+static std::string daemonEcho(std::string input)
+{
+    return input;
+}
+
+TEST(daemonServesItsOwnUser)
+{
+    std::string socketPath = tempPath("daemon.sock");
+    JobSystem *js = JobSystem::CreateOrGet();
+    js->Register("daemonEcho", new Job(daemonEcho, 4104));
+    js->Register("daemonParked", new Job(daemonEcho, 4105, 0)); // No worker serves channel mask 0
+
+    JobSystemInterface server;
+    server.CreateJobSystem();
+    JobSystemDaemon daemon(&server);
+    daemon.SetPluginDirectory(tempPath("daemonplugins"));
+    CHECK(daemon.Listen(socketPath));
+    std::thread serving(&JobSystemDaemon::Serve, &daemon);
+
+    // Nobody else can even reach the socket
+    struct stat socketStat;
+    CHECK(stat(socketPath.c_str(), &socketStat) == 0 && (socketStat.st_mode & 0777) == 0600);
+
+    JobSystemInterface client;
+    CHECK(client.ConnectToDaemon(socketPath));
+    json created = json::parse(client.CreateJob(R"({"job_type": "daemonEcho", "input": "hi"})"));
+    CHECK(created["id"] != -1);
+    json wait;
+    wait["ids"] = json::array({created["id"]});
+    wait["timeout_ms"] = 5000;
+    CHECK(json::parse(client.WaitForJobs(wait.dump()))["ids"].size() == 1);
+    CHECK(json::parse(client.CompleteJob(created.dump()))["output"] == "\"hi\"");
+
+    // Plugins only come from the daemon's own directory
+    CHECK(json::parse(client.LoadPlugins("/tmp")).contains("error"));
+
+    // Jobs a client leaves behind go with it
+    JobSystemInterface leaving;
+    CHECK(leaving.ConnectToDaemon(socketPath));
+    int parked = json::parse(leaving.CreateJob(R"({"job_type": "daemonParked", "input": 1})"))["id"];
+    CHECK(js->GetJobStatus(parked) == JOB_STATUS_QUEUED);
+    leaving.DestroyJobSystem();
+    for (int i = 0; i < 100 && js->GetJobStatus(parked) == JOB_STATUS_QUEUED; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(js->GetJobStatus(parked) != JOB_STATUS_QUEUED);
+
+    client.DestroyJobSystem();
+    daemon.Stop();
+    serving.join();
+    CHECK(stat(socketPath.c_str(), &socketStat) != 0);
+    js->Unregister("daemonEcho");
+    js->Unregister("daemonParked");
+}
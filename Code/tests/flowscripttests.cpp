@@ -0,0 +1,238 @@
+#include "test.h"
+#include "../flowscript.h"
+#include "../flowexpression.h"
+
+// Lexer, parser and module inliner
+
+static std::vector<FlowToken> lex(const std::string &source)
+{
+    FlowScriptLexer lexer(source.data(), source.size());
+    std::vector<FlowToken> tokens;
+    do
+        tokens.push_back(lexer.next());
+    while (tokens.back().type != FLOW_TOKEN_END && tokens.back().type != FLOW_TOKEN_INVALID);
+    return tokens;
+}
+
+static bool parseAndInline(const std::string &source, std::vector<FlowStatement> &statements, std::string &error)
+{
+    FlowScriptParser parser(source.data(), source.size());
+    std::vector<FlowGraph> graphs;
+    if (!parser.parse(graphs))
+    {
+        error = parser.getErrorMessage();
+        return false;
+    }
+    FlowModuleInliner inliner;
+    if (!inliner.inlineModules(graphs, statements))
+    {
+        error = inliner.getErrorMessage();
+        return false;
+    }
+    return true;
+}
+
+TEST(lexerTokensAndSpans)
+{
+    std::string source = "a -> \"b c\" [label=x]; // comment\n 1.5 -- }";
+    std::vector<FlowToken> tokens = lex(source);
+    std::vector<FlowTokenType> types = {FLOW_TOKEN_ID, FLOW_TOKEN_ARROW, FLOW_TOKEN_STRING, FLOW_TOKEN_LEFT_BRACKET, FLOW_TOKEN_ID, FLOW_TOKEN_EQUALS, FLOW_TOKEN_ID,
+                                        FLOW_TOKEN_RIGHT_BRACKET, FLOW_TOKEN_SEMICOLON, FLOW_TOKEN_NUMBER, FLOW_TOKEN_UNDIRECTED_EDGE, FLOW_TOKEN_RIGHT_BRACE, FLOW_TOKEN_END};
+    CHECK(tokens.size() == types.size());
+    for (size_t i = 0; i < tokens.size() && i < types.size(); i++)
+        CHECK(tokens[i].type == types[i]);
+
+    // Strings keep their quotes, the comment is skipped and lines count from 1
+    CHECK(tokens[2].text == "\"b c\"");
+    CHECK(tokens[2].span.line == 1 && tokens[2].span.column == 6 && tokens[2].span.endColumn == 11);
+    CHECK(tokens[9].text == "1.5");
+    CHECK(tokens[9].span.line == 2 && tokens[9].span.column == 2);
+}
+
+TEST(lexerReportsUnterminatedString)
+{
+    std::vector<FlowToken> tokens = lex("a -> \"open");
+    CHECK(tokens.back().type == FLOW_TOKEN_INVALID);
+    CHECK(tokens.back().text == "Missing closing quote");
+    CHECK(tokens.back().span.line == 1 && tokens.back().span.column == 6);
+}
+
+TEST(parserBuildsStatements)
+{
+    std::string source = "digraph g {\n  node [shape=box]\n  a -> b -> c [style=dashed]\n  rankdir = LR\n  d\n}\n";
+    FlowScriptParser parser(source.data(), source.size());
+    std::vector<FlowGraph> graphs;
+    CHECK(parser.parse(graphs));
+    CHECK(graphs.size() == 1);
+    if (graphs.size() != 1 || graphs[0].statements.size() != 4)
+    {
+        CHECK(false);
+        return;
+    }
+
+    const std::vector<FlowStatement> &statements = graphs[0].statements;
+    CHECK(graphs[0].name == "g");
+    CHECK(statements[0].type == FLOW_STATEMENT_DEFAULTS && statements[0].target == "node");
+    CHECK(statements[1].type == FLOW_STATEMENT_EDGE && statements[1].nodes.size() == 3);
+    CHECK(statements[1].nodes[2].id == "c");
+    CHECK(statements[1].attributes.size() == 1 && statements[1].attributes[0].name == "style" && statements[1].attributes[0].value == "dashed");
+    CHECK(statements[2].type == FLOW_STATEMENT_GRAPH_ATTRIBUTE && statements[2].attributes[0].value == "LR");
+    CHECK(statements[3].type == FLOW_STATEMENT_NODE && statements[3].nodes[0].id == "d");
+}
+
+TEST(parserStopsAtFirstError)
+{
+    std::string source = "digraph {\n a -> \n}";
+    FlowScriptParser parser(source.data(), source.size());
+    std::vector<FlowGraph> graphs;
+    CHECK(!parser.parse(graphs));
+    CHECK(parser.getErrorMessage() == "Expected a process name");
+    CHECK(parser.getErrorSpan().line == 3 && parser.getErrorSpan().column == 1);
+}
+
+TEST(inlinerExpandsModulesWithParameters)
+{
+    std::string source = "digraph g {\n"
+                         "  subgraph step {\n"
+                         "    level = 1\n"
+                         "    input -> work\n"
+                         "    work [label=\"L${level}\"]\n"
+                         "    work -> output\n"
+                         "  }\n"
+                         "  input -> build -> output\n"
+                         "  build [module=step, level=3]\n"
+                         "}\n";
+    std::vector<FlowStatement> statements;
+    std::string error;
+    CHECK(parseAndInline(source, statements, error));
+
+    // The module adds no nodes of its own: the edges go straight to its renamed copy
+    std::vector<std::string> edges;
+    std::string label;
+    for (const FlowStatement &statement : statements)
+    {
+        if (statement.type == FLOW_STATEMENT_EDGE)
+            edges.push_back(statement.nodes[0].id + "->" + statement.nodes[1].id);
+        for (const FlowAttribute &attribute : statement.attributes)
+        {
+            if (attribute.name == "label")
+                label = attribute.value;
+        }
+    }
+    CHECK(edges == std::vector<std::string>({"input->build/work", "build/work->output"}));
+    CHECK(label == "L3");
+}
+
+TEST(inlinerRejectsRecursiveAndUnknownModules)
+{
+    std::vector<FlowStatement> statements;
+    std::string error;
+    CHECK(!parseAndInline("digraph g {\n subgraph loop {\n input -> x\n x -> output\n x [module=loop]\n }\n input -> y -> output\n y [module=loop]\n}\n", statements, error));
+    CHECK(error == "Module \"loop\" includes itself");
+
+    statements.clear();
+    CHECK(!parseAndInline("digraph g {\n input -> y -> output\n y [module=nothere]\n}\n", statements, error));
+    CHECK(error == "Unknown module \"nothere\"");
+}
+
+// Expression VM
+
+static json evaluate(const std::string &source, const json &payload)
+{
+    FlowExpression expression;
+    if (!expression.compile(source))
+        return "compile error: " + expression.getErrorMessage();
+    return expression.evaluate(payload);
+}
+
+TEST(expressionEvaluation)
+{
+    json payload = json::parse(R"({"status": "ok", "n": 5, "items": [{"id": 7}], "flag": false, "name": "b"})");
+    CHECK(evaluate("status == \"ok\"", payload) == true);
+    CHECK(evaluate("n > 3 && n <= 5", payload) == true);
+    CHECK(evaluate("n == 5.0", payload) == true);
+    CHECK(evaluate("1e2 == 100 and -2 < 0", payload) == true);
+    CHECK(evaluate("items[0].id == 7", payload) == true);
+    CHECK(evaluate("$[\"status\"]", payload) == "ok");
+    CHECK(evaluate("name < \"c\"", payload) == true);
+    CHECK(evaluate("not (n > 1) or status == 'ok'", payload) == true);
+
+    // Missing fields are null, and values of different types are never equal
+    CHECK(evaluate("$.items[1].id", payload).is_null());
+    CHECK(evaluate("missing == null", payload) == true);
+    CHECK(evaluate("n == \"5\"", payload) == false);
+    CHECK(evaluate("n != \"5\"", payload) == true);
+
+    // && and || give booleans, not the operand
+    CHECK(evaluate("flag || name", payload) == true);
+    CHECK(evaluate("!flag", payload) == true);
+}
+
+TEST(expressionCompileErrors)
+{
+    struct
+    {
+        const char *source;
+        const char *message;
+        int column;
+    } cases[] = {
+        {"n >", "Condition ends too early", 4},
+        {"n == == 1", "Unexpected \"=\"", 6},
+        {"(n", "Missing )", 3},
+        {"items[99999999999]", "Index too large", 7},
+        {"\"abc", "Missing closing quote", 1},
+    };
+    for (const auto &testCase : cases)
+    {
+        FlowExpression expression;
+        CHECK(!expression.compile(testCase.source));
+        CHECK(expression.getErrorMessage() == testCase.message);
+        CHECK(expression.getErrorColumn() == testCase.column);
+    }
+}
+
+TEST(expressionKeysAndRawInput)
+{
+    std::string input = R"({"status": "ok", "n": 5})";
+    FlowExpression key;
+    CHECK(key.compile("status"));
+    CHECK(key.evaluateKey(input) == "ok");
+    CHECK(key.compile("n"));
+    CHECK(key.evaluateKey(input) == "5");
+
+    // Input that isn't JSON has no fields
+    FlowExpression condition;
+    CHECK(condition.compile("n > 1"));
+    CHECK(!condition.test(std::string("not json")));
+    CHECK(condition.test(std::string("{\"n\": 2}")));
+}
+
+TEST(expressionRoundTripAndLoadChecks)
+{
+    FlowExpression compiled;
+    CHECK(compiled.compile("a.b == 1 && (c || !d)"));
+    json saved = compiled.toJson();
+    json payload = json::parse(R"({"a": {"b": 1}, "d": false})");
+
+    FlowExpression loaded;
+    CHECK(loaded.fromJson(saved));
+    CHECK(loaded.evaluate(payload) == compiled.evaluate(payload));
+
+    // Loaded code is checked the way run() will execute it
+    json tampered = saved;
+    tampered["code"].push_back({12, 0}); // A pop too many
+    CHECK(!loaded.fromJson(tampered));
+    tampered = saved;
+    tampered["code"][0] = {12, 0}; // Pop from an empty stack
+    CHECK(!loaded.fromJson(tampered));
+    tampered["code"] = json::array();
+    for (int i = 0; i < 70; i++)
+        tampered["code"].push_back({0, 0}); // Deeper than the stack
+    CHECK(!loaded.fromJson(tampered));
+    tampered["code"] = {{0, 0}, {10, 0}}; // Jump backwards
+    CHECK(!loaded.fromJson(tampered));
+    tampered["code"] = {{0, 0}, {256, 0}}; // No such opcode
+    CHECK(!loaded.fromJson(tampered));
+    tampered["code"] = {{0, 99}}; // No such constant
+    CHECK(!loaded.fromJson(tampered));
+}
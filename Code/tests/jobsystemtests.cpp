@@ -0,0 +1,217 @@
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <filesystem>
+#include "test.h"
+#include "../lib/job.h"
+#include "../lib/jobsystem.h"
+#include "../lib/jobjournal.h"
+#include "../lib/jobdiskcache.h"
+
+// Queue capacities, the journal and the disk cache
+
+static std::string echoJob(std::string input)
+{
+    return input;
+}
+
+static void appendBytes(const std::string &path, const std::string &bytes)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    file << bytes;
+}
+
+static std::string readBytes(const std::string &path, size_t count)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string bytes(count, '\0');
+    file.read(&bytes[0], count);
+    bytes.resize(file.gcount());
+    return bytes;
+}
+
+TEST(queueCapacityRejectsWhenFull)
+{
+    JobSystem *js = JobSystem::CreateOrGet();
+    const int parkedTag = 4100, otherTag = 4101;
+
+    // No worker serves channel mask 0, so these stay queued
+    js->Register("parkedJob", new Job(echoJob, parkedTag, 0));
+    js->Register("otherParkedJob", new Job(echoJob, otherTag, 0));
+    js->SetJobTypeQueueCapacity(parkedTag, 2);
+
+    int first = js->CreateJob("parkedJob", "1", JOB_SUBMIT_FAIL_FAST, 0, {}, false);
+    int second = js->CreateJob("parkedJob", "2", JOB_SUBMIT_FAIL_FAST, 0, {}, false);
+    CHECK(first != -1 && second != -1);
+    CHECK(js->CreateJob("parkedJob", "3", JOB_SUBMIT_FAIL_FAST, 0, {}, false) == -1);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    CHECK(js->CreateJob("parkedJob", "4", JOB_SUBMIT_TRY, 20, {}, false) == -1);
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+    // Other job types have their own count
+    int other = js->CreateJob("otherParkedJob", "5", JOB_SUBMIT_FAIL_FAST, 0, {}, false);
+    CHECK(other != -1);
+
+    // A blocked submission goes through once a queued job leaves
+    int blocked = -1;
+    std::thread submitter([&]()
+                          { blocked = js->CreateJob("parkedJob", "6", JOB_SUBMIT_BLOCK, 0, {}, false); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(blocked == -1);
+    js->DestroyJob(first);
+    submitter.join();
+    CHECK(blocked != -1);
+    CHECK(js->GetJobStatus(blocked) == JOB_STATUS_QUEUED);
+
+    js->SetJobTypeQueueCapacity(parkedTag, JOB_QUEUE_UNBOUNDED);
+    CHECK(js->CreateJob("parkedJob", "7", JOB_SUBMIT_FAIL_FAST, 0, {}, false) != -1);
+
+    for (int jobID : {second, other, blocked})
+        js->DestroyJob(jobID);
+    js->Unregister("parkedJob");
+    js->Unregister("otherParkedJob");
+}
+
+TEST(waitForJobsWakesOnCompletion)
+{
+    JobSystem *js = JobSystem::CreateOrGet();
+    js->Register("waitedJob", new Job(echoJob, 4102));
+    int jobID = js->CreateJob("waitedJob", "\"x\"", JOB_SUBMIT_BLOCK, 0, {}, false);
+    CHECK(jobID != -1);
+    CHECK(js->WaitForJobs({jobID}) == std::vector<int>({jobID}));
+    CHECK(js->FinishJob(jobID) == "\"x\"");
+
+    // Jobs that are gone are reported too, they are never going to complete
+    CHECK(js->WaitForJobs({jobID, 1000000}, 1000).size() == 2);
+    js->Unregister("waitedJob");
+}
+
+TEST(journalReplaysIntactRecords)
+{
+    std::string path = tempPath("journal");
+    {
+        JobJournal journal;
+        CHECK(journal.Open(path, {}));
+        journal.RecordSubmit(1, "compile", "key1", "input1");
+        journal.RecordSubmit(2, "compile", "key2", "input2");
+        journal.RecordSubmit(3, "link", "key3", "input3");
+        journal.RecordComplete(1, "output1");
+        journal.RecordComplete(3, "output3");
+        journal.RecordRetire(3);
+        journal.Flush();
+        journal.Close();
+    }
+
+    // A crash in the middle of a write leaves part of a record behind
+    appendBytes(path, readBytes(path, 20));
+
+    std::vector<JobJournalEntry> entries = JobJournal::Replay(path);
+    CHECK(entries.size() == 3);
+    if (entries.size() != 3)
+        return;
+    CHECK(entries[0].m_jobID == 1 && entries[0].m_jobType == "compile" && entries[0].m_key == "key1" && entries[0].m_input == "input1");
+    CHECK(entries[0].m_completed && entries[0].m_output == "output1" && !entries[0].m_retired);
+    CHECK(entries[1].m_jobID == 2 && !entries[1].m_completed);
+    CHECK(entries[2].m_jobID == 3 && entries[2].m_completed && entries[2].m_retired);
+
+    // Carried over entries start the next journal
+    {
+        JobJournal journal;
+        CHECK(journal.Open(path, {entries[1]}));
+        journal.Close();
+    }
+    entries = JobJournal::Replay(path);
+    CHECK(entries.size() == 1 && entries[0].m_jobID == 2 && entries[0].m_input == "input2");
+}
+
+TEST(journalKeepsOutUnjournaledJobs)
+{
+    std::string path = tempPath("secretjournal");
+    JobSystem js;
+    js.CreateWorkerThread("JournalWorker");
+    CHECK(js.EnableJournal(path));
+    CHECK(!js.EnableJournal(path)); // Jobs record to the first one without a lock
+
+    js.Register("journaledJob", new Job(echoJob, 4103));
+    int shared = js.CreateJob("journaledJob", "\"public\"");
+    int secret = js.CreateJob("journaledJob", "\"secret\"", JOB_SUBMIT_BLOCK, 0, {}, true, false);
+    CHECK(js.FinishJob(shared) == "\"public\"");
+    CHECK(js.FinishJob(secret) == "\"secret\"");
+    js.FlushJournal();
+
+    std::string contents = readBytes(path, 1 << 20);
+    CHECK(contents.find("public") != std::string::npos);
+    CHECK(contents.find("secret") == std::string::npos);
+}
+
+TEST(diskCacheDropsTornTail)
+{
+    std::string path = tempPath("diskcache");
+    size_t intactSize = 0;
+    {
+        JobDiskCache cache;
+        CHECK(cache.Open(path));
+        cache.Store("first", "one");
+        cache.Store("second", "two");
+        cache.Store("first", "uno");
+        cache.Erase("second");
+        std::string output;
+        CHECK(cache.Lookup("first", output) && output == "uno");
+        CHECK(!cache.Lookup("second", output));
+        cache.Close();
+    }
+
+    // Reopening alone compacts away the replaced and erased records
+    {
+        JobDiskCache cache;
+        CHECK(cache.Open(path));
+        intactSize = cache.GetFileSize();
+        cache.Close();
+    }
+    CHECK(intactSize > 0 && intactSize == std::filesystem::file_size(path));
+
+    // A writer that died mid-record
+    appendBytes(path, readBytes(path, 30));
+
+    JobDiskCache cache;
+    CHECK(cache.Open(path));
+    CHECK(cache.GetFileSize() == intactSize);
+    std::string output;
+    CHECK(cache.Lookup("first", output) && output == "uno");
+    CHECK(!cache.Lookup("second", output));
+
+    // Appending goes on after the intact records
+    cache.Store("third", "three");
+    cache.Close();
+    CHECK(cache.Open(path));
+    CHECK(cache.Lookup("third", output) && output == "three");
+    CHECK(cache.Lookup("first", output) && output == "uno");
+    cache.Close();
+}
+
+TEST(diskCacheKeepsATornTailWhileShared)
+{
+    std::string path = tempPath("shareddiskcache");
+    JobDiskCache first;
+    CHECK(first.Open(path));
+    first.Store("kept", "one");
+
+    // Another process still has it open, so the tail can't be cut and nothing goes behind it
+    JobDiskCache second;
+    CHECK(second.Open(path));
+    appendBytes(path, readBytes(path, 30));
+    second.Store("lost", "two");
+    std::string output;
+    CHECK(!second.Lookup("lost", output));
+    CHECK(second.Lookup("kept", output) && output == "one");
+    first.Close();
+    second.Close();
+
+    // The next sole opener cuts it off, and stores work again
+    CHECK(first.Open(path));
+    first.Store("stored", "three");
+    CHECK(first.Lookup("stored", output) && output == "three");
+    first.Close();
+    CHECK(!first.IsOpen());
+}
@@ -0,0 +1,51 @@
+#include <filesystem>
+#include "test.h"
+#include "../lib/jobsystem.h"
+
+std::vector<TestCase> &testCases()
+{
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+int &testFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+std::string tempPath(const std::string &name)
+{
+    std::filesystem::path path = std::filesystem::temp_directory_path() / ("flowtests-" + name);
+    std::filesystem::remove(path);
+    std::filesystem::remove(path.string() + ".lock");
+    return path.string();
+}
+
+// Runs every test, or only those whose name contains the first argument
+int main(int argc, char **argv)
+{
+    std::string filter = argc > 1 ? argv[1] : "";
+
+    // Worker process tests need the spawner, forked while this is the only thread
+    JobSystem::EnableWorkerProcesses();
+
+    // At least one worker, however few cores the machine has
+    JobSystem::CreateOrGet()->CreateWorkerThread("TestWorker");
+
+    int failedTests = 0, ranTests = 0;
+    for (const TestCase &testCase : testCases())
+    {
+        if (std::string(testCase.name).find(filter) == std::string::npos)
+            continue;
+        std::cout << testCase.name << std::endl;
+        int failuresBefore = testFailures();
+        testCase.run();
+        failedTests += testFailures() > failuresBefore;
+        ranTests++;
+    }
+
+    JobSystem::Destroy();
+    std::cout << ranTests - failedTests << " of " << ranTests << " tests passed" << std::endl;
+    return failedTests == 0 ? 0 : 1;
+}
@@ -0,0 +1,258 @@
+#include <fstream>
+#include "test.h"
+#include "../interpreter.h"
+
+// Compiling FlowScript into a plan, the optimizer, and storing plans
+
+static std::string unwrap(const std::string &input)
+{
+    // Job inputs arrive as JSON, a string output of the previous job comes back quoted
+    json value = json::parse(input, nullptr, false);
+    return value.is_string() ? value.get<std::string>() : input;
+}
+
+static std::string appendA(std::string input)
+{
+    return unwrap(input) + "a";
+}
+
+static std::string appendB(std::string input)
+{
+    return unwrap(input) + "b";
+}
+
+static std::string writeGraph(const std::string &name, const std::string &source)
+{
+    std::string path = tempPath(name + ".dot");
+    std::ofstream file(path);
+    file << source;
+    return path;
+}
+
+static std::shared_ptr<const FlowPlan> compile(Interpreter &interpreter, const std::string &name, const std::string &source)
+{
+    interpreter.registerJob("planA", new Job(appendA, 1));
+    interpreter.registerJob("planB", new Job(appendB, 2));
+    interpreter.loadFile(writeGraph(name, source));
+    interpreter.parse();
+    return interpreter.getErrorCode() == 0 ? interpreter.getPlan() : nullptr;
+}
+
+static int findNode(const FlowPlan &plan, const std::string &name)
+{
+    for (int node = 0; node < plan.size(); node++)
+    {
+        if (plan.names[node] == name)
+            return node;
+    }
+    return -1;
+}
+
+static bool isWellFormed(const FlowPlan &plan)
+{
+    bool wellFormed = (int)plan.successorOffsets.size() == plan.size() + 1 && plan.successorOffsets[0] == 0 && plan.successorOffsets.back() == (int)plan.successors.size();
+    for (int node = 0; wellFormed && node < plan.size(); node++)
+        wellFormed = plan.successorOffsets[node] <= plan.successorOffsets[node + 1];
+    for (int successor : plan.successors)
+        wellFormed = wellFormed && successor >= 0 && successor < plan.size();
+    return wellFormed && plan.isAcyclic();
+}
+
+TEST(compilerFusesStraightChains)
+{
+    Interpreter interpreter;
+    std::shared_ptr<const FlowPlan> plan = compile(interpreter, "chain", "digraph g {\n input -> planA -> planB -> output\n}\n");
+    CHECK(plan);
+    if (!plan)
+        return;
+
+    // input, one fused job and output
+    CHECK(plan->size() == 3);
+    CHECK(isWellFormed(*plan));
+    int fused = plan->firstSuccessor(plan->inputNode);
+    CHECK(fused != -1 && plan->kinds[fused] == NODE_JOB);
+    CHECK(plan->jobNames[fused] == "planA+planB");
+    CHECK(plan->stageJobs[fused] == std::vector<std::string>({"planA", "planB"}));
+    CHECK(plan->jobTypeIDs[fused] != JOB_TYPE_ID_UNKNOWN);
+    CHECK(plan->kinds[plan->firstSuccessor(fused)] == NODE_OUTPUT);
+
+    Interpreter::execution state;
+    CHECK(interpreter.run("s", state) == "sab");
+}
+
+TEST(compilerKeepsUnfusedJobs)
+{
+    Interpreter interpreter;
+    std::shared_ptr<const FlowPlan> plan = compile(interpreter, "unfused", "digraph g {\n input -> planA -> planB -> output\n planB [fuse=false]\n}\n");
+    CHECK(plan);
+    if (!plan)
+        return;
+
+    CHECK(plan->size() == 4);
+    CHECK(isWellFormed(*plan));
+    int first = findNode(*plan, "planA"), second = findNode(*plan, "planB");
+    CHECK(first != -1 && second != -1);
+    CHECK(plan->stageJobs[first].empty() && plan->stageJobs[second].empty());
+    CHECK(plan->firstSuccessor(first) == second);
+
+    Interpreter::execution state;
+    CHECK(interpreter.run("s", state) == "sab");
+}
+
+TEST(compilerBuildsDecisions)
+{
+    Interpreter interpreter;
+    std::shared_ptr<const FlowPlan> plan = compile(interpreter, "decisions",
+                                                   "digraph g {\n"
+                                                   " check [shape=diamond, label=\"$.n > 3\"]\n"
+                                                   " kind [shape=trapezium, label=\"$.kind\"]\n"
+                                                   " input -> check\n"
+                                                   " check -> kind [label=\"true\"]\n"
+                                                   " check -> output [label=\"false\"]\n"
+                                                   " kind -> planA [label=\"a\"]\n"
+                                                   " kind -> planB [label=\"default\"]\n"
+                                                   " planA -> output\n"
+                                                   " planB -> output\n"
+                                                   "}\n");
+    CHECK(plan);
+    if (!plan)
+        return;
+
+    CHECK(isWellFormed(*plan));
+    int check = findNode(*plan, "check"), kind = findNode(*plan, "kind");
+    CHECK(check != -1 && plan->kinds[check] == NODE_IF);
+    CHECK(kind != -1 && plan->kinds[kind] == NODE_SWITCH);
+    if (check == -1 || kind == -1)
+        return;
+
+    const FlowIf &decision = plan->ifs[plan->decisionIDs[check]];
+    CHECK(decision.whenTrue == kind);
+    CHECK(plan->kinds[decision.whenFalse] == NODE_OUTPUT);
+    const FlowSwitch &dispatch = plan->switches[plan->decisionIDs[kind]];
+    CHECK(dispatch.cases.size() == 1 && dispatch.cases.at("a") == findNode(*plan, "planA"));
+    CHECK(dispatch.otherwise == findNode(*plan, "planB"));
+
+    // Decisions pass their input on unchanged
+    Interpreter::execution state;
+    CHECK(interpreter.run(R"({"n": 5, "kind": "a"})", state) == R"({"n": 5, "kind": "a"})" "a");
+    CHECK(interpreter.run(R"({"n": 5, "kind": "z"})", state) == R"({"n": 5, "kind": "z"})" "b");
+    CHECK(interpreter.run(R"({"n": 1})", state) == R"({"n": 1})");
+}
+
+TEST(compilerReportsGraphErrors)
+{
+    Interpreter interpreter;
+    CHECK(!compile(interpreter, "cycle", "digraph g {\n input -> planA -> planB -> planA\n planB -> output\n}\n"));
+    CHECK(interpreter.getErrorCode() != 0);
+
+    Interpreter unknown;
+    CHECK(!compile(unknown, "unknown", "digraph g {\n input -> notRegistered -> output\n}\n"));
+    CHECK(unknown.getErrorCode() != 0);
+}
+
+TEST(planRoundTrip)
+{
+    Interpreter interpreter;
+    std::shared_ptr<const FlowPlan> plan = compile(interpreter, "roundtrip",
+                                                   "digraph g {\n"
+                                                   " split [shape=point]\n"
+                                                   " check [shape=diamond, label=\"$.n > 3\"]\n"
+                                                   " input -> check\n"
+                                                   " check -> split [label=\"true\"]\n"
+                                                   " check -> output [label=\"false\"]\n"
+                                                   " split -> planA [style=dashed]\n"
+                                                   " split -> planB [style=dashed]\n"
+                                                   " split -> output\n"
+                                                   " planB [concurrency=2, queue=4]\n"
+                                                   "}\n");
+    CHECK(plan);
+    if (!plan)
+        return;
+
+    json saved = plan->toJson();
+    FlowPlan loaded;
+    CHECK(loaded.fromJson(json::parse(saved.dump())));
+    CHECK(loaded.toJson() == saved);
+    CHECK(loaded.size() == plan->size());
+    CHECK(loaded.ifs.size() == 1 && loaded.ifs[0].condition.test(std::string(R"({"n": 4})")));
+    int limited = findNode(loaded, "planB");
+    CHECK(limited != -1 && loaded.stageLimits[limited] == 2 && loaded.stageQueues[limited] == 4);
+
+    // Job type IDs belong to one job system, they are resolved again after loading
+    for (int node = 0; node < loaded.size(); node++)
+        CHECK(loaded.jobTypeIDs[node] == JOB_TYPE_ID_UNKNOWN);
+}
+
+TEST(planLoadRejectsBrokenPlans)
+{
+    Interpreter interpreter;
+    std::shared_ptr<const FlowPlan> plan = compile(interpreter, "broken", "digraph g {\n input -> planA -> output\n}\n");
+    CHECK(plan);
+    if (!plan)
+        return;
+    json saved = plan->toJson();
+    FlowPlan loaded;
+
+    json broken = saved;
+    broken["successors"].push_back(0); // One more edge than the offsets say
+    CHECK(!loaded.fromJson(broken));
+    CHECK(loaded.size() == 0);
+
+    broken = saved;
+    broken["names"].erase(0); // Arrays have to line up
+    CHECK(!loaded.fromJson(broken));
+
+    // An edge from the output back to the job would go around forever
+    int output = findNode(*plan, "output"), job = findNode(*plan, "planA");
+    std::vector<int> offsets = plan->successorOffsets, successors = plan->successors;
+    successors.insert(successors.begin() + offsets[output + 1], job);
+    for (int node = output + 1; node < (int)offsets.size(); node++)
+        offsets[node]++;
+    broken = saved;
+    broken["successor_offsets"] = offsets;
+    broken["successors"] = successors;
+    broken["edge_labels"].push_back("");
+    broken["edge_dashed"].push_back(0);
+    CHECK(!loaded.fromJson(broken));
+
+    broken = saved;
+    broken["stage_limits"][0] = -1;
+    CHECK(!loaded.fromJson(broken));
+
+    CHECK(loaded.fromJson(saved));
+}
+
+TEST(planCacheSkipsParsing)
+{
+    std::string cachePath = tempPath("plans.cache");
+    std::string graph = "digraph g {\n input -> planA -> planB -> output\n}\n";
+    {
+        Interpreter interpreter;
+        interpreter.enablePlanCache(cachePath);
+        CHECK(compile(interpreter, "cached", graph));
+    }
+
+    // A new interpreter finds the plan on disk and resolves its jobs again
+    Interpreter interpreter;
+    interpreter.enablePlanCache(cachePath);
+    std::shared_ptr<const FlowPlan> plan = compile(interpreter, "cached", graph);
+    CHECK(plan);
+    Interpreter::execution state;
+    CHECK(interpreter.run("s", state) == "sab");
+}
+
+TEST(runBatchKeepsInputOrder)
+{
+    Interpreter interpreter;
+    CHECK(compile(interpreter, "batch", "digraph g {\n input -> planA -> planB -> output\n planB [fuse=false, concurrency=1]\n}\n"));
+
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 20; i++)
+        inputs.push_back(std::to_string(i));
+    Interpreter::batchStats stats;
+    std::vector<Interpreter::batchResult> results = interpreter.runBatch(inputs, 4, true, stats);
+    CHECK(results.size() == inputs.size());
+    for (size_t i = 0; i < results.size(); i++)
+        CHECK(results[i].index == i && results[i].output == inputs[i] + "ab");
+    CHECK(stats.inputs == inputs.size() && stats.errors == 0);
+}
@@ -0,0 +1,21 @@
+#include <string>
+#include "../../lib/jobplugin.h"
+
+// Built by plugintests.cpp, once per PLUGIN_VERSION
+
+static std::string pluginVersion(std::string input)
+{
+    return std::to_string(PLUGIN_VERSION);
+}
+
+#if PLUGIN_VERSION == 1
+static std::string pluginDropped(std::string input)
+{
+    return input;
+}
+
+JOB_PLUGIN_EXPORTS({"pluginVersion", pluginVersion, nullptr, 4117, 0xFFFFFFFF},
+                   {"pluginDropped", pluginDropped, nullptr, 4118, 0xFFFFFFFF})
+#else
+JOB_PLUGIN_EXPORTS({"pluginVersion", pluginVersion, nullptr, 4117, 0xFFFFFFFF})
+#endif
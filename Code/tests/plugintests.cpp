@@ -0,0 +1,47 @@
+#include <cstdlib>
+#include <filesystem>
+#include "test.h"
+#include "../lib/jobsystem.h"
+#include "../lib/jobpluginloader.h"
+
+// Job plugins, built here from tests/plugins
+
+static bool buildPlugin(const std::string &path, int version)
+{
+    // Tests run from Code/, like the makefile
+    std::string command = "clang++ -std=c++20 -shared -fPIC -DPLUGIN_VERSION=" + std::to_string(version) +
+                          " -o " + path + " ./tests/plugins/reloadplugin.cpp";
+    return std::system(command.c_str()) == 0;
+}
+
+TEST(pluginReloadKeepsQueuedJobsOnTheirBuild)
+{
+    std::string directory = tempPath("plugins");
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::string pluginPath = directory + "/reload.so";
+
+    // No worker yet, so jobs stay queued across the reload
+    JobSystem js;
+    JobPluginLoader loader(&js);
+    CHECK(buildPlugin(pluginPath, 1));
+    CHECK(loader.LoadDirectory(directory) == 1);
+    CHECK(loader.ReloadChanged() == 0);
+    int oldBuild = js.CreateJob("pluginVersion", "1");
+    CHECK(oldBuild != -1 && js.CreateJob("pluginDropped", "1") != -1);
+
+    CHECK(buildPlugin(pluginPath, 2));
+    CHECK(loader.ReloadChanged() == 1);
+    int newBuild = js.CreateJob("pluginVersion", "2");
+    CHECK(js.CreateJob("pluginDropped", "2") == -1);
+
+    js.CreateWorkerThread("PluginWorker");
+    CHECK(js.FinishJob(oldBuild) == "1");
+    CHECK(js.FinishJob(newBuild) == "2");
+
+    // Unloading takes its job types with it
+    loader.Unload(pluginPath);
+    CHECK(loader.GetPlugins().empty());
+    CHECK(js.CreateJob("pluginVersion", "3") == -1);
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,113 @@
+#include <csignal>
+#include <vector>
+#include <unistd.h>
+#include "test.h"
+#include "../lib/job.h"
+#include "../lib/jobsystem.h"
+#include "../lib/jobsharedring.h"
+#include "../lib/json.hpp"
+using json = nlohmann::json;
+
+// Worker processes
+
+static std::string processID(std::string input)
+{
+    return std::to_string(getpid());
+}
+
+static std::string processEcho(std::string input)
+{
+    return input;
+}
+
+static std::string crashProcess(std::string input)
+{
+    // Leave a mark for every run, then die the way a segfault would
+    std::string path = json::parse(input).get<std::string>();
+    FILE *runs = fopen(path.c_str(), "a");
+    fputc('x', runs);
+    fclose(runs);
+    raise(SIGKILL);
+    return "";
+}
+
+TEST(workerProcessRestartsAfterACrash)
+{
+    std::string runsPath = tempPath("crashruns");
+
+    // A job system of its own, so no worker thread takes these jobs
+    JobSystem js;
+    js.Register("processID", new Job(processID, 4106));
+    js.Register("crashProcess", new Job(crashProcess, 4107));
+    js.CreateWorkerProcess("TestProcess");
+
+    int before = js.CreateJob("processID", "1");
+    std::string firstChild = js.FinishJob(before);
+    CHECK(!firstChild.empty() && firstChild != std::to_string(getpid()));
+
+    // The crashing job fails once instead of taking a second child with it
+    int crash = js.CreateJob("crashProcess", json(runsPath).dump());
+    CHECK(js.FinishJob(crash) == "ERROR: Job crashed its worker process");
+    FILE *runs = fopen(runsPath.c_str(), "r");
+    int numRuns = 0;
+    while (runs && fgetc(runs) != EOF)
+        numRuns++;
+    if (runs)
+        fclose(runs);
+    CHECK(numRuns == 1);
+
+    // The next job gets a new child
+    int after = js.CreateJob("processID", "2");
+    std::string secondChild = js.FinishJob(after);
+    CHECK(!secondChild.empty() && secondChild != firstChild && secondChild != std::to_string(getpid()));
+}
+
+TEST(sharedRingWrapsAndRefusesWhenFull)
+{
+    JobSharedRing producer;
+    CHECK(producer.Create(64));
+
+    // The other side maps the same bytes through the descriptor
+    JobSharedRing consumer;
+    CHECK(consumer.Attach(dup(producer.GetDescriptor()), 64));
+
+    std::string first(40, 'a'), second(40, 'b');
+    uint64_t firstPosition = 0, secondPosition = 0;
+    CHECK(producer.Write(first.data(), first.size(), firstPosition) && firstPosition == 0);
+    CHECK(!producer.Write(second.data(), second.size(), secondPosition)); // Not read yet
+    CHECK(!producer.Write(std::string(65, 'c').data(), 65, secondPosition));
+
+    std::string output;
+    consumer.Read(firstPosition, first.size(), output);
+    CHECK(output == first);
+
+    // Too close to the end to fit, so it starts over at the beginning
+    CHECK(producer.Write(second.data(), second.size(), secondPosition) && secondPosition == 64);
+    output.clear();
+    consumer.Read(secondPosition, second.size(), output);
+    CHECK(output == second);
+
+    producer.Reset();
+    CHECK(producer.Write(first.data(), first.size(), firstPosition) && firstPosition == 0);
+}
+
+TEST(workerProcessPassesBigPayloadsInSharedMemory)
+{
+    JobSystem js;
+    js.Register("processEcho", new Job(processEcho, 4116));
+    js.CreateWorkerProcess("RingProcess");
+
+    // Over the shared ring threshold both ways, and more than the ring holds at once
+    std::vector<int> jobIDs;
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 8; i++)
+    {
+        inputs.push_back(json(std::string(4 * 1024 * 1024, 'a' + i)).dump());
+        jobIDs.push_back(js.CreateJob("processEcho", inputs.back()));
+    }
+    for (int i = 0; i < 8; i++)
+        CHECK(js.FinishJob(jobIDs[i]) == inputs[i]);
+
+    // Small ones still go inline
+    CHECK(js.FinishJob(js.CreateJob("processEcho", "\"small\"")) == "\"small\"");
+}
@@ -0,0 +1,115 @@
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "test.h"
+#include "../lib/job.h"
+#include "../lib/jobsystem.h"
+#include "../lib/jobreadyring.h"
+
+// The lock-free ready ring, alone and in front of the locked queue
+
+static std::mutex s_runOrderMutex;
+static std::vector<int> s_runOrder;
+
+static std::string recordRun(std::string input)
+{
+    s_runOrderMutex.lock();
+    s_runOrder.push_back(std::stoi(input));
+    s_runOrderMutex.unlock();
+    return input;
+}
+
+TEST(readyRingIsBoundedAndFifo)
+{
+    JobReadyRing ring(5);
+    CHECK(ring.GetCapacity() == 8);
+    for (uintptr_t i = 1; i <= 8; i++)
+        CHECK(ring.Push((Job *)i));
+    CHECK(!ring.Push((Job *)9));
+    for (uintptr_t i = 1; i <= 8; i++)
+        CHECK(ring.Pop() == (Job *)i);
+    CHECK(ring.Pop() == nullptr);
+}
+
+TEST(readyRingHandsOutEveryJobOnce)
+{
+    const int numThreads = 4, numPerProducer = 20000;
+    JobReadyRing ring(64);
+    std::vector<std::vector<uintptr_t>> popped(numThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads.emplace_back([&, t]()
+                             {
+                                 for (int i = 0; i < numPerProducer; i++)
+                                 {
+                                     while (!ring.Push((Job *)(uintptr_t)(t * numPerProducer + i + 1)))
+                                         std::this_thread::yield();
+                                 }
+                             });
+        threads.emplace_back([&, t]()
+                             {
+                                 while ((int)popped[t].size() < numPerProducer)
+                                 {
+                                     if (Job *job = ring.Pop())
+                                         popped[t].push_back((uintptr_t)job);
+                                     else
+                                         std::this_thread::yield();
+                                 }
+                             });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    std::vector<uintptr_t> all;
+    for (const std::vector<uintptr_t> &consumed : popped)
+        all.insert(all.end(), consumed.begin(), consumed.end());
+    std::sort(all.begin(), all.end());
+    CHECK((int)all.size() == numThreads * numPerProducer);
+    bool eachOnce = true;
+    for (size_t i = 0; i < all.size(); i++)
+        eachOnce = eachOnce && all[i] == i + 1;
+    CHECK(eachOnce);
+}
+
+TEST(spilledJobsRunBeforeLaterOnes)
+{
+    // Nothing runs until the worker starts, so the ring fills up and the rest spills over
+    JobSystem js;
+    js.Register("recordRun", new Job(recordRun, 4113));
+    s_runOrder.clear();
+    int numJobs = 4096 + 100;
+    std::vector<int> jobIDs;
+    for (int i = 0; i < numJobs; i++)
+        jobIDs.push_back(js.CreateJob("recordRun", std::to_string(i)));
+
+    // Submitted while the worker frees ring slots, these still go behind the spilled jobs
+    js.CreateWorkerThread("RingWorker");
+    for (int i = numJobs; i < numJobs + 1000; i++)
+        jobIDs.push_back(js.CreateJob("recordRun", std::to_string(i)));
+    for (int jobID : jobIDs)
+        js.FinishJob(jobID);
+
+    s_runOrderMutex.lock();
+    CHECK((int)s_runOrder.size() == numJobs + 1000);
+    CHECK(std::is_sorted(s_runOrder.begin(), s_runOrder.end()));
+    s_runOrderMutex.unlock();
+}
+
+TEST(capacityCountsJobsInTheRing)
+{
+    JobSystem js;
+    const int tag = 4114;
+    js.Register("ringParked", new Job(recordRun, tag));
+    for (int i = 0; i < 100; i++)
+        CHECK(js.CreateJob("ringParked", std::to_string(i)) != -1);
+
+    // All 100 are still in the ring when the first capacity is set
+    js.SetJobTypeQueueCapacity(tag, 100);
+    CHECK(js.CreateJob("ringParked", "100", JOB_SUBMIT_FAIL_FAST) == -1);
+    js.SetJobTypeQueueCapacity(tag, 101);
+    CHECK(js.CreateJob("ringParked", "101", JOB_SUBMIT_FAIL_FAST) != -1);
+    CHECK(js.CreateJob("ringParked", "102", JOB_SUBMIT_FAIL_FAST) == -1);
+}
@@ -0,0 +1,72 @@
+#include <atomic>
+#include "test.h"
+#include "../lib/job.h"
+#include "../lib/jobsystem.h"
+#include "../lib/jobresultcache.h"
+
+// The in-memory result cache, alone and behind CreateJob
+
+static std::atomic<int> s_numCountedRuns{0};
+
+static std::string countedEcho(std::string input)
+{
+    s_numCountedRuns++;
+    return input;
+}
+
+TEST(resultCacheEvictsLeastRecentlyUsed)
+{
+    // Each entry is a 1-byte key and a 9-byte output, so three fit
+    JobResultCache cache(30);
+    cache.Store("a", "000000000");
+    cache.Store("b", "111111111");
+    cache.Store("c", "222222222");
+    std::string output;
+    CHECK(cache.Lookup("a", output) && output == "000000000"); // "b" is now the oldest
+
+    cache.Store("d", "333333333");
+    CHECK(!cache.Lookup("b", output));
+    CHECK(cache.Lookup("a", output) && cache.Lookup("c", output) && cache.Lookup("d", output));
+
+    JobResultCacheStats stats = cache.GetStats();
+    CHECK(stats.m_hits == 4 && stats.m_misses == 1 && stats.m_diskHits == 0);
+    CHECK(stats.m_evictions == 1 && stats.m_numEntries == 3 && stats.m_sizeBytes == 30);
+
+    // Replacing an entry doesn't count it twice, and outputs bigger than the cache aren't kept
+    cache.Store("a", "444444444");
+    CHECK(cache.GetStats().m_sizeBytes == 30);
+    cache.Store("e", std::string(40, 'x'));
+    CHECK(!cache.Lookup("e", output));
+
+    // Shrinking drops the oldest until it fits
+    cache.SetMaxBytes(10);
+    stats = cache.GetStats();
+    CHECK(stats.m_numEntries == 1 && stats.m_evictions == 3 && stats.m_maxBytes == 10);
+    CHECK(cache.Lookup("a", output) && output == "444444444");
+}
+
+TEST(resultCacheSkipsRepeatedJobs)
+{
+    JobSystem js;
+    js.CreateWorkerThread("CacheWorker");
+    js.EnableResultCache(1024);
+    js.Register("countedEcho", new Job(countedEcho, 4115));
+    js.SetJobCacheable("countedEcho");
+    s_numCountedRuns = 0;
+
+    CHECK(js.FinishJob(js.CreateJob("countedEcho", "\"x\"")) == "\"x\"");
+    CHECK(js.FinishJob(js.CreateJob("countedEcho", "\"x\"")) == "\"x\"");
+    CHECK(js.FinishJob(js.CreateJob("countedEcho", "\"y\"")) == "\"y\"");
+    CHECK(s_numCountedRuns == 2);
+
+    // Asking for a fresh run neither reads nor counts against the cache
+    CHECK(js.FinishJob(js.CreateJob("countedEcho", "\"x\"", JOB_SUBMIT_BLOCK, 0, {}, false)) == "\"x\"");
+    CHECK(s_numCountedRuns == 3);
+
+    JobResultCacheStats stats = js.GetResultCacheStats();
+    CHECK(stats.m_hits == 1 && stats.m_misses == 2 && stats.m_numEntries == 2);
+
+    js.InvalidateCachedJob("countedEcho", "\"x\"");
+    CHECK(js.FinishJob(js.CreateJob("countedEcho", "\"x\"")) == "\"x\"");
+    CHECK(s_numCountedRuns == 4);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Just enough of a test framework: TEST(name) defines a test that registers itself, and
+// CHECK reports a failed condition with its file and line and lets the test go on.
+
+struct TestCase
+{
+    const char *name;
+    void (*run)();
+};
+
+std::vector<TestCase> &testCases();
+int &testFailures();
+
+inline bool registerTest(const char *name, void (*run)())
+{
+    testCases().push_back({name, run});
+    return true;
+}
+
+#define TEST(name)                                                   \
+    static void name();                                              \
+    static bool name##Registered = registerTest(#name, name);       \
+    static void name()
+
+#define CHECK(condition)                                                                               \
+    do                                                                                                 \
+    {                                                                                                  \
+        if (!(condition))                                                                              \
+        {                                                                                              \
+            std::cout << "  FAILED " << __FILE__ << ":" << __LINE__ << ": " << #condition << std::endl; \
+            testFailures()++;                                                                          \
+        }                                                                                              \
+    } while (0)
+
+// A fresh path in the temp directory, nothing is left at it from an earlier run
+std::string tempPath(const std::string &name);